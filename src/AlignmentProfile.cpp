@@ -1,271 +1,1489 @@
 #include "structure.h"
+#include <unordered_map>
+#include <sched.h>
 
 #define shift 10
-#define MinBreakPointSize 20
+#define ProfileBlockShift 16
 
-map<int64_t, uint16_t> BreakPointMap;
-map<int64_t, map<string, uint16_t> > InsertSeqMap, DeleteSeqMap;
+// indel observations, sorted by position and sequence once mapping is done (BuildIndEventView)
+vector<IndEvent_t> InsertEventVec, DeleteEventVec;
+static vector<string> IndSpillSeqVec;
+static map<int64_t, map<string, uint32_t> > InsertSpillMap;
 
-bool CheckIndStrOccu(string& IndSeq, map<int64_t, map<string, uint16_t> >::iterator iter)
+#define ProfileEventBufSize (1 << 16)
+#define ProfileBaseBufSize (1 << 22)
+#define IndEventBufSize (1 << 16)
+// a thread applying its events gives up a block lock after this many events if other threads wait for the block
+#define MaxLockHoldEvents 1024
+#define MaxHandoffYields 64
+
+// profile event types: a run of base codes stored in ProfileBuffer_t::BaseVec, or a range increment of one counter
+#define EVENT_BASE 0
+#define EVENT_F1 1
+#define EVENT_R1 2
+#define EVENT_F2 3
+#define EVENT_R2 4
+#define EVENT_MULTI 5
+
+#define CellBaseMax 255
+#define CellStrandMax 63
+
+// one lock per 64Kb genome block replaces the global profile lock
+static int64_t ProfileBlockNum = 0;
+static int64_t ReleasedBlockNum = 0; // the calling stage has released the blocks before it (ReleaseProfilePages)
+static pthread_mutex_t* ProfileBlockLockArr = NULL;
+static int* ProfileBlockWaitArr = NULL; // threads waiting for each block lock
+// the profile is a directory of 64Kb pages of 8-byte cells, allocated on first touch (an untouched page reads as zero);
+// a column whose counts outgrow its cell moves to the overflow table of its block, which keeps the full MappingRecord_t counters
+static ProfileCell_t** ProfileCellPageArr = NULL;
+// in deep-coverage mode (bDeepCoverage) the pages hold 32-bit counters instead and need no overflow table
+static DeepProfileCell_t** DeepCellPageArr = NULL;
+static unordered_map<int64_t, MappingRecord_t>** OverflowColumnArr = NULL;
+// multi_hit range updates are kept as difference counts in per-block arrays allocated on first use,
+// and MaterializeRangeCounters() turns them into the counts in place
+static int32_t** MultiHitArr = NULL;
+
+typedef struct
+{
+	int64_t BlockBeg, BlockEnd, multi;
+} CounterSegment_t;
+
+static CounterSegment_t* CounterSegmentArr = NULL;
+
+// the profile has its own coordinates: the genome itself, or with target regions (-regions) only the padded targets,
+// widened to whole depth blocks and laid end to end, so that the pages, the locks and the depth arrays scale with the targets
+typedef struct
+{
+	int64_t gBeg, gEnd, pBeg; // genome [gBeg, gEnd) is profile [pBeg, pBeg + gEnd - gBeg)
+} ProfileRegion_t;
+
+int64_t ProfileSize = 0;
+static vector<ProfileRegion_t> ProfileRegionVec; // empty: the profile covers the genome
+// duplicate counts of the read starts outside the laid-out targets (guarded by ProfileLock)
+static unordered_map<int64_t, int> OffProfileReadCountMap;
+
+int CheckMismatch(vector<FragPair_t>& FragPairVec)
+{
+	int mis = 0;
+	vector<FragPair_t>::iterator iter;
+	for (iter = FragPairVec.begin(); iter != FragPairVec.end(); iter++)
+	{
+		if (!iter->bSimple && iter->rLen > 0 && iter->gLen > 0) mis += CalCigarOpLength(iter->cigar, CIGAR_X);
+	}
+	return mis;
+}
+
+string GetFragReadSeq(bool orientation, char* seq, FragPair_t& fp, int offset, int len)
+{
+	// read bases [offset, offset+len) of the fragment in the forward genome orientation
+	string str;
+
+	if (orientation) str.assign(seq + fp.rPos + offset, len);
+	else
+	{
+		str.assign(seq + fp.rPos + fp.rLen - offset - len, len);
+		SelfComplementarySeq(len, (char*)str.c_str());
+	}
+	return str;
+}
+
+static inline uint8_t GetProfileBaseCode(char c)
+{
+	switch (c)
+	{
+	case 'A': return 0;
+	case 'C': return 1;
+	case 'G': return 2;
+	case 'T': return 3;
+	default:  return 4;
+	}
+}
+
+string GetIndEventSeq(const IndEvent_t& ind, bool bDeletion)
+{
+	string str;
+
+	if (bDeletion) str.assign(RefSequence + ind.gPos + 1, ind.len);
+	else if (ind.len & IndSpillFlag) str = IndSpillSeqVec[ind.seq];
+	else
+	{
+		str.resize(ind.len);
+		for (uint32_t i = 0; i < ind.len; i++) str[i] = "ACGT"[(ind.seq >> (62 - 2 * i)) & 3];
+	}
+	return str;
+}
+
+bool CompByIndEvent(const IndEvent_t& a, const IndEvent_t& b)
+{
+	// position first, then the sequence in string order: a packed prefix compares equal and the shorter one goes first
+	if (a.gPos != b.gPos) return a.gPos < b.gPos;
+	if (((a.len | b.len) & IndSpillFlag) == 0) return a.seq != b.seq ? a.seq < b.seq : a.len < b.len;
+	return GetIndEventSeq(a, false) < GetIndEventSeq(b, false);
+}
+
+static void CompactIndEvents(vector<IndEvent_t>& vec)
+{
+	vector<IndEvent_t>::iterator iter, dst;
+
+	if (vec.size() == 0) return;
+	sort(vec.begin(), vec.end(), CompByIndEvent);
+	for (dst = vec.begin(), iter = vec.begin() + 1; iter != vec.end(); iter++)
+	{
+		if (iter->gPos == dst->gPos && iter->seq == dst->seq && iter->len == dst->len) dst->count += iter->count;
+		else *(++dst) = *iter;
+	}
+	vec.resize(dst - vec.begin() + 1);
+}
+
+static inline void NewIndEvent(vector<IndEvent_t>& vec, int64_t gPos, uint64_t seq, uint32_t len)
+{
+	IndEvent_t ind;
+
+	// repeated observations are folded before the buffer grows
+	if (vec.size() >= IndEventBufSize && vec.size() == vec.capacity()) CompactIndEvents(vec);
+	ind.gPos = gPos; ind.seq = seq; ind.len = len; ind.count = 1;
+	vec.push_back(ind);
+}
+
+static void NewInsertEvent(ProfileBuffer_t& buf, bool orientation, char* seq, FragPair_t& fp, int offset, int len, int64_t gPos)
+{
+	// read bases [offset, offset+len) of the fragment in the forward genome orientation, inserted after gPos
+	int i;
+	uint8_t c;
+	char* p;
+	uint64_t packed = 0;
+
+	if (len <= 32)
+	{
+		if (orientation) for (p = seq + fp.rPos + offset, i = 0; i < len && (c = GetProfileBaseCode(p[i])) < 4; i++) packed |= (uint64_t)c << (62 - 2 * i);
+		else for (p = seq + fp.rPos + fp.rLen - offset - 1, i = 0; i < len && (c = GetProfileBaseCode(*(p - i) & 0xDF)) < 4; i++) packed |= (uint64_t)(c ^ 3) << (62 - 2 * i);
+		if (i == len)
+		{
+			NewIndEvent(buf.InsertEventVec, gPos, packed, (uint32_t)len);
+			return;
+		}
+	}
+	buf.InsertSpillMap[gPos][GetFragReadSeq(orientation, seq, fp, offset, len)]++;
+}
+
+static void ApplyProfileEvents(ProfileBuffer_t& buf);
+
+static inline bool NewProfileEvent(ProfileBuffer_t& buf, int64_t gPos, int len, int type)
+{
+	ProfileEvent_t event;
+
+	if (len <= 0 || gPos >= GenomeSize) return false;
+	if (buf.EventVec.size() >= ProfileEventBufSize || buf.BaseVec.size() >= ProfileBaseBufSize) ApplyProfileEvents(buf);
+
+	event.gPos = gPos; event.offset = (uint32_t)buf.BaseVec.size(); event.type = type;
+	event.len = (uint32_t)(gPos + len > GenomeSize ? GenomeSize - gPos : len);
+	buf.EventVec.push_back(event);
+
+	return true;
+}
+
+static inline uint8_t* NewBaseEvent(ProfileBuffer_t& buf, int64_t gPos, int len)
+{
+	// returns the slot for the len base codes of the run
+	if (!NewProfileEvent(buf, gPos, len, EVENT_BASE)) return NULL;
+	buf.BaseVec.resize(buf.BaseVec.size() + len);
+
+	return buf.BaseVec.data() + buf.EventVec.back().offset;
+}
+
+void UpdateFragProfile(bool orientation, char* seq, FragPair_t& fp, int64_t gPos, ProfileBuffer_t& buf)
+{
+	int i, len, k = 0; // k: read bases consumed
+	uint8_t* code;
+
+	for (vector<uint32_t>::iterator iter = fp.cigar.begin(); iter != fp.cigar.end(); iter++)
+	{
+		len = *iter >> 4;
+		switch (*iter & 0xf)
+		{
+		case CIGAR_I:
+			NewInsertEvent(buf, orientation, seq, fp, k, len, gPos - 1);
+			k += len;
+			break;
+		case CIGAR_D:
+			NewIndEvent(buf.DeleteEventVec, gPos - 1, 0, (uint32_t)len);
+			gPos += len;
+			break;
+		default: // =/X
+			if ((code = NewBaseEvent(buf, gPos, len)) != NULL)
+			{
+				if (orientation) for (i = 0; i < len; i++) code[i] = GetProfileBaseCode(seq[fp.rPos + k + i]);
+				else for (i = 0; i < len; i++) code[i] = GetProfileBaseCode(GetComplementaryBase(seq[fp.rPos + fp.rLen - 1 - k - i]));
+			}
+			k += len; gPos += len;
+		}
+	}
+}
+
+static bool CompByRegionEnd(int64_t gPos, const ProfileRegion_t& r)
+{
+	return gPos < r.gEnd;
+}
+
+static bool CompByProfileBeg(int64_t pPos, const ProfileRegion_t& r)
+{
+	return pPos < r.pBeg;
+}
+
+int64_t GetProfilePos(int64_t gPos)
+{
+	// the profile position of gPos, or -1 if gPos is not profiled
+	vector<ProfileRegion_t>::iterator iter;
+
+	if (ProfileRegionVec.size() == 0) return gPos;
+	iter = upper_bound(ProfileRegionVec.begin(), ProfileRegionVec.end(), gPos, CompByRegionEnd);
+	return iter != ProfileRegionVec.end() && iter->gBeg <= gPos ? iter->pBeg + gPos - iter->gBeg : -1;
+}
+
+int64_t GetProfileBound(int64_t gPos)
+{
+	// the profile position of the first profiled genome position at or after gPos: [GetProfileBound(beg), GetProfileBound(end)) holds the profiled part of [beg, end)
+	vector<ProfileRegion_t>::iterator iter;
+
+	if (ProfileRegionVec.size() == 0) return gPos < GenomeSize ? gPos : GenomeSize;
+	iter = upper_bound(ProfileRegionVec.begin(), ProfileRegionVec.end(), gPos, CompByRegionEnd);
+	if (iter == ProfileRegionVec.end()) return ProfileSize;
+	return iter->pBeg + (gPos > iter->gBeg ? gPos - iter->gBeg : 0);
+}
+
+int64_t GetProfileRun(int64_t pPos, int64_t pEnd, int64_t& gPos)
+{
+	// the genome position of pPos and the length of the run of [pPos, pEnd) that is contiguous in the genome
+	vector<ProfileRegion_t>::iterator iter;
+
+	if (ProfileRegionVec.size() == 0)
+	{
+		gPos = pPos;
+		return pEnd - pPos;
+	}
+	iter = upper_bound(ProfileRegionVec.begin(), ProfileRegionVec.end(), pPos, CompByProfileBeg) - 1;
+	gPos = iter->gBeg + pPos - iter->pBeg;
+	return iter->gEnd - gPos < pEnd - pPos ? iter->gEnd - gPos : pEnd - pPos;
+}
+
+static int GetProfileSegment(int64_t gPos, int64_t len, int64_t& pPos)
+{
+	// the length of the leading segment of [gPos, gPos+len) that lies in one profile page (pPos set) or is not profiled (pPos = -1)
+	int64_t n = (1 << ProfileBlockShift);
+	vector<ProfileRegion_t>::iterator iter;
+
+	if (ProfileRegionVec.size() == 0) pPos = gPos;
+	else
+	{
+		iter = upper_bound(ProfileRegionVec.begin(), ProfileRegionVec.end(), gPos, CompByRegionEnd);
+		if (iter == ProfileRegionVec.end() || gPos < iter->gBeg)
+		{
+			pPos = -1;
+			if (iter != ProfileRegionVec.end() && iter->gBeg - gPos < len) len = iter->gBeg - gPos;
+			return len < n ? (int)len : (int)n;
+		}
+		pPos = iter->pBeg + gPos - iter->gBeg;
+		if (iter->gEnd - gPos < len) len = iter->gEnd - gPos;
+	}
+	n -= pPos & ((1 << ProfileBlockShift) - 1);
+	return len < n ? (int)len : (int)n;
+}
+
+static void BuildProfileLayout()
+{
+	// the padded targets, widened to the depth block grid of the genome so that every depth block is profiled whole or not at all
+	int64_t gBeg, gEnd;
+	ProfileRegion_t r;
+
+	ProfileRegionVec.clear();
+	for (vector<pair<int64_t, int64_t> >::iterator iter = PaddedRegionVec.begin(); iter != PaddedRegionVec.end(); iter++)
+	{
+		gBeg = iter->first / BlockSize * BlockSize; gEnd = (iter->second + BlockSize - 1) / BlockSize * BlockSize;
+		if (gEnd > GenomeSize) gEnd = GenomeSize;
+		if (ProfileRegionVec.size() > 0 && ProfileRegionVec.back().gEnd >= gBeg)
+		{
+			if (gEnd > ProfileRegionVec.back().gEnd) ProfileRegionVec.back().gEnd = gEnd;
+			continue;
+		}
+		r.gBeg = gBeg; r.gEnd = gEnd; r.pBeg = 0;
+		ProfileRegionVec.push_back(r);
+	}
+}
+
+static void AllocateProfileBlocks()
+{
+	vector<ProfileRegion_t>::iterator iter;
+
+	for (ProfileSize = 0, iter = ProfileRegionVec.begin(); iter != ProfileRegionVec.end(); iter++) iter->pBeg = ProfileSize, ProfileSize += iter->gEnd - iter->gBeg;
+	if (ProfileRegionVec.size() == 0) ProfileSize = GenomeSize;
+
+	ProfileBlockNum = (ProfileSize >> ProfileBlockShift) + 1;
+	ProfileBlockLockArr = new pthread_mutex_t[ProfileBlockNum];
+	for (int64_t i = 0; i < ProfileBlockNum; i++) pthread_mutex_init(&ProfileBlockLockArr[i], NULL);
+	ProfileBlockWaitArr = new int[ProfileBlockNum]();
+	ProfileCellPageArr = new ProfileCell_t*[ProfileBlockNum]();
+	DeepCellPageArr = new DeepProfileCell_t*[ProfileBlockNum]();
+	OverflowColumnArr = new unordered_map<int64_t, MappingRecord_t>*[ProfileBlockNum]();
+	MultiHitArr = new int32_t*[ProfileBlockNum]();
+}
+
+void InitProfileBlocks()
+{
+	BuildProfileLayout(); AllocateProfileBlocks();
+}
+
+void ReleaseProfileBlocks()
+{
+	if (ProfileBlockLockArr == NULL) return;
+	for (int64_t i = 0; i < ProfileBlockNum; i++)
+	{
+		pthread_mutex_destroy(&ProfileBlockLockArr[i]);
+		if (ProfileCellPageArr[i] != NULL) delete[] ProfileCellPageArr[i];
+		if (DeepCellPageArr[i] != NULL) delete[] DeepCellPageArr[i];
+		if (OverflowColumnArr[i] != NULL) delete OverflowColumnArr[i];
+		if (MultiHitArr[i] != NULL) delete[] MultiHitArr[i];
+	}
+	delete[] ProfileBlockLockArr; ProfileBlockLockArr = NULL;
+	delete[] ProfileBlockWaitArr; ProfileBlockWaitArr = NULL;
+	delete[] ProfileCellPageArr; ProfileCellPageArr = NULL;
+	delete[] DeepCellPageArr; DeepCellPageArr = NULL;
+	delete[] OverflowColumnArr; OverflowColumnArr = NULL;
+	delete[] MultiHitArr; MultiHitArr = NULL;
+	OffProfileReadCountMap.clear();
+}
+
+void ReleaseProfilePages(int64_t beg, int64_t end)
+{
+	// frees the pages lying entirely within the profile of [beg, end), which read as empty columns afterwards
+	int64_t b;
+
+	beg = GetProfileBound(beg); end = GetProfileBound(end);
+	for (b = (beg + (1 << ProfileBlockShift) - 1) >> ProfileBlockShift; b < ProfileBlockNum && ((b + 1) << ProfileBlockShift) <= end; b++)
+	{
+		if (ProfileCellPageArr[b] != NULL) delete[] ProfileCellPageArr[b], ProfileCellPageArr[b] = NULL;
+		if (DeepCellPageArr[b] != NULL) delete[] DeepCellPageArr[b], DeepCellPageArr[b] = NULL;
+		if (OverflowColumnArr[b] != NULL) delete OverflowColumnArr[b], OverflowColumnArr[b] = NULL;
+		if (MultiHitArr[b] != NULL) delete[] MultiHitArr[b], MultiHitArr[b] = NULL;
+	}
+	if (ReleasedBlockNum < b) ReleasedBlockNum = b;
+}
+
+void ReportProfileMemory()
+{
+	int64_t b, PageNum = 0, OverflowNum = 0, MultiHitBlockNum = 0;
+	size_t CellSize = bDeepCoverage ? sizeof(DeepProfileCell_t) : sizeof(ProfileCell_t);
+
+	for (b = 0; b < ProfileBlockNum; b++)
+	{
+		if (ProfileCellPageArr[b] != NULL || DeepCellPageArr[b] != NULL) PageNum++;
+		if (OverflowColumnArr[b] != NULL) OverflowNum += (int64_t)OverflowColumnArr[b]->size();
+		if (MultiHitArr[b] != NULL) MultiHitBlockNum++;
+	}
+	fprintf(stderr, "\tAlignment profile: %s%lld / %lld pages (%.1f MB, %d bytes/bp), %lld overflow columns (%.1f MB), %lld multi-hit blocks (%.1f MB)\n", (bDeepCoverage ? "deep-coverage mode, " : ""), (long long)PageNum, (long long)ProfileBlockNum, 1.0*PageNum*(CellSize << ProfileBlockShift) / 1048576, (int)CellSize, (long long)OverflowNum, 1.0*OverflowNum*(sizeof(MappingRecord_t) + 32) / 1048576, (long long)MultiHitBlockNum, 1.0*MultiHitBlockNum*(sizeof(int32_t) << ProfileBlockShift) / 1048576);
+}
+
+static inline ProfileCell_t& GetProfileCell(int64_t pPos)
+{
+	// the caller holds the lock of pPos's block; pPos is a profile position, as for all the cell accessors below
+	ProfileCell_t*& page = ProfileCellPageArr[pPos >> ProfileBlockShift];
+
+	if (page == NULL) page = new ProfileCell_t[1 << ProfileBlockShift]();
+	return page[pPos & ((1 << ProfileBlockShift) - 1)];
+}
+
+static inline DeepProfileCell_t& GetDeepProfileCell(int64_t pPos)
 {
-	bool bChecked = false;
-	map<string, uint16_t>::iterator SeqIter;
+	// the caller holds the lock of pPos's block
+	DeepProfileCell_t*& page = DeepCellPageArr[pPos >> ProfileBlockShift];
 
-	for (SeqIter = iter->second.begin(); SeqIter != iter->second.end(); SeqIter++)
+	if (page == NULL) page = new DeepProfileCell_t[1 << ProfileBlockShift]();
+	return page[pPos & ((1 << ProfileBlockShift) - 1)];
+}
+
+int64_t SkipEmptyProfilePages(int64_t gPos, int64_t end)
+{
+	// returns the end of the run of unprofiled positions and untouched pages starting at gPos (gPos itself if its page is in use)
+	int n;
+	int64_t b, pPos;
+
+	for (; gPos < end; gPos += n)
+	{
+		n = GetProfileSegment(gPos, end - gPos, pPos);
+		if (pPos >= 0 && (ProfileCellPageArr[b = pPos >> ProfileBlockShift] != NULL || DeepCellPageArr[b] != NULL || MultiHitArr[b] != NULL)) break;
+	}
+	return gPos < end ? gPos : end;
+}
+
+static MappingRecord_t GetProfileColumnAt(int64_t pPos)
+{
+	MappingRecord_t Profile;
+	ProfileCell_t* page = pPos < 0 ? NULL : ProfileCellPageArr[pPos >> ProfileBlockShift];
+	DeepProfileCell_t* DeepPage = pPos < 0 ? NULL : DeepCellPageArr[pPos >> ProfileBlockShift];
+	int32_t* MultiHit = pPos < 0 ? NULL : MultiHitArr[pPos >> ProfileBlockShift];
+
+	if (DeepPage != NULL)
 	{
-		if (SeqIter->first == IndSeq)
+		DeepProfileCell_t& cell = DeepPage[pPos & ((1 << ProfileBlockShift) - 1)];
+		Profile.A = cell.base[0]; Profile.C = cell.base[1]; Profile.G = cell.base[2]; Profile.T = cell.base[3];
+		Profile.F1 = cell.strand[0]; Profile.R1 = cell.strand[1]; Profile.F2 = cell.strand[2]; Profile.R2 = cell.strand[3];
+		Profile.readCount = (uint8_t)cell.readCount;
+		Profile.multi_hit = MultiHit == NULL ? 0 : MultiHit[pPos & ((1 << ProfileBlockShift) - 1)];
+		return Profile;
+	}
+	if (page == NULL)
+	{
+		Profile.A = Profile.C = Profile.G = Profile.T = Profile.readCount = 0;
+		Profile.F1 = Profile.R1 = Profile.F2 = Profile.R2 = 0;
+		Profile.multi_hit = MultiHit == NULL ? 0 : MultiHit[pPos & ((1 << ProfileBlockShift) - 1)];
+		return Profile;
+	}
+	ProfileCell_t& cell = page[pPos & ((1 << ProfileBlockShift) - 1)];
+	if (cell.overflow) Profile = OverflowColumnArr[pPos >> ProfileBlockShift]->find(pPos)->second;
+	else
+	{
+		Profile.A = cell.A; Profile.C = cell.C; Profile.G = cell.G; Profile.T = cell.T;
+		Profile.F1 = cell.F1; Profile.R1 = cell.R1; Profile.F2 = cell.F2; Profile.R2 = cell.R2;
+	}
+	Profile.readCount = cell.readCount;
+	Profile.multi_hit = MultiHit == NULL ? 0 : MultiHit[pPos & ((1 << ProfileBlockShift) - 1)];
+
+	return Profile;
+}
+
+MappingRecord_t GetProfileColumn(int64_t gPos)
+{
+	return GetProfileColumnAt(GetProfilePos(gPos));
+}
+
+void GetProfileCoverage(int64_t gPos, int len, int* CovArr, uint8_t* RcArr)
+{
+	// column depths and read-start counts of [gPos, gPos+len), one page segment at a time
+	int i, n;
+	int64_t b, pPos;
+	uint64_t overflow;
+
+	for (; len > 0; gPos += n, len -= n, CovArr += n, RcArr += n)
+	{
+		n = GetProfileSegment(gPos, len, pPos); b = pPos >> ProfileBlockShift;
+		if (pPos >= 0 && DeepCellPageArr[b] != NULL)
+		{
+			DeepProfileCell_t* cell = DeepCellPageArr[b] + (pPos & ((1 << ProfileBlockShift) - 1));
+			for (i = 0; i < n; i++)
+			{
+				CovArr[i] = (int)(cell[i].base[0] + cell[i].base[1] + cell[i].base[2] + cell[i].base[3]);
+				RcArr[i] = (uint8_t)cell[i].readCount;
+			}
+		}
+		else if (pPos >= 0 && ProfileCellPageArr[b] != NULL)
 		{
-			SeqIter->second++;
-			bChecked = true;
+			ProfileCell_t* cell = ProfileCellPageArr[b] + (pPos & ((1 << ProfileBlockShift) - 1));
+			for (overflow = 0, i = 0; i < n; i++)
+			{
+				CovArr[i] = (int)(cell[i].A + cell[i].C + cell[i].G + cell[i].T);
+				RcArr[i] = (uint8_t)cell[i].readCount;
+				overflow |= cell[i].overflow;
+			}
+			if (overflow) for (i = 0; i < n; i++) if (cell[i].overflow) CovArr[i] = GetProfileColumnSize(GetProfileColumnAt(pPos + i));
+		}
+		else
+		{
+			memset(CovArr, 0, n * sizeof(int)); memset(RcArr, 0, n);
+		}
+	}
+}
+
+void GetProfileCandidates(int64_t gPos, int len, int MinAltCount, int* CovArr, uint8_t* FlagArr)
+{
+	// column depths of [gPos, gPos+len) with CandAltAllele set where a non-reference base reaches MinAltCount
+	// and CandMultiHit set where multi_hit is not zero; only CandAltAllele columns can yield a SNV
+	int i, n, ref;
+	int64_t b, pPos;
+	uint32_t cnt[5];
+	int32_t* MultiHit;
+	MappingRecord_t Profile;
+
+	for (; len > 0; gPos += n, len -= n, CovArr += n, FlagArr += n)
+	{
+		n = GetProfileSegment(gPos, len, pPos); b = pPos >> ProfileBlockShift;
+		if (pPos >= 0 && DeepCellPageArr[b] != NULL)
+		{
+			DeepProfileCell_t* cell = DeepCellPageArr[b] + (pPos & ((1 << ProfileBlockShift) - 1));
+			for (i = 0; i < n; i++)
+			{
+				cnt[0] = cell[i].base[0]; cnt[1] = cell[i].base[1]; cnt[2] = cell[i].base[2]; cnt[3] = cell[i].base[3];
+				CovArr[i] = (int)(cnt[0] + cnt[1] + cnt[2] + cnt[3]);
+				cnt[(ref = nst_nt4_table[(unsigned short)RefSequence[gPos + i]]) < 4 ? ref : 4] = 0;
+				FlagArr[i] = ((int)cnt[0] >= MinAltCount || (int)cnt[1] >= MinAltCount || (int)cnt[2] >= MinAltCount || (int)cnt[3] >= MinAltCount) ? CandAltAllele : 0;
+			}
+		}
+		else if (pPos >= 0 && ProfileCellPageArr[b] != NULL)
+		{
+			ProfileCell_t* cell = ProfileCellPageArr[b] + (pPos & ((1 << ProfileBlockShift) - 1));
+			for (i = 0; i < n; i++)
+			{
+				if (cell[i].overflow)
+				{
+					Profile = GetProfileColumnAt(pPos + i);
+					cnt[0] = Profile.A; cnt[1] = Profile.C; cnt[2] = Profile.G; cnt[3] = Profile.T;
+				}
+				else
+				{
+					cnt[0] = cell[i].A; cnt[1] = cell[i].C; cnt[2] = cell[i].G; cnt[3] = cell[i].T;
+				}
+				CovArr[i] = (int)(cnt[0] + cnt[1] + cnt[2] + cnt[3]);
+				cnt[(ref = nst_nt4_table[(unsigned short)RefSequence[gPos + i]]) < 4 ? ref : 4] = 0;
+				FlagArr[i] = ((int)cnt[0] >= MinAltCount || (int)cnt[1] >= MinAltCount || (int)cnt[2] >= MinAltCount || (int)cnt[3] >= MinAltCount) ? CandAltAllele : 0;
+			}
+		}
+		else
+		{
+			memset(CovArr, 0, n * sizeof(int)); memset(FlagArr, 0, n);
+		}
+		if (pPos >= 0 && (MultiHit = MultiHitArr[b]) != NULL)
+		{
+			MultiHit += (pPos & ((1 << ProfileBlockShift) - 1));
+			for (i = 0; i < n; i++) if (MultiHit[i] != 0) FlagArr[i] |= CandMultiHit;
+		}
+	}
+}
+
+int GetProfileReadCount(int64_t gPos)
+{
+	int64_t pPos = GetProfilePos(gPos);
+	ProfileCell_t* page = pPos < 0 ? NULL : ProfileCellPageArr[pPos >> ProfileBlockShift];
+	DeepProfileCell_t* DeepPage = pPos < 0 ? NULL : DeepCellPageArr[pPos >> ProfileBlockShift];
+
+	if (DeepPage != NULL) return (int)DeepPage[pPos & ((1 << ProfileBlockShift) - 1)].readCount;
+	return page == NULL ? 0 : (int)page[pPos & ((1 << ProfileBlockShift) - 1)].readCount;
+}
+
+static MappingRecord_t& GetOverflowColumn(int64_t pPos)
+{
+	// the caller holds the lock of pPos's block; the first call moves the cell's counts to the table
+	ProfileCell_t& cell = GetProfileCell(pPos);
+	unordered_map<int64_t, MappingRecord_t>*& table = OverflowColumnArr[pPos >> ProfileBlockShift];
+
+	if (table == NULL) table = new unordered_map<int64_t, MappingRecord_t>();
+	MappingRecord_t& Profile = (*table)[pPos];
+	if (!cell.overflow)
+	{
+		Profile.A = cell.A; Profile.C = cell.C; Profile.G = cell.G; Profile.T = cell.T;
+		Profile.F1 = cell.F1; Profile.R1 = cell.R1; Profile.F2 = cell.F2; Profile.R2 = cell.R2;
+		Profile.multi_hit = Profile.readCount = 0;
+		cell.A = cell.C = cell.G = cell.T = cell.F1 = cell.R1 = cell.F2 = cell.R2 = 0; cell.overflow = 1;
+	}
+	return Profile;
+}
+
+static inline void IncProfileBase(int64_t pPos, int base)
+{
+	ProfileCell_t& cell = GetProfileCell(pPos);
+
+	if (!cell.overflow)
+	{
+		switch (base)
+		{
+		case 0: if (cell.A < CellBaseMax) { cell.A++; return; } break;
+		case 1: if (cell.C < CellBaseMax) { cell.C++; return; } break;
+		case 2: if (cell.G < CellBaseMax) { cell.G++; return; } break;
+		case 3: if (cell.T < CellBaseMax) { cell.T++; return; } break;
+		default: return;
+		}
+	}
+	MappingRecord_t& Profile = GetOverflowColumn(pPos);
+	switch (base)
+	{
+	case 0: if (Profile.A < MaxAlleleCount) Profile.A++; break;
+	case 1: if (Profile.C < MaxAlleleCount) Profile.C++; break;
+	case 2: if (Profile.G < MaxAlleleCount) Profile.G++; break;
+	case 3: if (Profile.T < MaxAlleleCount) Profile.T++; break;
+	}
+}
+
+static inline void IncProfileStrand(int64_t pPos, int type)
+{
+	ProfileCell_t& cell = GetProfileCell(pPos);
+
+	if (!cell.overflow)
+	{
+		switch (type)
+		{
+		case EVENT_F1: if (cell.F1 < CellStrandMax) { cell.F1++; return; } break;
+		case EVENT_R1: if (cell.R1 < CellStrandMax) { cell.R1++; return; } break;
+		case EVENT_F2: if (cell.F2 < CellStrandMax) { cell.F2++; return; } break;
+		case EVENT_R2: if (cell.R2 < CellStrandMax) { cell.R2++; return; } break;
+		}
+	}
+	MappingRecord_t& Profile = GetOverflowColumn(pPos);
+	switch (type)
+	{
+	case EVENT_F1: Profile.F1++; break;
+	case EVENT_R1: Profile.R1++; break;
+	case EVENT_F2: Profile.F2++; break;
+	case EVENT_R2: Profile.R2++; break;
+	}
+}
+
+static inline void AddMultiHitDiff(int64_t pPos, int32_t v)
+{
+	// the caller holds the lock of pPos's block
+	int32_t*& arr = MultiHitArr[pPos >> ProfileBlockShift];
+
+	if (arr == NULL) arr = new int32_t[1 << ProfileBlockShift]();
+	arr[pPos & ((1 << ProfileBlockShift) - 1)] += v;
+}
+
+static void LockProfileBlock(int64_t block, ProfileBuffer_t& buf)
+{
+	struct timespec t1, t2;
+
+	buf.LockNum++;
+	if (pthread_mutex_trylock(&ProfileBlockLockArr[block]) == 0) return;
+
+	buf.ContendedNum++;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	__atomic_add_fetch(&ProfileBlockWaitArr[block], 1, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&ProfileBlockLockArr[block]);
+	__atomic_sub_fetch(&ProfileBlockWaitArr[block], 1, __ATOMIC_RELAXED);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	buf.LockWaitTime += (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) / 1e9;
+}
+
+static void SortProfileEventsByBlock(ProfileBuffer_t& buf)
+{
+	// one counting-sort pass on the genome block of each event; a block's records stay cache
+	// resident while its events are applied, so events inside a block are left unordered
+	int64_t i, b, n = (int64_t)buf.EventVec.size();
+
+	buf.BlockCntVec.assign(ProfileBlockNum + 1, 0);
+	for (i = 0; i < n; i++) buf.BlockCntVec[(buf.EventVec[i].gPos >> ProfileBlockShift) + 1]++;
+	for (b = 1; b <= ProfileBlockNum; b++) buf.BlockCntVec[b] += buf.BlockCntVec[b - 1];
+	buf.TmpVec.resize(n);
+	for (i = 0; i < n; i++) buf.TmpVec[buf.BlockCntVec[buf.EventVec[i].gPos >> ProfileBlockShift]++] = buf.EventVec[i];
+	buf.EventVec.swap(buf.TmpVec);
+}
+
+static bool HandOffProfileBlocks(int64_t lo, int64_t hi, ProfileBuffer_t& buf)
+{
+	// releases blocks [lo, hi] to the threads waiting for them and takes them back once the waiters are served
+	int64_t b;
+	int n;
+
+	for (b = lo; b <= hi && __atomic_load_n(&ProfileBlockWaitArr[b], __ATOMIC_RELAXED) == 0; b++);
+	if (b > hi) return false;
+
+	for (b = lo; b <= hi; b++) pthread_mutex_unlock(&ProfileBlockLockArr[b]);
+	for (n = 0; n < MaxHandoffYields; n++)
+	{
+		for (b = lo; b <= hi && __atomic_load_n(&ProfileBlockWaitArr[b], __ATOMIC_RELAXED) == 0; b++);
+		if (b > hi) break;
+		sched_yield();
+	}
+	for (b = lo; b <= hi; b++) LockProfileBlock(b, buf);
+	return true;
+}
+
+static void MapProfileEvents(ProfileBuffer_t& buf)
+{
+	// moves the events to profile positions: the parts outside the laid-out targets are dropped and an event across a gap is split
+	int64_t gPos, gPosEnd, beg, end;
+	ProfileEvent_t event;
+	vector<ProfileRegion_t>::iterator iter;
+
+	buf.TmpVec.clear(); buf.TmpVec.reserve(buf.EventVec.size());
+	for (vector<ProfileEvent_t>::iterator EventIter = buf.EventVec.begin(); EventIter != buf.EventVec.end(); EventIter++)
+	{
+		gPos = EventIter->gPos; gPosEnd = gPos + EventIter->len; event = *EventIter;
+		for (iter = upper_bound(ProfileRegionVec.begin(), ProfileRegionVec.end(), gPos, CompByRegionEnd); iter != ProfileRegionVec.end() && iter->gBeg < gPosEnd; iter++)
+		{
+			beg = gPos > iter->gBeg ? gPos : iter->gBeg; end = gPosEnd < iter->gEnd ? gPosEnd : iter->gEnd;
+			event.gPos = iter->pBeg + beg - iter->gBeg; event.len = (uint32_t)(end - beg); event.offset = EventIter->offset + (uint32_t)(beg - gPos);
+			buf.TmpVec.push_back(event);
+		}
+	}
+	buf.EventVec.swap(buf.TmpVec);
+}
+
+static void ApplyProfileEvents(ProfileBuffer_t& buf)
+{
+	uint8_t* code;
+	int64_t pPos, pEnd, b, b1, b2, lo = 0, hi = -1; // blocks [lo, hi] are held
+	int HoldNum = 0; // events applied since the held blocks were last taken
+
+	if (ProfileRegionVec.size() > 0) MapProfileEvents(buf);
+	SortProfileEventsByBlock(buf);
+	for (vector<ProfileEvent_t>::iterator iter = buf.EventVec.begin(); iter != buf.EventVec.end(); iter++)
+	{
+		pPos = iter->gPos; pEnd = pPos + iter->len;
+		b1 = pPos >> ProfileBlockShift; b2 = (iter->type != EVENT_MULTI || pEnd == ProfileSize ? pEnd - 1 : pEnd) >> ProfileBlockShift; // multi-hit events also touch pEnd
+		if (b1 != lo)
+		{
+			for (b = lo; b <= hi; b++) pthread_mutex_unlock(&ProfileBlockLockArr[b]);
+			for (lo = b1, hi = b1 - 1; hi < b2;) LockProfileBlock(++hi, buf);
+			HoldNum = 0;
+		}
+		else
+		{
+			// a batch whose events crowd into one block (e.g. sorted -aln input) must not keep the block for the whole batch
+			if (++HoldNum >= MaxLockHoldEvents)
+			{
+				HandOffProfileBlocks(lo, hi, buf);
+				HoldNum = 0;
+			}
+			while (hi < b2) LockProfileBlock(++hi, buf);
+		}
+
+		switch (iter->type)
+		{
+		case EVENT_BASE:
+			code = buf.BaseVec.data() + iter->offset;
+			if (bDeepCoverage) for (; pPos < pEnd; pPos++, code++) GetDeepProfileCell(pPos).base[*code]++;
+			else for (; pPos < pEnd; pPos++, code++) IncProfileBase(pPos, *code);
+			break;
+		case EVENT_F1: case EVENT_R1: case EVENT_F2: case EVENT_R2: // small cells cannot hold difference counts
+			if (bDeepCoverage) for (; pPos < pEnd; pPos++) GetDeepProfileCell(pPos).strand[iter->type - EVENT_F1]++;
+			else for (; pPos < pEnd; pPos++) IncProfileStrand(pPos, iter->type);
 			break;
+		case EVENT_MULTI: AddMultiHitDiff(pPos, 1); if (pEnd < ProfileSize) AddMultiHitDiff(pEnd, -1); break;
+		}
+	}
+	for (b = lo; b <= hi; b++) pthread_mutex_unlock(&ProfileBlockLockArr[b]);
+	buf.EventVec.clear(); buf.BaseVec.clear();
+}
+
+static void UpdateAlnCanProfile(bool bFirstRead, ReadItem_t* read, AlnCan_t& AlnCan, int64_t gPos, ProfileBuffer_t& buf)
+{
+	uint8_t* code;
+	int i, j, len, rPos, num = (int)AlnCan.FragPairVec.size();
+
+	if (bFirstRead) NewProfileEvent(buf, gPos, read->rlen, AlnCan.orientation ? EVENT_F1 : EVENT_R1);
+	else NewProfileEvent(buf, gPos, read->rlen, AlnCan.orientation ? EVENT_R2 : EVENT_F2);
+
+	if (AlnCan.orientation) //AlnCan.FragPairVec[0].gPos < GenomeSize
+	{
+		for (i = 0; i < num; i++)
+		{
+			rPos = AlnCan.FragPairVec[i].rPos; gPos = AlnCan.FragPairVec[i].gPos;
+			if (AlnCan.FragPairVec[i].bSimple)
+			{
+				len = AlnCan.FragPairVec[i].rLen;
+				if ((code = NewBaseEvent(buf, gPos, len)) != NULL) for (j = 0; j < len; j++) code[j] = GetProfileBaseCode(read->seq[rPos + j]);
+			}
+			else if (AlnCan.FragPairVec[i].gLen == 0) // ins; an empty fragment pair is a clipped end
+			{
+				if (AlnCan.FragPairVec[i].rLen > 0) NewInsertEvent(buf, true, read->seq, AlnCan.FragPairVec[i], 0, AlnCan.FragPairVec[i].rLen, gPos - 1);
+			}
+			else if (AlnCan.FragPairVec[i].rLen == 0) // del
+			{
+				NewIndEvent(buf.DeleteEventVec, gPos - 1, 0, (uint32_t)AlnCan.FragPairVec[i].gLen);
+			}
+			else UpdateFragProfile(true, read->seq, AlnCan.FragPairVec[i], gPos, buf);
 		}
 	}
-	return bChecked;
-}
-
-int CheckMismatch(vector<FragPair_t>& FragPairVec)
-{
-	int i, len, mis = 0;
-	vector<FragPair_t>::iterator iter;
-	for (iter = FragPairVec.begin(); iter != FragPairVec.end(); iter++)
+	else
 	{
-		if (!iter->bSimple && iter->rLen > 0 && iter->gLen > 0)
+		for (i = 0; i < num; i++)
 		{
-			len = (int)iter->aln1.length();
-			for (i = 0; i < len; i++) if (iter->aln1[i] != iter->aln2[i] && iter->aln1[i] != '-' && iter->aln2[i] != '-') mis++;
+			if (AlnCan.FragPairVec[i].bSimple)
+			{
+				// the read runs backwards on the forward strand: store complemented codes in forward order
+				rPos = AlnCan.FragPairVec[i].rPos; len = AlnCan.FragPairVec[i].rLen; gPos = TwoGenomeSize - AlnCan.FragPairVec[i].gPos - len;
+				if ((code = NewBaseEvent(buf, gPos, len)) != NULL)
+				{
+					for (j = 0; j < len; j++) code[len - 1 - j] = GetProfileBaseCode(read->seq[rPos + j]) ^ 3; // A<->T, C<->G
+				}
+			}
+			else if (AlnCan.FragPairVec[i].gLen == 0) // ins; an empty fragment pair is a clipped end
+			{
+				gPos = TwoGenomeSize - AlnCan.FragPairVec[i].gPos;
+				if (AlnCan.FragPairVec[i].rLen > 0) NewInsertEvent(buf, false, read->seq, AlnCan.FragPairVec[i], 0, AlnCan.FragPairVec[i].rLen, gPos - 1);
+			}
+			else if (AlnCan.FragPairVec[i].rLen == 0) // del
+			{
+				gPos = (TwoGenomeSize - AlnCan.FragPairVec[i].gPos - AlnCan.FragPairVec[i].gLen);
+				NewIndEvent(buf.DeleteEventVec, gPos - 1, 0, (uint32_t)AlnCan.FragPairVec[i].gLen);
+			}
+			else UpdateFragProfile(false, read->seq, AlnCan.FragPairVec[i], TwoGenomeSize - (AlnCan.FragPairVec[i].gPos + AlnCan.FragPairVec[i].gLen), buf);
 		}
 	}
-	return mis;
 }
 
-void UpdateProfile(bool bFirstRead, ReadItem_t* read, vector<AlnCan_t>& AlnCanVec)
+void UpdateProfile(bool bFirstRead, ReadItem_t* read, vector<AlnCan_t>& AlnCanVec, ProfileBuffer_t& buf)
 {
-	int64_t gPos;
-	string IndSeq;
-	int i, j, frag_len, ext_len, rPos, num;
-	map<int64_t, map<string, uint16_t> >::iterator ind_iter, lower_iter, upper_iter;
+	bool bUpdate;
+	int64_t gPos, pPos;
+	int ClipSize;
 
 	for (vector<AlnCan_t>::iterator iter = AlnCanVec.begin(); iter != AlnCanVec.end(); iter++)
 	{
 		if (iter->score == 0) continue;
 
-		num = iter->FragPairVec.size();
+		// clips are empty fragment pairs at either end; the fragment pairs of a reverse strand alignment are in reverse read order
 		if (iter->FragPairVec.begin()->rLen == 0 && iter->FragPairVec.begin()->gLen == 0)
 		{
-			//if (iter->FragPairVec[1].rPos > MinBreakPointSize)
-			if (iter->FragPairVec.begin()->rPos > MinBreakPointSize)
+			ClipSize = iter->orientation ? iter->FragPairVec.begin()->rPos : read->rlen - iter->FragPairVec.begin()->rPos;
+			if (ClipSize > MinBreakPointSize)
 			{
 				gPos = iter->FragPairVec.begin()->gPos;
-				if (gPos < GenomeSize) BreakPointMap[gPos]++;
-				else BreakPointMap[(TwoGenomeSize - 1 - gPos)]++;
+				buf.BreakPointVec.push_back(gPos < GenomeSize ? gPos : TwoGenomeSize - 1 - gPos);
 			}
-			if (iter->FragPairVec.begin()->rPos > MaxClipSize) continue;
+			if (ClipSize > MaxClipSize) continue;
 		}
 		if (iter->FragPairVec.rbegin()->rLen == 0 && iter->FragPairVec.rbegin()->gLen == 0)
 		{
-			if ((read->rlen - iter->FragPairVec.rbegin()->rPos) > MinBreakPointSize)
+			ClipSize = iter->orientation ? read->rlen - iter->FragPairVec.rbegin()->rPos : iter->FragPairVec.rbegin()->rPos;
+			if (ClipSize > MinBreakPointSize)
 			{
 				gPos = iter->FragPairVec.rbegin()->gPos;
-				if (gPos < GenomeSize) BreakPointMap[gPos]++;
-				else BreakPointMap[TwoGenomeSize - 1 - gPos]++;
+				buf.BreakPointVec.push_back(gPos < GenomeSize ? gPos : TwoGenomeSize - 1 - gPos);
 			}
-			if ((read->rlen - iter->FragPairVec.rbegin()->rPos) > MaxClipSize) continue;
+			if (ClipSize > MaxClipSize) continue;
 		}
 		if (iter->orientation) gPos = iter->FragPairVec.begin()->gPos;
 		else gPos = TwoGenomeSize - (iter->FragPairVec.begin()->gPos + iter->FragPairVec.begin()->gLen);
-		if (MappingRecordArr[gPos].readCount < iMaxDuplicate) MappingRecordArr[gPos].readCount++;
-		else continue;
 
-		if (bFirstRead)
+		// the duplicate check is applied immediately; base and strand counts are deferred as events
+		if ((pPos = GetProfilePos(gPos)) < 0)
 		{
-			if (iter->orientation)
-			{
-				for (i = 0; i < read->rlen; i++) MappingRecordArr[gPos + i].F1++;
-			}
-			else
-			{
-				for (i = 0; i < read->rlen; i++) MappingRecordArr[gPos + i].R1++;
-			}
+			pthread_mutex_lock(&ProfileLock);
+			int& ReadCount = OffProfileReadCountMap[gPos];
+			if ((bUpdate = (ReadCount < iMaxDuplicate))) ReadCount++;
+			pthread_mutex_unlock(&ProfileLock);
 		}
 		else
 		{
-			if (iter->orientation)
+			LockProfileBlock(pPos >> ProfileBlockShift, buf);
+			if (bDeepCoverage)
 			{
-				for (i = 0; i < read->rlen; i++) MappingRecordArr[gPos + i].R2++;
+				DeepProfileCell_t& cell = GetDeepProfileCell(pPos);
+				if ((bUpdate = (cell.readCount < iMaxDuplicate))) cell.readCount++;
 			}
 			else
 			{
-				for (i = 0; i < read->rlen; i++) MappingRecordArr[gPos + i].F2++;
+				ProfileCell_t& cell = GetProfileCell(pPos);
+				if ((bUpdate = (cell.readCount < iMaxDuplicate))) cell.readCount++;
 			}
+			pthread_mutex_unlock(&ProfileBlockLockArr[pPos >> ProfileBlockShift]);
+		}
+		if (bUpdate) UpdateAlnCanProfile(bFirstRead, read, *iter, gPos, buf);
+	}
+}
+
+static inline void GetAlnCanSpan(AlnCan_t& AlnCan, int64_t& gPosBeg, int64_t& gPosEnd)
+{
+	// forward-strand span of an alignment candidate
+	if (AlnCan.orientation)
+	{
+		gPosBeg = AlnCan.FragPairVec.begin()->gPos;
+		gPosEnd = AlnCan.FragPairVec.rbegin()->gPos + AlnCan.FragPairVec.rbegin()->gLen;
+	}
+	else
+	{
+		gPosBeg = TwoGenomeSize - (AlnCan.FragPairVec.begin()->gPos + AlnCan.FragPairVec.begin()->gLen);
+		gPosEnd = TwoGenomeSize - AlnCan.FragPairVec.rbegin()->gPos;
+	}
+}
+
+bool CheckAlnCanOnTarget(vector<AlnCan_t>& AlnCanVec)
+{
+	// a read is profiled if one of its alignments overlaps a padded target region
+	int64_t gPosBeg, gPosEnd;
+
+	for (vector<AlnCan_t>::iterator iter = AlnCanVec.begin(); iter != AlnCanVec.end(); iter++)
+	{
+		if (iter->score == 0) continue;
+		GetAlnCanSpan(*iter, gPosBeg, gPosEnd);
+		if (CheckRegionOverlap(PaddedRegionVec, gPosBeg, gPosEnd)) return true;
+	}
+	return false;
+}
+
+void UpdateMultiHitCount(ReadItem_t* read, vector<AlnCan_t>& AlnCanVec, ProfileBuffer_t& buf)
+{
+	int64_t gPosBeg, gPosEnd;
+	vector<AlnCan_t>::iterator iter;
+
+	for (iter = AlnCanVec.begin(); iter != AlnCanVec.end(); iter++)
+	{
+		if (iter->score > 0)
+		{
+			GetAlnCanSpan(*iter, gPosBeg, gPosEnd);
+			// off-target hits of a multi-hit read would allocate profile pages outside the targets
+			if (PaddedRegionVec.size() > 0 && !CheckRegionOverlap(PaddedRegionVec, gPosBeg, gPosEnd)) continue;
+			NewProfileEvent(buf, gPosBeg, (int)(gPosEnd - gPosBeg), EVENT_MULTI);
+		}
+	}
+}
+
+static void *SumRangeCounterDiffs(void *arg)
+{
+	int tid = *((int*)arg);
+	CounterSegment_t& seg = CounterSegmentArr[tid];
+
+	seg.multi = 0;
+	for (int64_t b = seg.BlockBeg; b < seg.BlockEnd; b++)
+	{
+		if (MultiHitArr[b] != NULL) for (int i = 0; i < (1 << ProfileBlockShift); i++) seg.multi += MultiHitArr[b][i];
+	}
+	return (void*)(1);
+}
+
+static void *PrefixSumRangeCounters(void *arg)
+{
+	int i, tid = *((int*)arg);
+	int64_t b, multi;
+	CounterSegment_t& seg = CounterSegmentArr[tid]; // holds the carry-in of the segment
+
+	for (multi = seg.multi, b = seg.BlockBeg; b < seg.BlockEnd; b++)
+	{
+		if (MultiHitArr[b] == NULL)
+		{
+			if (multi == 0) continue;
+			MultiHitArr[b] = new int32_t[1 << ProfileBlockShift]();
+		}
+		for (i = 0; i < (1 << ProfileBlockShift); i++)
+		{
+			multi += MultiHitArr[b][i];
+			MultiHitArr[b][i] = (multi < MaxAlleleCount || bDeepCoverage) ? (int32_t)multi : MaxAlleleCount;
+		}
+	}
+	return (void*)(1);
+}
+
+void MaterializeRangeCounters()
+{
+	// turn the multi-hit difference counts into counts: per-segment sums, a scan for the carries, then a prefix-sum pass
+	int i, *ThrIdArr = new int[iThreadNum];
+	pthread_t *ThreadArr = new pthread_t[iThreadNum];
+	int64_t carry;
+
+	CounterSegmentArr = new CounterSegment_t[iThreadNum];
+	for (i = 0; i < iThreadNum; i++)
+	{
+		ThrIdArr[i] = i;
+		CounterSegmentArr[i].BlockBeg = ProfileBlockNum * i / iThreadNum;
+		CounterSegmentArr[i].BlockEnd = ProfileBlockNum * (i + 1) / iThreadNum;
+	}
+	for (i = 0; i < iThreadNum; i++) pthread_create(&ThreadArr[i], NULL, SumRangeCounterDiffs, &ThrIdArr[i]);
+	for (i = 0; i < iThreadNum; i++) pthread_join(ThreadArr[i], NULL);
+
+	for (carry = 0, i = 0; i < iThreadNum; i++)
+	{
+		swap(carry, CounterSegmentArr[i].multi); carry += CounterSegmentArr[i].multi;
+	}
+	for (i = 0; i < iThreadNum; i++) pthread_create(&ThreadArr[i], NULL, PrefixSumRangeCounters, &ThrIdArr[i]);
+	for (i = 0; i < iThreadNum; i++) pthread_join(ThreadArr[i], NULL);
+
+	delete[] CounterSegmentArr; CounterSegmentArr = NULL;
+	delete[] ThrIdArr; delete[] ThreadArr;
+}
+
+void MergeProfileBuffer(ProfileBuffer_t& buf)
+{
+	map<int64_t, map<string, uint32_t> >::iterator iter;
+
+	if (buf.EventVec.size() > 0) ApplyProfileEvents(buf);
+	CompactIndEvents(buf.InsertEventVec); CompactIndEvents(buf.DeleteEventVec);
+
+	pthread_mutex_lock(&ProfileLock);
+	InsertEventVec.insert(InsertEventVec.end(), buf.InsertEventVec.begin(), buf.InsertEventVec.end());
+	DeleteEventVec.insert(DeleteEventVec.end(), buf.DeleteEventVec.begin(), buf.DeleteEventVec.end());
+	for (iter = buf.InsertSpillMap.begin(); iter != buf.InsertSpillMap.end(); iter++)
+	{
+		map<string, uint32_t>& SeqMap = InsertSpillMap[iter->first];
+		for (map<string, uint32_t>::iterator SeqIter = iter->second.begin(); SeqIter != iter->second.end(); SeqIter++) SeqMap[SeqIter->first] += SeqIter->second;
+	}
+	pthread_mutex_unlock(&ProfileLock);
+
+	buf.InsertSpillMap.clear();
+	vector<IndEvent_t>().swap(buf.InsertEventVec); vector<IndEvent_t>().swap(buf.DeleteEventVec);
+}
+
+void BuildIndEventView()
+{
+	IndEvent_t ind;
+	map<int64_t, map<string, uint32_t> >::iterator iter;
+
+	for (iter = InsertSpillMap.begin(); iter != InsertSpillMap.end(); iter++)
+	{
+		for (map<string, uint32_t>::iterator SeqIter = iter->second.begin(); SeqIter != iter->second.end(); SeqIter++)
+		{
+			ind.gPos = iter->first; ind.seq = IndSpillSeqVec.size(); ind.len = IndSpillFlag | (uint32_t)SeqIter->first.length(); ind.count = SeqIter->second;
+			IndSpillSeqVec.push_back(SeqIter->first); InsertEventVec.push_back(ind);
+		}
+	}
+	InsertSpillMap.clear();
+	CompactIndEvents(InsertEventVec); CompactIndEvents(DeleteEventVec);
+}
+
+// profile checkpoint: the final profile state after mapping, so that the calling stage can be re-run ('call') or the
+// profiles of several read shards can be summed ('merge').
+// layout (gzip): header, the target layout of the profile (ProfileRegionVec) and the spilled insert sequences, then per block
+// a flag byte followed by the data it flags and the indel events and SV evidence whose profile bound lies in the block, so that
+// the calling stage loads the checkpoint block by block (LoadProfileCheckpointBlocks)
+#define ProfileCheckpointMagic 0x4650434d // "MCPF"
+#define ProfileCheckpointVersion 4
+#define CKPT_PAGE 1
+#define CKPT_MULTI_HIT 2
+#define CKPT_OVERFLOW 4
+
+typedef struct
+{
+	uint32_t magic, version;
+	int64_t GenomeSize, ProfileSize;
+	int32_t ChromosomeNum, BlockShift;
+	int64_t PairedNum, PairedDistance, ReadLengthSum;
+	int64_t InversionSiteEnd, TranslocationSiteEnd;
+	int32_t FragmentSize;
+	uint8_t bDeepCoverage;
+} CheckpointHeader_t;
+
+// the checkpoints being loaded: one file per shard, and each shard's spilled sequence indexes in IndSpillSeqVec
+static vector<gzFile> CheckpointFpVec;
+static vector<string> CheckpointFileNameVec;
+static vector<vector<uint64_t> > CheckpointSpillIdxVec;
+static int64_t LoadedBlockNum = 0, PeakPageBytes = 0;
+
+extern uint32_t avgReadLength;
+extern int64_t iTotalPairedNum, TotalPairedDistance, ReadLengthSum;
+extern bool CompByDiscordPos(const DiscordPair_t& p1, const DiscordPair_t& p2);
+
+static void WriteCheckpointData(gzFile fp, const void* data, size_t size)
+{
+	// gzwrite takes an unsigned length, so large vectors go out in chunks
+	for (const char* p = (const char*)data; size > 0;)
+	{
+		unsigned int len = size < (1U << 30) ? (unsigned int)size : (1U << 30);
+		if (gzwrite(fp, p, len) != (int)len)
+		{
+			fprintf(stderr, "Error! Cannot write the profile checkpoint file!\n");
+			exit(1);
+		}
+		p += len; size -= len;
+	}
+}
+
+static void ReadCheckpointData(gzFile fp, void* data, size_t size)
+{
+	for (char* p = (char*)data; size > 0;)
+	{
+		unsigned int len = size < (1U << 30) ? (unsigned int)size : (1U << 30);
+		if (gzread(fp, p, len) != (int)len)
+		{
+			fprintf(stderr, "Error! The profile checkpoint file is truncated or corrupt!\n");
+			exit(1);
 		}
+		p += len; size -= len;
+	}
+}
+
+template<class T> static void WriteCheckpointVec(gzFile fp, const vector<T>& vec)
+{
+	uint64_t n = vec.size();
+
+	WriteCheckpointData(fp, &n, sizeof(n));
+	if (n > 0) WriteCheckpointData(fp, &vec[0], n * sizeof(T));
+}
+
+template<class T> static void ReadCheckpointVec(gzFile fp, vector<T>& vec)
+{
+	uint64_t n;
+
+	ReadCheckpointData(fp, &n, sizeof(n)); vec.resize(n);
+	if (n > 0) ReadCheckpointData(fp, &vec[0], n * sizeof(T));
+}
+
+static inline int64_t GetEvidencePos(const IndEvent_t& ind) { return ind.gPos; }
+static inline int64_t GetEvidencePos(const pair<int64_t, uint32_t>& bp) { return bp.first; }
+static inline int64_t GetEvidencePos(const DiscordPair_t& site) { return site.gPos; }
+
+template<class T> static void WriteCheckpointBlockVec(gzFile fp, const vector<T>& vec, size_t& i, int64_t b)
+{
+	// the entries from i on whose profile bound lies in block b (the vector is sorted by position)
+	size_t beg = i;
+	uint64_t n;
+
+	while (i < vec.size() && (GetProfileBound(GetEvidencePos(vec[i])) >> ProfileBlockShift) <= b) i++;
+	n = i - beg; WriteCheckpointData(fp, &n, sizeof(n));
+	if (n > 0) WriteCheckpointData(fp, &vec[beg], n * sizeof(T));
+}
+
+void SaveProfileCheckpoint(const char* filename)
+{
+	int64_t b, pPos;
+	uint8_t flag;
+	uint32_t len;
+	uint64_t n;
+	size_t EvidenceIdx[5] = { 0, 0, 0, 0, 0 };
+	gzFile fp;
+	CheckpointHeader_t header;
+	unordered_map<int64_t, MappingRecord_t>::iterator iter;
+
+	if ((fp = gzopen(filename, "wb1")) == NULL)
+	{
+		fprintf(stderr, "Error! Cannot open the profile checkpoint file [%s]!\n", filename);
+		exit(1);
+	}
+	fprintf(stderr, "Write the alignment profile to [%s]...\n", filename);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = ProfileCheckpointMagic; header.version = ProfileCheckpointVersion;
+	header.GenomeSize = GenomeSize; header.ProfileSize = ProfileSize; header.ChromosomeNum = iChromsomeNum; header.BlockShift = ProfileBlockShift;
+	header.PairedNum = iTotalPairedNum; header.PairedDistance = TotalPairedDistance; header.ReadLengthSum = ReadLengthSum;
+	header.InversionSiteEnd = InversionSiteEnd; header.TranslocationSiteEnd = TranslocationSiteEnd;
+	header.FragmentSize = FragmentSize; header.bDeepCoverage = bDeepCoverage ? 1 : 0;
+	WriteCheckpointData(fp, &header, sizeof(header));
+	WriteCheckpointVec(fp, ProfileRegionVec);
+	n = IndSpillSeqVec.size(); WriteCheckpointData(fp, &n, sizeof(n));
+	for (vector<string>::iterator SeqIter = IndSpillSeqVec.begin(); SeqIter != IndSpillSeqVec.end(); SeqIter++)
+	{
+		len = (uint32_t)SeqIter->length(); WriteCheckpointData(fp, &len, sizeof(len));
+		WriteCheckpointData(fp, SeqIter->c_str(), len);
+	}
+	for (b = 0; b < ProfileBlockNum; b++)
+	{
+		flag = 0;
+		if (ProfileCellPageArr[b] != NULL || DeepCellPageArr[b] != NULL) flag |= CKPT_PAGE;
+		if (MultiHitArr[b] != NULL) flag |= CKPT_MULTI_HIT;
+		if (OverflowColumnArr[b] != NULL && OverflowColumnArr[b]->size() > 0) flag |= CKPT_OVERFLOW;
+		WriteCheckpointData(fp, &flag, 1);
 
-		if (iter->orientation) //iter->FragPairVec[0].gPos < GenomeSize
+		if (flag & CKPT_PAGE)
+		{
+			if (bDeepCoverage) WriteCheckpointData(fp, DeepCellPageArr[b], sizeof(DeepProfileCell_t) << ProfileBlockShift);
+			else WriteCheckpointData(fp, ProfileCellPageArr[b], sizeof(ProfileCell_t) << ProfileBlockShift);
+		}
+		if (flag & CKPT_MULTI_HIT) WriteCheckpointData(fp, MultiHitArr[b], sizeof(int32_t) << ProfileBlockShift);
+		if (flag & CKPT_OVERFLOW)
 		{
-			for (i = 0; i < num; i++)
+			n = OverflowColumnArr[b]->size(); WriteCheckpointData(fp, &n, sizeof(n));
+			for (iter = OverflowColumnArr[b]->begin(); iter != OverflowColumnArr[b]->end(); iter++)
 			{
-				rPos = iter->FragPairVec[i].rPos; gPos = iter->FragPairVec[i].gPos;
-				if (iter->FragPairVec[i].bSimple)
-				{
-					//printf("gPos[%lld-%lld]=%d / %lld\n", gPos, gPos + iter->FragPairVec[i].gLen - 1, iter->FragPairVec[i].gLen, GenomeSize);
-					for (j = 0; j < iter->FragPairVec[i].rLen; j++, rPos++, gPos++)
-					{
-						switch (read->seq[rPos])
-						{
-						case 'A': if (MappingRecordArr[gPos].A < MaxAlleleCount) MappingRecordArr[gPos].A++; break;
-						case 'C': if (MappingRecordArr[gPos].C < MaxAlleleCount) MappingRecordArr[gPos].C++; break;
-						case 'G': if (MappingRecordArr[gPos].G < MaxAlleleCount) MappingRecordArr[gPos].G++; break;
-						case 'T': if (MappingRecordArr[gPos].T < MaxAlleleCount) MappingRecordArr[gPos].T++; break;
-						}
-					}
-				}
-				else if (iter->FragPairVec[i].gLen == 0) // ins
-				{
-					InsertSeqMap[gPos - 1][iter->FragPairVec[i].aln1]++;
-					//printf("%lld: %s\n", gPos - 1, iter->FragPairVec[i].aln1.c_str());
-					//ShowSimplePairInfo(iter->FragPairVec);
-				}
-				else if (iter->FragPairVec[i].rLen == 0) // del
-				{
-					DeleteSeqMap[gPos-1][iter->FragPairVec[i].aln2]++;
-					//printf("%lld: %s\n", (long long)(gPos - 1), iter->FragPairVec[i].aln2.c_str());
-					//ShowSimplePairInfo(iter->FragPairVec);
-				}
-				else
-				{
-					for (frag_len = (int)iter->FragPairVec[i].aln1.length(), j = 0; j < frag_len;)
-					{
-						if (iter->FragPairVec[i].aln2[j] == '-') // ins
-						{
-							ext_len = 1; while (iter->FragPairVec[i].aln2[j + ext_len] == '-') ext_len++;
-							IndSeq = iter->FragPairVec[i].aln1.substr(j, ext_len);
-							InsertSeqMap[gPos - 1][IndSeq]++;
-							//printf("%lld: %s\n", gPos - 1, IndSeq.c_str());
-							//ShowSimplePairInfo(iter->FragPairVec);
-							j += ext_len; rPos += ext_len;
-						}
-						else if (iter->FragPairVec[i].aln1[j] == '-') // del
-						{
-							ext_len = 1; while (iter->FragPairVec[i].aln1[j + ext_len] == '-') ext_len++;
-							IndSeq = iter->FragPairVec[i].aln2.substr(j, ext_len);
-							DeleteSeqMap[gPos - 1][IndSeq]++;
-							//printf("%lld: %s\n", (long long)(gPos - 1), IndSeq.c_str());
-							//ShowSimplePairInfo(iter->FragPairVec);
-							j += ext_len; gPos += ext_len;
-						}
-						else
-						{
-							switch (iter->FragPairVec[i].aln1[j])
-							{
-							case 'A': if (MappingRecordArr[gPos].A < MaxAlleleCount) MappingRecordArr[gPos].A++; break;
-							case 'C': if (MappingRecordArr[gPos].C < MaxAlleleCount) MappingRecordArr[gPos].C++; break;
-							case 'G': if (MappingRecordArr[gPos].G < MaxAlleleCount) MappingRecordArr[gPos].G++; break;
-							case 'T': if (MappingRecordArr[gPos].T < MaxAlleleCount) MappingRecordArr[gPos].T++; break;
-							}
-							j++; rPos++; gPos++;
-						}
-					}
-				}
+				pPos = iter->first; WriteCheckpointData(fp, &pPos, sizeof(pPos));
+				WriteCheckpointData(fp, &iter->second, sizeof(MappingRecord_t));
 			}
 		}
+		WriteCheckpointBlockVec(fp, InsertEventVec, EvidenceIdx[0], b); WriteCheckpointBlockVec(fp, DeleteEventVec, EvidenceIdx[1], b);
+		WriteCheckpointBlockVec(fp, BreakPointVec, EvidenceIdx[2], b);
+		WriteCheckpointBlockVec(fp, InversionSiteVec, EvidenceIdx[3], b); WriteCheckpointBlockVec(fp, TranslocationSiteVec, EvidenceIdx[4], b);
+	}
+	WriteCheckpointData(fp, &header.magic, sizeof(header.magic)); // end mark
+
+	if (gzclose(fp) != Z_OK)
+	{
+		fprintf(stderr, "Error! Cannot write the profile checkpoint file!\n");
+		exit(1);
+	}
+}
+
+static gzFile OpenProfileCheckpoint(const char* filename, CheckpointHeader_t& header)
+{
+	gzFile fp;
+
+	if ((fp = gzopen(filename, "rb")) == NULL)
+	{
+		fprintf(stderr, "Error! Cannot open the profile checkpoint file [%s]!\n", filename);
+		exit(1);
+	}
+	ReadCheckpointData(fp, &header, sizeof(header));
+	if (header.magic != ProfileCheckpointMagic)
+	{
+		fprintf(stderr, "Error! [%s] is not a MapCaller profile checkpoint!\n", filename);
+		exit(1);
+	}
+	if (header.version != ProfileCheckpointVersion || header.BlockShift != ProfileBlockShift)
+	{
+		fprintf(stderr, "Error! The profile checkpoint version (%d) is not supported by this MapCaller (%d)!\n", header.version, ProfileCheckpointVersion);
+		exit(1);
+	}
+	if (header.GenomeSize != GenomeSize || header.ChromosomeNum != iChromsomeNum)
+	{
+		fprintf(stderr, "Error! The profile checkpoint [%s] was not generated with this reference index!\n", filename);
+		exit(1);
+	}
+	return fp;
+}
+
+static inline uint32_t SumCounts(uint32_t a, uint32_t b, uint32_t max)
+{
+	return a + b < max ? a + b : max;
+}
+
+static void MergeProfilePage(int64_t b, ProfileCell_t*& PageBuf, unordered_map<int64_t, MappingRecord_t>& OverflowBuf)
+{
+	// adds a shard page to block b with the saturation rules of mapping: a column that no longer fits its cell moves to the overflow table
+	int i;
+	int64_t pPos;
+	MappingRecord_t rec;
+	ProfileCell_t*& page = ProfileCellPageArr[b];
+
+	if (page == NULL && OverflowColumnArr[b] == NULL)
+	{
+		// first shard touching the block: take the buffers over
+		page = PageBuf; PageBuf = new ProfileCell_t[1 << ProfileBlockShift];
+		if (OverflowBuf.size() > 0) OverflowColumnArr[b] = new unordered_map<int64_t, MappingRecord_t>(), OverflowColumnArr[b]->swap(OverflowBuf);
+		return;
+	}
+	for (i = 0; i < (1 << ProfileBlockShift); i++)
+	{
+		ProfileCell_t& src = PageBuf[i];
+		if ((src.A | src.C | src.G | src.T | src.F1 | src.R1 | src.F2 | src.R2 | src.readCount | src.overflow) == 0) continue;
+
+		pPos = (b << ProfileBlockShift) + i;
+		ProfileCell_t& cell = GetProfileCell(pPos);
+		cell.readCount = SumCounts(cell.readCount, src.readCount, iMaxDuplicate);
+		if (src.overflow) rec = OverflowBuf.find(pPos)->second;
+		else
+		{
+			rec.A = src.A; rec.C = src.C; rec.G = src.G; rec.T = src.T;
+			rec.F1 = src.F1; rec.R1 = src.R1; rec.F2 = src.F2; rec.R2 = src.R2;
+		}
+		if (!cell.overflow && !src.overflow && cell.A + rec.A <= CellBaseMax && cell.C + rec.C <= CellBaseMax && cell.G + rec.G <= CellBaseMax && cell.T + rec.T <= CellBaseMax
+			&& cell.F1 + rec.F1 <= CellStrandMax && cell.R1 + rec.R1 <= CellStrandMax && cell.F2 + rec.F2 <= CellStrandMax && cell.R2 + rec.R2 <= CellStrandMax)
+		{
+			cell.A += rec.A; cell.C += rec.C; cell.G += rec.G; cell.T += rec.T;
+			cell.F1 += rec.F1; cell.R1 += rec.R1; cell.F2 += rec.F2; cell.R2 += rec.R2;
+		}
 		else
 		{
-			for (i = 0; i < num; i++)
+			MappingRecord_t& Profile = GetOverflowColumn(pPos);
+			Profile.A = SumCounts(Profile.A, rec.A, MaxAlleleCount); Profile.C = SumCounts(Profile.C, rec.C, MaxAlleleCount);
+			Profile.G = SumCounts(Profile.G, rec.G, MaxAlleleCount); Profile.T = SumCounts(Profile.T, rec.T, MaxAlleleCount);
+			Profile.F1 += rec.F1; Profile.R1 += rec.R1; Profile.F2 += rec.F2; Profile.R2 += rec.R2;
+		}
+	}
+}
+
+static void MergeDeepProfilePage(int64_t b, DeepProfileCell_t*& PageBuf)
+{
+	int i, j;
+	DeepProfileCell_t*& page = DeepCellPageArr[b];
+
+	if (page == NULL)
+	{
+		page = PageBuf; PageBuf = new DeepProfileCell_t[1 << ProfileBlockShift];
+		return;
+	}
+	for (i = 0; i < (1 << ProfileBlockShift); i++)
+	{
+		for (j = 0; j < 5; j++) page[i].base[j] += PageBuf[i].base[j];
+		for (j = 0; j < 4; j++) page[i].strand[j] += PageBuf[i].strand[j];
+		page[i].readCount = SumCounts(page[i].readCount, PageBuf[i].readCount, iMaxDuplicate);
+	}
+}
+
+static void MergeMultiHitPage(int64_t b, int32_t*& PageBuf)
+{
+	int32_t*& arr = MultiHitArr[b];
+
+	if (arr == NULL)
+	{
+		arr = PageBuf; PageBuf = new int32_t[1 << ProfileBlockShift];
+		return;
+	}
+	for (int i = 0; i < (1 << ProfileBlockShift); i++) arr[i] = bDeepCoverage ? arr[i] + PageBuf[i] : (int32_t)SumCounts(arr[i], PageBuf[i], MaxAlleleCount);
+}
+
+static void MergeCheckpointEvidence()
+{
+	// appends one block's indel events and SV evidence of all the shards; the evidence of later blocks lies further down the genome
+	int s, ShardNum = (int)CheckpointFpVec.size();
+	size_t n;
+	vector<IndEvent_t> IndBuf, InsertVec, DeleteVec;
+	vector<pair<int64_t, uint32_t> > BreakPointBuf, BreakPointVecOfBlock;
+	vector<DiscordPair_t> SiteBuf, InversionVec, TranslocationVec;
+	vector<pair<int64_t, uint32_t> >::iterator iter, dst;
+
+	for (s = 0; s < ShardNum; s++)
+	{
+		ReadCheckpointVec(CheckpointFpVec[s], IndBuf);
+		for (vector<IndEvent_t>::iterator IndIter = IndBuf.begin(); IndIter != IndBuf.end(); IndIter++) if (IndIter->len & IndSpillFlag) IndIter->seq = CheckpointSpillIdxVec[s][IndIter->seq];
+		InsertVec.insert(InsertVec.end(), IndBuf.begin(), IndBuf.end());
+		ReadCheckpointVec(CheckpointFpVec[s], IndBuf); DeleteVec.insert(DeleteVec.end(), IndBuf.begin(), IndBuf.end());
+
+		ReadCheckpointVec(CheckpointFpVec[s], BreakPointBuf); BreakPointVecOfBlock.insert(BreakPointVecOfBlock.end(), BreakPointBuf.begin(), BreakPointBuf.end());
+		ReadCheckpointVec(CheckpointFpVec[s], SiteBuf); n = InversionVec.size(); InversionVec.insert(InversionVec.end(), SiteBuf.begin(), SiteBuf.end());
+		inplace_merge(InversionVec.begin(), InversionVec.begin() + n, InversionVec.end(), CompByDiscordPos);
+		ReadCheckpointVec(CheckpointFpVec[s], SiteBuf); n = TranslocationVec.size(); TranslocationVec.insert(TranslocationVec.end(), SiteBuf.begin(), SiteBuf.end());
+		inplace_merge(TranslocationVec.begin(), TranslocationVec.begin() + n, TranslocationVec.end(), CompByDiscordPos);
+	}
+	if (ShardNum > 1)
+	{
+		CompactIndEvents(InsertVec); CompactIndEvents(DeleteVec);
+		sort(BreakPointVecOfBlock.begin(), BreakPointVecOfBlock.end());
+		if (BreakPointVecOfBlock.size() > 0)
+		{
+			for (dst = BreakPointVecOfBlock.begin(), iter = BreakPointVecOfBlock.begin() + 1; iter != BreakPointVecOfBlock.end(); iter++)
 			{
-				if (iter->FragPairVec[i].bSimple)
-				{
-					rPos = iter->FragPairVec[i].rPos; gPos = TwoGenomeSize - 1 - iter->FragPairVec[i].gPos;
-					for (j = 0; j < iter->FragPairVec[i].rLen; j++, rPos++, gPos--)
-					{
-						switch (read->seq[rPos])
-						{
-						case 'A': if (MappingRecordArr[gPos].T < MaxAlleleCount) MappingRecordArr[gPos].T++; break;
-						case 'C': if (MappingRecordArr[gPos].G < MaxAlleleCount) MappingRecordArr[gPos].G++; break;
-						case 'G': if (MappingRecordArr[gPos].C < MaxAlleleCount) MappingRecordArr[gPos].C++; break;
-						case 'T': if (MappingRecordArr[gPos].A < MaxAlleleCount) MappingRecordArr[gPos].A++; break;
-						}
-					}
-				}
-				else if (iter->FragPairVec[i].gLen == 0) // ins
-				{
-					gPos = TwoGenomeSize - iter->FragPairVec[i].gPos;
-					InsertSeqMap[gPos - 1][iter->FragPairVec[i].aln1]++;
-					//printf("%lld: %s\n", gPos - 1, iter->FragPairVec[i].aln1.c_str());
-					//ShowSimplePairInfo(iter->FragPairVec);
-				}
-				else if (iter->FragPairVec[i].rLen == 0) // del
-				{
-					gPos = (TwoGenomeSize - iter->FragPairVec[i].gPos - iter->FragPairVec[i].gLen);
-					DeleteSeqMap[gPos - 1][iter->FragPairVec[i].aln2]++;
-					//printf("%lld: %s\n", (long long)(gPos - 1), iter->FragPairVec[i].aln2.c_str());
-					//ShowSimplePairInfo(iter->FragPairVec);
-				}
-				else
-				{
-					rPos = read->rlen - (iter->FragPairVec[i].rPos + iter->FragPairVec[i].rLen);
-					gPos = TwoGenomeSize - (iter->FragPairVec[i].gPos + iter->FragPairVec[i].gLen);
-					for (frag_len = (int)iter->FragPairVec[i].aln1.length(), j = 0; j < frag_len;)
-					{
-						if (iter->FragPairVec[i].aln2[j] == '-') // ins
-						{
-							ext_len = 1; while (iter->FragPairVec[i].aln2[j + ext_len] == '-') ext_len++;
-							IndSeq = iter->FragPairVec[i].aln1.substr(j, ext_len);
-							InsertSeqMap[gPos - 1][IndSeq]++;
-							//printf("%lld: %s\n", (long long)(gPos - 1), IndSeq.c_str());
-							//ShowSimplePairInfo(iter->FragPairVec);
-							j += ext_len; rPos += ext_len;
-						}
-						else if (iter->FragPairVec[i].aln1[j] == '-') // del
-						{
-							ext_len = 1; while (iter->FragPairVec[i].aln1[j + ext_len] == '-') ext_len++;
-							IndSeq = iter->FragPairVec[i].aln2.substr(j, ext_len);
-							DeleteSeqMap[gPos - 1][IndSeq]++;
-							//printf("%lld: %s\n", (long long)(gPos - 1), IndSeq.c_str());
-							//ShowSimplePairInfo(iter->FragPairVec);
-							j += ext_len; gPos += ext_len;
-						}
-						else
-						{
-							switch (iter->FragPairVec[i].aln1[j])
-							{
-							case 'A': if (MappingRecordArr[gPos].A < MaxAlleleCount) MappingRecordArr[gPos].A++; break;
-							case 'C': if (MappingRecordArr[gPos].C < MaxAlleleCount) MappingRecordArr[gPos].C++; break;
-							case 'G': if (MappingRecordArr[gPos].G < MaxAlleleCount) MappingRecordArr[gPos].G++; break;
-							case 'T': if (MappingRecordArr[gPos].T < MaxAlleleCount) MappingRecordArr[gPos].T++; break;
-							}
-							j++; rPos++; gPos++;
-						}
-					}
-				}
+				if (iter->first == dst->first) dst->second += iter->second;
+				else *(++dst) = *iter;
 			}
+			BreakPointVecOfBlock.resize(dst - BreakPointVecOfBlock.begin() + 1);
 		}
 	}
+	InsertEventVec.insert(InsertEventVec.end(), InsertVec.begin(), InsertVec.end()); DeleteEventVec.insert(DeleteEventVec.end(), DeleteVec.begin(), DeleteVec.end());
+	BreakPointVec.insert(BreakPointVec.end(), BreakPointVecOfBlock.begin(), BreakPointVecOfBlock.end());
+	InversionSiteVec.insert(InversionSiteVec.end(), InversionVec.begin(), InversionVec.end());
+	TranslocationSiteVec.insert(TranslocationSiteVec.end(), TranslocationVec.begin(), TranslocationVec.end());
 }
 
-void UpdateMultiHitCount(ReadItem_t* read, vector<AlnCan_t>& AlnCanVec)
+void LoadProfileCheckpoints(vector<string>& FileNameVec)
 {
-	int64_t gPos, gPosEnd;
-	vector<AlnCan_t>::iterator iter;
-	vector<FragPair_t>::iterator FragIter;
+	// opens one or more checkpoints and reads their headers, target layout and spilled sequences; the blocks are loaded as the calling proceeds
+	int s, ShardNum = (int)FileNameVec.size();
+	uint32_t len;
+	uint64_t i, n;
+	string seq;
+	CheckpointHeader_t header, *HeaderArr = new CheckpointHeader_t[ShardNum];
+	vector<ProfileRegion_t> LayoutBuf;
+	map<string, uint64_t> SpillSeqMap;
+	map<string, uint64_t>::iterator iter;
 
-	for (iter = AlnCanVec.begin(); iter != AlnCanVec.end(); iter++)
+	CheckpointFpVec.resize(ShardNum); CheckpointSpillIdxVec.resize(ShardNum); CheckpointFileNameVec = FileNameVec;
+	for (s = 0; s < ShardNum; s++)
 	{
-		if (iter->score > 0)
+		CheckpointFpVec[s] = OpenProfileCheckpoint(FileNameVec[s].c_str(), HeaderArr[s]);
+		if (HeaderArr[s].bDeepCoverage != HeaderArr[0].bDeepCoverage)
+		{
+			fprintf(stderr, "Error! Profile checkpoints of the deep-coverage mode cannot be merged with the others!\n");
+			exit(1);
+		}
+		// the profile takes the target layout of the checkpoints, whatever -regions says; the calling still follows -regions
+		ReadCheckpointVec(CheckpointFpVec[s], s == 0 ? ProfileRegionVec : LayoutBuf);
+		if (s > 0 && (LayoutBuf.size() != ProfileRegionVec.size() || (LayoutBuf.size() > 0 && memcmp(&LayoutBuf[0], &ProfileRegionVec[0], LayoutBuf.size() * sizeof(ProfileRegion_t)) != 0)))
 		{
-			if (iter->orientation)
+			fprintf(stderr, "Error! Profile checkpoints of different target regions (-regions, -region_pad) cannot be merged!\n");
+			exit(1);
+		}
+		// spilled insert sequences are re-indexed so that equal sequences of different shards share an index
+		ReadCheckpointData(CheckpointFpVec[s], &n, sizeof(n)); CheckpointSpillIdxVec[s].resize(n);
+		for (i = 0; i < n; i++)
+		{
+			ReadCheckpointData(CheckpointFpVec[s], &len, sizeof(len)); seq.resize(len);
+			if (len > 0) ReadCheckpointData(CheckpointFpVec[s], &seq[0], len);
+			if ((iter = SpillSeqMap.find(seq)) == SpillSeqMap.end())
 			{
-				gPos = iter->FragPairVec.begin()->gPos;
-				gPosEnd = iter->FragPairVec.rbegin()->gPos + iter->FragPairVec.rbegin()->gLen;
+				iter = SpillSeqMap.insert(make_pair(seq, (uint64_t)IndSpillSeqVec.size())).first;
+				IndSpillSeqVec.push_back(seq);
 			}
-			else
+			CheckpointSpillIdxVec[s][i] = iter->second;
+		}
+	}
+	memset(&header, 0, sizeof(header));
+	for (s = 0; s < ShardNum; s++)
+	{
+		header.PairedNum += HeaderArr[s].PairedNum; header.PairedDistance += HeaderArr[s].PairedDistance; header.ReadLengthSum += HeaderArr[s].ReadLengthSum;
+		if (header.InversionSiteEnd < HeaderArr[s].InversionSiteEnd) header.InversionSiteEnd = HeaderArr[s].InversionSiteEnd;
+		if (header.TranslocationSiteEnd < HeaderArr[s].TranslocationSiteEnd) header.TranslocationSiteEnd = HeaderArr[s].TranslocationSiteEnd;
+	}
+	bDeepCoverage = HeaderArr[0].bDeepCoverage != 0;
+	iTotalPairedNum = header.PairedNum; TotalPairedDistance = header.PairedDistance; ReadLengthSum = header.ReadLengthSum;
+	InversionSiteEnd = header.InversionSiteEnd; TranslocationSiteEnd = header.TranslocationSiteEnd;
+	if (iTotalPairedNum > 0)
+	{
+		avgDist = (int)(1.*TotalPairedDistance / iTotalPairedNum + .5);
+		avgReadLength = (int)(1.*ReadLengthSum / (iTotalPairedNum << 1) + .5);
+		FragmentSize = avgDist + avgReadLength;
+	}
+	else
+	{
+		avgDist = avgReadLength = 0;
+		FragmentSize = HeaderArr[0].FragmentSize;
+	}
+	AllocateProfileBlocks();
+	if (ProfileSize != HeaderArr[0].ProfileSize)
+	{
+		fprintf(stderr, "Error! The profile checkpoint file [%s] is truncated or corrupt!\n", FileNameVec[0].c_str());
+		exit(1);
+	}
+	LoadedBlockNum = ReleasedBlockNum = PeakPageBytes = 0;
+	delete[] HeaderArr;
+}
+
+static int64_t GetLoadedGenomeEnd()
+{
+	// one past the last genome position of the loaded blocks: the profile and the evidence before it are loaded
+	int64_t gPos;
+
+	if (LoadedBlockNum == ProfileBlockNum) return GenomeSize;
+	if (LoadedBlockNum == 0) return 0;
+	GetProfileRun((LoadedBlockNum << ProfileBlockShift) - 1, ProfileSize, gPos);
+	return gPos + 1;
+}
+
+int64_t LoadProfileCheckpointBlocks(int64_t gPos)
+{
+	// loads the blocks of the open checkpoints until the loaded part of the genome reaches past gPos, and returns its end;
+	// the calling releases the blocks behind it, so only a window of the profile is held at a time
+	int s, ShardNum = (int)CheckpointFpVec.size();
+	int64_t b, pPos, PageBytes;
+	uint8_t flag;
+	uint32_t magic;
+	uint64_t i, n;
+	MappingRecord_t rec;
+	ProfileCell_t* PageBuf;
+	DeepProfileCell_t* DeepPageBuf;
+	int32_t* MultiHitBuf;
+	unordered_map<int64_t, MappingRecord_t> OverflowBuf;
+
+	if (ShardNum == 0) return GenomeSize;
+	if (GetLoadedGenomeEnd() > gPos) return GetLoadedGenomeEnd();
+
+	PageBuf = new ProfileCell_t[1 << ProfileBlockShift]; DeepPageBuf = new DeepProfileCell_t[1 << ProfileBlockShift]; MultiHitBuf = new int32_t[1 << ProfileBlockShift];
+	for (; LoadedBlockNum < ProfileBlockNum && GetLoadedGenomeEnd() <= gPos; LoadedBlockNum++)
+	{
+		b = LoadedBlockNum;
+		for (s = 0; s < ShardNum; s++)
+		{
+			ReadCheckpointData(CheckpointFpVec[s], &flag, 1);
+			if (flag & CKPT_PAGE)
+			{
+				if (bDeepCoverage) ReadCheckpointData(CheckpointFpVec[s], DeepPageBuf, sizeof(DeepProfileCell_t) << ProfileBlockShift);
+				else ReadCheckpointData(CheckpointFpVec[s], PageBuf, sizeof(ProfileCell_t) << ProfileBlockShift);
+			}
+			if (flag & CKPT_MULTI_HIT) ReadCheckpointData(CheckpointFpVec[s], MultiHitBuf, sizeof(int32_t) << ProfileBlockShift);
+			OverflowBuf.clear();
+			if (flag & CKPT_OVERFLOW)
+			{
+				ReadCheckpointData(CheckpointFpVec[s], &n, sizeof(n));
+				for (i = 0; i < n; i++)
+				{
+					ReadCheckpointData(CheckpointFpVec[s], &pPos, sizeof(pPos)); ReadCheckpointData(CheckpointFpVec[s], &rec, sizeof(rec));
+					OverflowBuf[pPos] = rec;
+				}
+			}
+			if (flag & CKPT_PAGE)
 			{
-				gPos = TwoGenomeSize - (iter->FragPairVec.begin()->gPos + iter->FragPairVec.begin()->gLen);
-				gPosEnd = TwoGenomeSize - iter->FragPairVec.rbegin()->gPos;
-				//printf("%lld - %lld (len=%d)\n", gPos, gPosEnd, gPosEnd - gPos);
+				if (bDeepCoverage) MergeDeepProfilePage(b, DeepPageBuf);
+				else MergeProfilePage(b, PageBuf, OverflowBuf);
 			}
-			for (; gPos < gPosEnd; gPos++)
+			if (flag & CKPT_MULTI_HIT) MergeMultiHitPage(b, MultiHitBuf);
+		}
+		MergeCheckpointEvidence();
+	}
+	delete[] PageBuf; delete[] DeepPageBuf; delete[] MultiHitBuf;
+
+	for (PageBytes = 0, b = ReleasedBlockNum; b < LoadedBlockNum; b++)
+	{
+		if (ProfileCellPageArr[b] != NULL || DeepCellPageArr[b] != NULL) PageBytes += (bDeepCoverage ? sizeof(DeepProfileCell_t) : sizeof(ProfileCell_t)) << ProfileBlockShift;
+		if (MultiHitArr[b] != NULL) PageBytes += sizeof(int32_t) << ProfileBlockShift;
+	}
+	if (PeakPageBytes < PageBytes) PeakPageBytes = PageBytes;
+
+	if (LoadedBlockNum == ProfileBlockNum)
+	{
+		for (s = 0; s < ShardNum; s++)
+		{
+			ReadCheckpointData(CheckpointFpVec[s], &magic, sizeof(magic));
+			if (magic != ProfileCheckpointMagic)
 			{
-				if (MappingRecordArr[gPos].multi_hit < MaxAlleleCount) MappingRecordArr[gPos].multi_hit++;
+				fprintf(stderr, "Error! The profile checkpoint file [%s] is truncated or corrupt!\n", CheckpointFileNameVec[s].c_str());
+				exit(1);
 			}
+			gzclose(CheckpointFpVec[s]);
 		}
+		CheckpointFpVec.clear(); CheckpointFileNameVec.clear(); vector<vector<uint64_t> >().swap(CheckpointSpillIdxVec);
+		fprintf(stderr, "\tAlignment profile: %lld blocks loaded, at most %.1f MB of pages held at a time\n", (long long)ProfileBlockNum, 1.0*PeakPageBytes / 1048576);
 	}
+	return GetLoadedGenomeEnd();
 }
@@ -163,6 +163,67 @@ bool CheckBWAIndexFiles(string IndexPrefix)
 	return bChecked;
 }
 
+static void MergeRegions(vector<pair<int64_t, int64_t> >& RegionVec)
+{
+	// sorts the intervals and merges the overlapping or adjacent ones
+	vector<pair<int64_t, int64_t> >::iterator iter, last;
+
+	if (RegionVec.size() == 0) return;
+	sort(RegionVec.begin(), RegionVec.end());
+	for (last = RegionVec.begin(), iter = last + 1; iter != RegionVec.end(); iter++)
+	{
+		if (iter->first <= last->second) { if (iter->second > last->second) last->second = iter->second; }
+		else *(++last) = *iter;
+	}
+	RegionVec.resize(last - RegionVec.begin() + 1);
+}
+
+void LoadTargetRegions(const char* filename)
+{
+	fstream file;
+	stringstream ss;
+	int64_t beg, end, ChrBeg, len, TargetSize, PaddedSize;
+	int UnknownNum = 0;
+	string str, chr;
+	map<string, int>::iterator iter;
+	vector<pair<int64_t, int64_t> >::iterator RegionIter;
+
+	file.open(filename, ios_base::in);
+	if (!file.is_open())
+	{
+		fprintf(stderr, "Error! Cannot open the region file [%s]\n", filename);
+		exit(1);
+	}
+	while (getline(file, str))
+	{
+		if (str == "" || str[0] == '#' || str.compare(0, 5, "track") == 0 || str.compare(0, 7, "browser") == 0) continue;
+		ss.clear(); ss.str(str); if (!(ss >> chr >> beg >> end)) continue;
+		if ((iter = ChrIdMap.find(chr)) == ChrIdMap.end())
+		{
+			UnknownNum++;
+			continue;
+		}
+		ChrBeg = ChromosomeVec[iter->second].FowardLocation; len = ChromosomeVec[iter->second].len;
+		if (beg < 0) beg = 0;
+		if (end > len) end = len;
+		if (beg >= end) continue;
+		TargetRegionVec.push_back(make_pair(ChrBeg + beg, ChrBeg + end));
+		PaddedRegionVec.push_back(make_pair(ChrBeg + (beg > RegionPadding ? beg - RegionPadding : 0), ChrBeg + (end + RegionPadding < len ? end + RegionPadding : len)));
+	}
+	file.close();
+	MergeRegions(TargetRegionVec); MergeRegions(PaddedRegionVec);
+
+	if (TargetRegionVec.size() == 0)
+	{
+		fprintf(stderr, "Error! No valid target region in [%s]\n", filename);
+		exit(1);
+	}
+	for (TargetSize = 0, RegionIter = TargetRegionVec.begin(); RegionIter != TargetRegionVec.end(); RegionIter++) TargetSize += RegionIter->second - RegionIter->first;
+	for (PaddedSize = 0, RegionIter = PaddedRegionVec.begin(); RegionIter != PaddedRegionVec.end(); RegionIter++) PaddedSize += RegionIter->second - RegionIter->first;
+	fprintf(stderr, "\tTarget regions: %d intervals, %lld bp (%lld bp with %d bp padding)\n", (int)TargetRegionVec.size(), (long long)TargetSize, (long long)PaddedSize, RegionPadding);
+	if (UnknownNum > 0) fprintf(stderr, "\tWarning! %d regions are on chromosomes not in the reference and are ignored\n", UnknownNum);
+}
+
 //bool DetermineVarType(string& ref_allele, string& alt_allele)
 //{
 //	if (ref_allele.length() == 1 && alt_allele.length() == 1) return true;
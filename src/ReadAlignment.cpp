@@ -1,25 +1,10 @@
 #include "structure.h"
 #define MinAlnBlcokSize 5
+#define GapAlnCacheSets 4096
+#define GapAlnCacheWays 4
 
 extern float MaxMisMatchRate;
 
-float CalFragAlnSeqIdy(string& aln1, string& aln2)
-{
-	int i, len = (int)aln1.length(), n = 0, mis = 0;
-
-	for (i = 0; i < len; i++)
-	{
-		if (aln1[i] != '-' && aln2[i] != '-')
-		{
-			n++;
-			if (aln1[i] != aln2[i]) mis++;
-		}
-	}
-	if (n != len && mis > 0) return 0;
-	else if(n > 0) return 1.0*(n - mis) / n;
-	else return 1;
-}
-
 bool CompByReadPos(const FragPair_t& p1, const FragPair_t& p2)
 {
 	if (p1.rPos == p2.rPos) return p1.gPos < p2.gPos;
@@ -132,72 +117,58 @@ bool CheckAlnCanCoverage(int rlen, vector<FragPair_t>& FragPairVec)
 
 int CalFragPairMismatches(int len, string& str1, string& str2)
 {
-	int i, mismatch;
-
-	for (mismatch = i = 0; i < len; i++)
-	{
-		if (str1[i] != str2[i]) mismatch++;
-	}
-	return mismatch;
+	return SeqMismatchNum(len, str1.c_str(), str2.c_str());
 }
 
-int CalFragPairMatches(int len, string& str1, string& str2)
+void SetMatchOps(int len, const char* str1, const char* str2, vector<uint32_t>& cigar)
 {
-	int i, match;
+	int i, n;
 
-	for (match = i = 0; i < len; i++)
+	for (i = 0; i < len; i += n)
 	{
-		if (str1[i] == str2[i]) match++;
+		n = len - i < 16 ? len - i : 16;
+		if (SeqMismatchNum(n, str1 + i, str2 + i) == 0) PushCigarOp(cigar, CIGAR_EQ, n);
+		else for (int k = i; k < i + n; k++) PushCigarOp(cigar, (str1[k] == str2[k] ? CIGAR_EQ : CIGAR_X), 1);
 	}
-	return match;
 }
 
-void ProcessNormalPair(char* seq, FragPair_t& fp)
+bool ProcessNormalPair(char* seq, FragPair_t& fp, GapAln_t& GapAln)
 {
-	//if (fp.rLen > 0 && fp.gLen > 0)
-	{
-		int n;
-
-		if (fp.rLen > 0)
-		{
-			fp.aln1.resize(fp.rLen);
-			strncpy((char*)fp.aln1.c_str(), seq + fp.rPos, fp.rLen);
-		}
-		else fp.aln1.assign(fp.gLen, '-');
-
-		if (fp.gLen > 0)
-		{
-			fp.aln2.resize(fp.gLen);
-			strncpy((char*)fp.aln2.c_str(), RefSequence + fp.gPos, fp.gLen);
-		}
-		else fp.aln2.assign(fp.rLen, '-');
+	int n;
 
-		//if (fp.rLen == 0 || fp.gLen == 0)
-		//{
-		//	printf("%s\n%s\n", fp.aln1.c_str(), fp.aln2.c_str());
-		//}
-		if (fp.gPos >= GenomeSize) // reverse sequence
-		{
-			if (fp.rLen > 0) SelfComplementarySeq(fp.rLen, (char*)fp.aln1.c_str());
-			if (fp.gLen > 0) SelfComplementarySeq(fp.gLen, (char*)fp.aln2.c_str());
-		}
-		if (fp.rLen > 0 && fp.gLen > 0 && (fp.rLen != fp.gLen || ((n = CalFragPairMismatches(fp.rLen, fp.aln1, fp.aln2)) > 1 && n >= (int)(fp.rLen*0.2))))
-		{
-			if (NW_ALG) nw_alignment(fp.rLen, fp.aln1, fp.gLen, fp.aln2);
-			else ksw2_alignment(fp.rLen, fp.aln1, fp.gLen, fp.aln2);
-			//if (bDebugMode) ShowFragmentPair(seq, fp), printf("Alignment for normal pair:\n%s\n\%s\n\n", fp.aln1.c_str(), fp.aln2.c_str());
-		}
+	fp.cigar.clear();
+	if (fp.rLen == 0 || fp.gLen == 0)
+	{
+		if (fp.rLen > 0) fp.cigar.push_back((uint32_t)fp.rLen << 4 | CIGAR_I);
+		else if (fp.gLen > 0) fp.cigar.push_back((uint32_t)fp.gLen << 4 | CIGAR_D);
+		return false;
+	}
+	GapAln.rseq.assign(seq + fp.rPos, fp.rLen);
+	GapAln.gseq.assign(RefSequence + fp.gPos, fp.gLen);
+	if (fp.gPos >= GenomeSize) // reverse sequence
+	{
+		SelfComplementarySeq(fp.rLen, (char*)GapAln.rseq.c_str());
+		SelfComplementarySeq(fp.gLen, (char*)GapAln.gseq.c_str());
+	}
+	// return true if the pair needs a gapped alignment
+	if (fp.rLen != fp.gLen || ((n = CalFragPairMismatches(fp.rLen, GapAln.rseq, GapAln.gseq)) > 1 && n >= (int)(fp.rLen*0.2)))
+	{
+		GapAln.fp = &fp;
+		return true;
 	}
+	SetMatchOps(fp.rLen, GapAln.rseq.c_str(), GapAln.gseq.c_str(), fp.cigar);
+	return false;
 }
 
 bool CheckLocalAlignmentQuality(FragPair_t& fp)
 {
-	int i, n, mis, len, AlnType, iStatus;
+	int op, len, n, mis, AlnType, iStatus;
 
-	AlnType = -1; len = (int)fp.aln1.length(); n = mis = iStatus = 0;
-	for (i = 0; i < len; i++)
+	AlnType = -1; n = mis = iStatus = 0;
+	for (vector<uint32_t>::iterator iter = fp.cigar.begin(); iter != fp.cigar.end(); iter++)
 	{
-		if (fp.aln1[i] == '-') // del
+		op = *iter & 0xf; len = *iter >> 4;
+		if (op == CIGAR_D) // del
 		{
 			if (AlnType != 0)
 			{
@@ -205,7 +176,7 @@ bool CheckLocalAlignmentQuality(FragPair_t& fp)
 				iStatus++;
 			}
 		}
-		else if (fp.aln2[i] == '-') // ins
+		else if (op == CIGAR_I) // ins
 		{
 			if (AlnType != 1)
 			{
@@ -215,7 +186,7 @@ bool CheckLocalAlignmentQuality(FragPair_t& fp)
 		}
 		else // type 2
 		{
-			n++; if (fp.aln1[i] != fp.aln2[i]) mis++;
+			n += len; if (op == CIGAR_X) mis += len;
 			if (AlnType != 2)
 			{
 				AlnType = 2;
@@ -223,60 +194,48 @@ bool CheckLocalAlignmentQuality(FragPair_t& fp)
 			}
 		}
 	}
-	if (iStatus >= 4 || (mis >= 3 && mis >= (int)(n*0.3)))
-	{
-		//if (bDebugMode) printf("BadAlignment\n%s\n%s\nIdy=%.4f\n", fp.aln1.c_str(), fp.aln2.c_str(), CalFragAlnSeqIdy(fp.aln1, fp.aln2));
-		return false;
-	}
+	if (iStatus >= 4 || (mis >= 3 && mis >= (int)(n*0.3))) return false;
 	else return true;
 }
 
 int EvaluateAlignmentScore(vector<FragPair_t>& FragPairVec)
 {
-	int len, score = 0;
+	int score = 0;
 	vector<FragPair_t>::iterator iter;
 
 	for (iter = FragPairVec.begin(); iter != FragPairVec.end(); iter++)
 	{
 		if (iter->bSimple) score += iter->rLen;
-		else if ((len = (int)iter->aln1.length()) > 0) score += CalFragPairMatches(len, iter->aln1, iter->aln2);
+		else if (iter->cigar.size() > 0) score += CalCigarOpLength(iter->cigar, CIGAR_EQ);
 	}
 	return score;
 }
 
 int FindMisMatchNumber(vector<FragPair_t>& FragPairVec)
 {
-	int i, len, mismatch = 0;
+	int mismatch = 0;
 	vector<FragPair_t>::iterator iter;
 	for (iter = FragPairVec.begin(); iter != FragPairVec.end(); iter++)
 	{
-		if (!iter->bSimple)
-		{
-			for (len = (int)iter->aln1.length(), i = 0; i < len; i++)
-			{
-				if (iter->aln1[i] != iter->aln2[i] && iter->aln1[i] != '-' && iter->aln2[i] != '-') mismatch++;
-			}
-		}
+		if (!iter->bSimple) mismatch += CalCigarOpLength(iter->cigar, CIGAR_X);
 	}
 	return mismatch;
 }
 
 void RemoveHeadingGaps(bool bFirstFragPair, FragPair_t& FragPair)
 {
-	int j, len, Rshrink = 0, Gshrink = 0;
+	int j, op, num, Rshrink = 0, Gshrink = 0;
 
-	for (len = (int)FragPair.aln1.length(), j = 0; j < len; j++)
+	for (num = (int)FragPair.cigar.size(), j = 0; j < num; j++)
 	{
-		if (FragPair.aln1[j] == '-') Gshrink++;
-		else if (FragPair.aln2[j] == '-') Rshrink++;
+		op = FragPair.cigar[j] & 0xf;
+		if (op == CIGAR_D) Gshrink += FragPair.cigar[j] >> 4;
+		else if (op == CIGAR_I) Rshrink += FragPair.cigar[j] >> 4;
 		else break;
 	}
 	if (j > 0)
 	{
-		//if (bDebugMode) printf("Before:\n%s\n%s\n", FragPair.aln1.c_str(), FragPair.aln2.c_str());
-		FragPair.aln1 = FragPair.aln1.substr(j);
-		FragPair.aln2 = FragPair.aln2.substr(j);
-		//if (bDebugMode) printf("After:\n%s\n%s\n\n",FragPair.aln1.c_str(), FragPair.aln2.c_str());
+		FragPair.cigar.erase(FragPair.cigar.begin(), FragPair.cigar.begin() + j);
 		FragPair.rLen -= Rshrink; FragPair.gLen -= Gshrink; 
 		if(bFirstFragPair) FragPair.rPos += Rshrink, FragPair.gPos += Gshrink;
 	}
@@ -284,32 +243,29 @@ void RemoveHeadingGaps(bool bFirstFragPair, FragPair_t& FragPair)
 
 void RemoveTailingGaps(bool bFirstFragPair, FragPair_t& FragPair)
 {
-	int j, len, Rshrink = 0, Gshrink = 0;
+	int j, op, num, Rshrink = 0, Gshrink = 0;
 
-	for (len = (int)FragPair.aln1.length(), j = len - 1; j >= 0; j--)
+	for (num = (int)FragPair.cigar.size(), j = num - 1; j >= 0; j--)
 	{
-		if (FragPair.aln1[j] == '-') Gshrink++;
-		else if (FragPair.aln2[j] == '-') Rshrink++;
+		op = FragPair.cigar[j] & 0xf;
+		if (op == CIGAR_D) Gshrink += FragPair.cigar[j] >> 4;
+		else if (op == CIGAR_I) Rshrink += FragPair.cigar[j] >> 4;
 		else break;
 	}
-	if (++j < len)
+	if (++j < num)
 	{
-		//if(bDebugMode) printf("Before:\n%s\n%s\n", FragPair.aln1.c_str(), FragPair.aln2.c_str());
-		FragPair.aln1.resize(j);
-		FragPair.aln2.resize(j);
-		//if (bDebugMode) printf("After:\n%s\n%s\n\n", FragPair.aln1.c_str(), FragPair.aln2.c_str());
+		FragPair.cigar.resize(j);
 		FragPair.rLen -= Rshrink, FragPair.gLen -= Gshrink;
 		if (bFirstFragPair) FragPair.rPos += Rshrink, FragPair.gPos += Gshrink;
 	}
 }
 
-bool ProduceReadAlignment(ReadItem_t& read)
+void CollectGapAlignments(ReadItem_t& read, vector<GapAln_t>& GapAlnVec)
 {
-	bool bHead, bTail;
+	GapAln_t GapAln;
 	vector<AlnCan_t>::iterator iter;
-	int i, FragPairNum, TailIdx, max_mismatches_thr;
+	vector<FragPair_t>::iterator FragPairIter;
 
-	max_mismatches_thr = (int)(read.rlen*MaxMisMatchRate);
 	for (iter = read.AlnCanVec.begin(); iter != read.AlnCanVec.end(); iter++)
 	{
 		if (iter->score == 0) continue;
@@ -322,6 +278,116 @@ bool ProduceReadAlignment(ReadItem_t& read)
 			iter->score = 0;
 			continue;
 		}
+		for (FragPairIter = iter->FragPairVec.begin(); FragPairIter != iter->FragPairVec.end(); FragPairIter++)
+		{
+			if (!FragPairIter->bSimple && ProcessNormalPair(read.seq, *FragPairIter, GapAln)) GapAlnVec.push_back(GapAln);
+		}
+	}
+}
+
+void InitGapAlnCache(GapAlnCache_t& cache)
+{
+	cache.clock = 0; cache.lookups = cache.hits = cache.evictions = 0;
+	cache.EntryVec.assign(GapAlnCacheSets * GapAlnCacheWays, GapAlnCacheEntry_t());
+	for (vector<GapAlnCacheEntry_t>::iterator iter = cache.EntryVec.begin(); iter != cache.EntryVec.end(); iter++) iter->stamp = 0;
+}
+
+uint64_t HashGapAln(GapAln_t& gap)
+{
+	uint64_t h = 14695981039346656037ULL; // FNV-1a
+
+	for (string::iterator iter = gap.rseq.begin(); iter != gap.rseq.end(); iter++) h = (h ^ (uint8_t)*iter) * 1099511628211ULL;
+	h ^= (uint64_t)gap.fp->gPos * 0x9E3779B97F4A7C15ULL;
+	h ^= ((uint64_t)gap.fp->rLen << 32 | (uint32_t)gap.fp->gLen) * 0xC2B2AE3D27D4EB4FULL;
+
+	return h ^ (h >> 29);
+}
+
+GapAlnCacheEntry_t* LookupGapAlnCache(GapAlnCache_t& cache, GapAln_t& gap, uint64_t hash)
+{
+	GapAlnCacheEntry_t* entry = &cache.EntryVec[(hash % GapAlnCacheSets) * GapAlnCacheWays];
+
+	cache.lookups++;
+	for (int i = 0; i < GapAlnCacheWays; i++, entry++)
+	{
+		if (entry->stamp > 0 && entry->hash == hash && entry->gPos == gap.fp->gPos && entry->rLen == gap.fp->rLen && entry->gLen == gap.fp->gLen && entry->rseq == gap.rseq)
+		{
+			cache.hits++; entry->stamp = ++cache.clock;
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+void InsertGapAlnCache(GapAlnCache_t& cache, GapAln_t& gap, uint64_t hash)
+{
+	int i;
+	GapAlnCacheEntry_t *entry, *victim;
+
+	// replace an empty slot or the least recently used one
+	entry = victim = &cache.EntryVec[(hash % GapAlnCacheSets) * GapAlnCacheWays];
+	for (i = 0; i < GapAlnCacheWays; i++, entry++) if (entry->stamp < victim->stamp) victim = entry;
+	if (victim->stamp > 0) cache.evictions++;
+
+	victim->stamp = ++cache.clock; victim->hash = hash;
+	victim->gPos = gap.fp->gPos; victim->rLen = gap.fp->rLen; victim->gLen = gap.fp->gLen;
+	victim->rseq = gap.rseq; victim->cigar = gap.fp->cigar;
+}
+
+void SolveGapAlignments(vector<GapAln_t>& GapAlnVec, GapAlnCache_t& cache)
+{
+	int i, j, p1, p2, num;
+	vector<uint64_t> HashVec;
+	vector<uint32_t> cigar;
+	vector<GapAln_t>::iterator iter;
+	GapAlnCacheEntry_t* entry;
+
+	// take the cached alignments and keep the misses at the front
+	for (num = (int)GapAlnVec.size(), i = j = 0; i < num; i++)
+	{
+		uint64_t hash = HashGapAln(GapAlnVec[i]);
+		if ((entry = LookupGapAlnCache(cache, GapAlnVec[i], hash)) != NULL) GapAlnVec[i].fp->cigar = entry->cigar;
+		else
+		{
+			if (i != j) swap(GapAlnVec[i], GapAlnVec[j]);
+			HashVec.push_back(hash); j++;
+		}
+	}
+	GapAlnVec.resize(j);
+
+	if (NW_ALG) nw_batch_alignment(GapAlnVec);
+	else for (iter = GapAlnVec.begin(); iter != GapAlnVec.end(); iter++) ksw2_alignment(iter->fp->rLen, iter->rseq, iter->fp->gLen, iter->gseq, iter->fp->cigar);
+
+	// split the M ops of the aligners into =/X
+	for (iter = GapAlnVec.begin(); iter != GapAlnVec.end(); iter++)
+	{
+		cigar.clear();
+		for (p1 = p2 = 0, i = 0; i < (int)iter->fp->cigar.size(); i++)
+		{
+			uint32_t c = iter->fp->cigar[i];
+			switch (c & 0xf)
+			{
+			case CIGAR_M: SetMatchOps(c >> 4, iter->rseq.c_str() + p1, iter->gseq.c_str() + p2, cigar); p1 += c >> 4; p2 += c >> 4; break;
+			case CIGAR_I: PushCigarOp(cigar, CIGAR_I, c >> 4); p1 += c >> 4; break;
+			case CIGAR_D: PushCigarOp(cigar, CIGAR_D, c >> 4); p2 += c >> 4; break;
+			}
+		}
+		iter->fp->cigar.swap(cigar);
+		InsertGapAlnCache(cache, *iter, HashVec[iter - GapAlnVec.begin()]);
+	}
+}
+
+// the gapped alignments of normal pairs are produced by CollectGapAlignments() and SolveGapAlignments() beforehand
+bool ProduceReadAlignment(ReadItem_t& read)
+{
+	bool bHead, bTail;
+	vector<AlnCan_t>::iterator iter;
+	int i, FragPairNum, TailIdx, max_mismatches_thr;
+
+	max_mismatches_thr = (int)(read.rlen*MaxMisMatchRate);
+	for (iter = read.AlnCanVec.begin(); iter != read.AlnCanVec.end(); iter++)
+	{
+		if (iter->score == 0) continue;
 		//if (CheckAlnCanCoverage(read.rlen, iter->FragPairVec) == false)
 		//{
 		//	printf("read: %s\n", read.header);
@@ -339,18 +405,17 @@ bool ProduceReadAlignment(ReadItem_t& read)
 		{
 			if (!iter->FragPairVec[i].bSimple)
 			{
-				ProcessNormalPair(read.seq, iter->FragPairVec[i]);
 				if (i == 0)
 				{
 					if(iter->FragPairVec[i].gPos < GenomeSize) RemoveHeadingGaps(true, iter->FragPairVec[i]);
 					else RemoveTailingGaps(true, iter->FragPairVec[i]);
 
-					if ((int)iter->FragPairVec[i].aln1.length() >= MinAlnBlcokSize && CheckLocalAlignmentQuality(iter->FragPairVec[i]) == false)
+					if (CalCigarColumnNum(iter->FragPairVec[i].cigar) >= MinAlnBlcokSize && CheckLocalAlignmentQuality(iter->FragPairVec[i]) == false)
 					{
 						//printf("read:%s\n", read.header); ShowSimplePairInfo(iter->FragPairVec);
 						bHead = false;
 						iter->FragPairVec[i].rLen = iter->FragPairVec[i].gLen = 0;
-						iter->FragPairVec[i].aln1.clear(); iter->FragPairVec[i].aln2.clear();
+						iter->FragPairVec[i].cigar.clear();
 						iter->FragPairVec[i].rPos = iter->FragPairVec[i + 1].rPos;
 						iter->FragPairVec[i].gPos = iter->FragPairVec[i + 1].gPos;
 					}
@@ -360,14 +425,14 @@ bool ProduceReadAlignment(ReadItem_t& read)
 					if (iter->FragPairVec[i].gPos < GenomeSize) RemoveTailingGaps(false, iter->FragPairVec[i]);
 					else RemoveHeadingGaps(false, iter->FragPairVec[i]);
 
-					if ((int)iter->FragPairVec[i].aln1.length() >= MinAlnBlcokSize && CheckLocalAlignmentQuality(iter->FragPairVec[i]) == false)
+					if (CalCigarColumnNum(iter->FragPairVec[i].cigar) >= MinAlnBlcokSize && CheckLocalAlignmentQuality(iter->FragPairVec[i]) == false)
 					{
 						//printf("read:%s\n", read.header); ShowSimplePairInfo(iter->FragPairVec);
 						bTail = false;
 						iter->FragPairVec[i].rLen = iter->FragPairVec[i].gLen = 0;
 						iter->FragPairVec[i].rPos = iter->FragPairVec[i - 1].rPos + iter->FragPairVec[i - 1].rLen;
 						iter->FragPairVec[i].gPos = iter->FragPairVec[i - 1].gPos + iter->FragPairVec[i - 1].gLen;
-						iter->FragPairVec[i].aln1.clear(); iter->FragPairVec[i].aln2.clear();
+						iter->FragPairVec[i].cigar.clear();
 					}
 				}
 				else
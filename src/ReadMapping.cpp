@@ -3,11 +3,13 @@
 #include "sam_opts.h"
 #include "htslib/htslib/kseq.h"
 #include "htslib/htslib/kstring.h"
+#include <queue>
 
 #define MinInversionSize 1000
 #define MaxPairedDistance 2000
 #define MaxInversionSize 10000000
 #define MinTranslocationSize 1000
+#define AlnChunkSize 1024
 
 FILE *vcf_output;
 FILE *sam_out = 0;
@@ -17,8 +19,16 @@ bool bSepLibrary = false;
 FILE *ReadFileHandler1, *ReadFileHandler2;
 gzFile gzReadFileHandler1, gzReadFileHandler2;
 vector<DiscordPair_t> InversionSiteVec, TranslocationSiteVec;
+int64_t InversionSiteEnd = 0, TranslocationSiteEnd = 0; // one past the last site: the calling stage may hold only a window of the sites
+vector<pair<int64_t, uint32_t> > BreakPointVec;
+vector<SVEvidence_t> ThreadSVEvidenceVec;
 uint32_t avgCov, avgReadLength, avgDist = 1000;
 int64_t iTotalReadNum = 0, iTotalMappingNum = 0, iTotalPairedNum = 0, iAlignedBase = 0, iTotalCoverage = 0, TotalPairedDistance = 0, ReadLengthSum = 0;
+int64_t GapAlnLookupNum = 0, GapAlnHitNum = 0, GapAlnEvictionNum = 0, OffTargetReadNum = 0;
+vector<ProfileBuffer_t> ThreadProfileStatVec;
+samFile *aln_in = NULL;
+bam_hdr_t *aln_header = NULL;
+static vector<int> AlnChrIdxVec; // chromosome of each sequence of the -aln header (-1: not in the reference)
 
 void ShowMappedRegion(vector<FragPair_t>& FragPairVec)
 {
@@ -324,15 +334,11 @@ void MaskUnPairedAlnCan(vector<AlnCan_t>& AlnCanVec1, vector<AlnCan_t>& AlnCanVe
 
 bool CheckAlignmentQuality(FragPair_t& FragPair)
 {
-	int i, len, iMis, iGap;
+	int len, iMis, iGap;
 	bool bPass = true;
 
-	len = (int)FragPair.aln1.length(); iMis = iGap = 0;
-	for (i = 0; i < len; i++)
-	{
-		if (FragPair.aln1[i] == '-' || FragPair.aln2[i] == '-') iGap++;
-		else if (FragPair.aln1[i] != FragPair.aln2[i]) iMis++;
-	}
+	len = CalCigarColumnNum(FragPair.cigar); iMis = CalCigarOpLength(FragPair.cigar, CIGAR_X);
+	iGap = CalCigarOpLength(FragPair.cigar, CIGAR_I) + CalCigarOpLength(FragPair.cigar, CIGAR_D);
 	if (iMis > 0 && iGap > 0) bPass = false;
 	else if (iMis > 1 && iMis > (int)(len*0.2)) bPass = false;
 
@@ -403,7 +409,7 @@ int CheckAlnNumber(vector<AlnCan_t>& AlnCanVec)
 
 void EnCodeReadSeq(int rlen, char* seq, uint8_t* EncodeSeq)
 {
-	for (int i = 0; i < rlen; i++) EncodeSeq[i] = nst_nt4_table[(int)seq[i]];
+	SeqEncodeNt4(rlen, seq, EncodeSeq);
 }
 
 void FreeReadItem(ReadItem_t* read)
@@ -413,8 +419,72 @@ void FreeReadItem(ReadItem_t* read)
 	if (read->qual != NULL)delete[] read->qual;
 }
 
+static bool CollectPairEvidence(CoordinatePair_t& CoorPair, DiscordPair_t& DiscordPair, vector<DiscordPair_t>& INVSiteVec, vector<DiscordPair_t>& TNLSiteVec)
+{
+	// inversion and translocation sites of a read pair; returns true for a concordant pair
+	if (CoorPair.gPos1 == -1 || CoorPair.gPos2 == -1) return false; // OEA
+
+	if ((CoorPair.gPos1 < GenomeSize && CoorPair.gPos2 >= GenomeSize))
+	{
+		if (bVCFoutput)
+		{
+			DiscordPair.dist = abs(TwoGenomeSize - CoorPair.gPos1 - CoorPair.gPos2);
+			if (DiscordPair.dist > MinInversionSize && DiscordPair.dist < MaxInversionSize)
+			{
+				DiscordPair.gPos = CoorPair.gPos1; INVSiteVec.push_back(DiscordPair);
+			}
+		}
+	}
+	else if (CoorPair.gPos1 >= GenomeSize && CoorPair.gPos2 < GenomeSize)
+	{
+		if (bVCFoutput)
+		{
+			DiscordPair.dist = abs(TwoGenomeSize - CoorPair.gPos1 - CoorPair.gPos2);
+			if (DiscordPair.dist > MinInversionSize && DiscordPair.dist < MaxInversionSize) DiscordPair.gPos = CoorPair.gPos2; INVSiteVec.push_back(DiscordPair);
+		}
+	}
+	else if (CoorPair.dist > MinTranslocationSize)
+	{
+		if (bVCFoutput)
+		{
+			DiscordPair.dist = CoorPair.dist;
+			//printf("gPos1=%lld, gPos2=%lld, dist=%lld\n", CoorPair.gPos1, CoorPair.gPos2, CoorPair.dist);
+			if (CoorPair.gPos1 < GenomeSize && CoorPair.gPos2 < GenomeSize)
+			{
+				DiscordPair.gPos = CoorPair.gPos1; TNLSiteVec.push_back(DiscordPair);
+				DiscordPair.gPos = CoorPair.gPos2; TNLSiteVec.push_back(DiscordPair);
+			}
+			else if (CoorPair.gPos1 >= GenomeSize && CoorPair.gPos2 >= GenomeSize)
+			{
+				DiscordPair.gPos = TwoGenomeSize - CoorPair.gPos1; TNLSiteVec.push_back(DiscordPair);
+				DiscordPair.gPos = TwoGenomeSize - CoorPair.gPos2; TNLSiteVec.push_back(DiscordPair);
+			}
+		}
+	}
+	else return true;
+	return false;
+}
+
+static void SaveThreadProfile(int tid, ProfileBuffer_t& ProfileBuffer, vector<DiscordPair_t>& INVSiteVec, vector<DiscordPair_t>& TNLSiteVec, int64_t myOffTargetNum)
+{
+	MergeProfileBuffer(ProfileBuffer);
+
+	pthread_mutex_lock(&OutputLock);
+	OffTargetReadNum += myOffTargetNum;
+	ThreadProfileStatVec[tid].LockWaitTime += ProfileBuffer.LockWaitTime; ThreadProfileStatVec[tid].LockNum += ProfileBuffer.LockNum; ThreadProfileStatVec[tid].ContendedNum += ProfileBuffer.ContendedNum;
+	pthread_mutex_unlock(&OutputLock);
+
+	// each thread leaves its sorted evidence in its own slot; MergeSVEvidence() combines them after mapping
+	SVEvidence_t& evidence = ThreadSVEvidenceVec[tid];
+	sort(TNLSiteVec.begin(), TNLSiteVec.end(), CompByDiscordPos); evidence.TNLSiteVec.swap(TNLSiteVec);
+	sort(INVSiteVec.begin(), INVSiteVec.end(), CompByDiscordPos); evidence.INVSiteVec.swap(INVSiteVec);
+	sort(ProfileBuffer.BreakPointVec.begin(), ProfileBuffer.BreakPointVec.end()); evidence.BreakPointVec.swap(ProfileBuffer.BreakPointVec);
+}
+
 void *ReadMapping(void *arg)
 {
+	int tid = *((int*)arg);
+	ProfileBuffer_t ProfileBuffer;
 	uint8_t* EncodeSeq;
 	AlnSummary_t AlnSummary;
 	DiscordPair_t DiscordPair;
@@ -422,11 +492,15 @@ void *ReadMapping(void *arg)
 	ReadItem_t* ReadArr = NULL;
 	vector<string> SamStreamVec;
 	vector<FragPair_t> SimplePairVec;
-	int64_t myTotalDistance, myReadLengthSum;
+	vector<GapAln_t> GapAlnVec;
+	GapAlnCache_t GapAlnCache;
+	int64_t myTotalDistance, myReadLengthSum, myOffTargetNum = 0;
 	int i, j, n, ReadNum, MappedNum, PairedNum;
 	vector<DiscordPair_t> INVSiteVec , TNLSiteVec;
 
 	ReadArr = new ReadItem_t[ReadChunkSize];
+	InitGapAlnCache(GapAlnCache);
+	ProfileBuffer.LockWaitTime = 0; ProfileBuffer.LockNum = ProfileBuffer.ContendedNum = 0;
 
 	AlnSummary.score = AlnSummary.sub_score = 0; AlnSummary.BestAlnCanIdx = -1;
 	while (true)
@@ -469,6 +543,12 @@ void *ReadMapping(void *arg)
 				if(n == 0) RemoveRedundantAlnCan(ReadArr[i].AlnCanVec), RemoveRedundantAlnCan(ReadArr[j].AlnCanVec);
 				else MaskUnPairedAlnCan(ReadArr[i].AlnCanVec, ReadArr[j].AlnCanVec);
 
+				CollectGapAlignments(ReadArr[i], GapAlnVec); CollectGapAlignments(ReadArr[j], GapAlnVec);
+			}
+			// solve the gap alignments of the whole chunk together
+			SolveGapAlignments(GapAlnVec, GapAlnCache); GapAlnVec.clear();
+			for (i = 0, j = 1; i != ReadNum; i += 2, j += 2)
+			{
 				if (ProduceReadAlignment(ReadArr[i])) MappedNum++;
 				if (ProduceReadAlignment(ReadArr[j])) MappedNum++;
 				//if (bDebugMode)
@@ -476,61 +556,11 @@ void *ReadMapping(void *arg)
 				//	printf("read1:%s\n", ReadArr[i].header); ShowFragPairCluster(ReadArr[i].AlnCanVec);
 				//	printf("read2:%s\n", ReadArr[j].header); ShowFragPairCluster(ReadArr[j].AlnCanVec);
 				//}
-				if ((CoorPair = GenCoordinatePair(ReadArr[i].AlnCanVec, ReadArr[j].AlnCanVec)).dist != 0)
+				if ((CoorPair = GenCoordinatePair(ReadArr[i].AlnCanVec, ReadArr[j].AlnCanVec)).dist != 0 && CollectPairEvidence(CoorPair, DiscordPair, INVSiteVec, TNLSiteVec))
 				{
-					if (CoorPair.gPos1 == -1 || CoorPair.gPos2 == -1)
-					{
-					}
-					else
-					{
-						if ((CoorPair.gPos1 < GenomeSize && CoorPair.gPos2 >= GenomeSize))
-						{
-							if (bVCFoutput)
-							{
-								DiscordPair.dist = abs(TwoGenomeSize - CoorPair.gPos1 - CoorPair.gPos2);
-								if (DiscordPair.dist > MinInversionSize && DiscordPair.dist < MaxInversionSize)
-								{
-									DiscordPair.gPos = CoorPair.gPos1; INVSiteVec.push_back(DiscordPair);
-								}
-							}
-						}
-						else if (CoorPair.gPos1 >= GenomeSize && CoorPair.gPos2 < GenomeSize)
-						{
-							if (bVCFoutput)
-							{
-								DiscordPair.dist = abs(TwoGenomeSize - CoorPair.gPos1 - CoorPair.gPos2);
-								if (DiscordPair.dist > MinInversionSize && DiscordPair.dist < MaxInversionSize) DiscordPair.gPos = CoorPair.gPos2; INVSiteVec.push_back(DiscordPair);
-							}
-						}
-						else if (CoorPair.dist > MinTranslocationSize)
-						{
-							if (bVCFoutput)
-							{
-								DiscordPair.dist = CoorPair.dist;
-								//printf("gPos1=%lld, gPos2=%lld, dist=%lld\n", CoorPair.gPos1, CoorPair.gPos2, CoorPair.dist);
-								if (CoorPair.gPos1 < GenomeSize && CoorPair.gPos2 < GenomeSize)
-								{
-									DiscordPair.gPos = CoorPair.gPos1; TNLSiteVec.push_back(DiscordPair);
-									DiscordPair.gPos = CoorPair.gPos2; TNLSiteVec.push_back(DiscordPair);
-								}
-								else if (CoorPair.gPos1 >= GenomeSize && CoorPair.gPos2 >= GenomeSize)
-								{
-									DiscordPair.gPos = TwoGenomeSize - CoorPair.gPos1; TNLSiteVec.push_back(DiscordPair);
-									DiscordPair.gPos = TwoGenomeSize - CoorPair.gPos2; TNLSiteVec.push_back(DiscordPair);
-								}
-							}
-						}
-						else
-						{
-							//Coordinate_t coor1 = DetermineCoordinate(CoorPair.gPos1), coor2 = DetermineCoordinate(CoorPair.gPos2);
-							//MC = GenMappingCoordinates(CoorPair);
-							//MC.rlen1 = ReadArr[i].rlen; MC.rlen2 = ReadArr[j].rlen;
-							//printf("%lld %lld vs %d %d\n", (long long)coor1.gPos - 1, (long long)coor2.gPos - 1, MC.gPos1, MC.gPos2);
-							myReadLengthSum += ReadArr[i].rlen;
-							myReadLengthSum += ReadArr[j].rlen;
-							PairedNum++; myTotalDistance += CoorPair.dist;
-						}
-					}
+					myReadLengthSum += ReadArr[i].rlen;
+					myReadLengthSum += ReadArr[j].rlen;
+					PairedNum++; myTotalDistance += CoorPair.dist;
 				}
 			}
 			if (bSAMoutput) for (SamStreamVec.clear(), i = 0, j = 1; i != ReadNum; i += 2, j += 2) GeneratePairedSamStream(ReadArr[i], ReadArr[j], SamStreamVec);
@@ -561,15 +591,18 @@ void *ReadMapping(void *arg)
 			// update the mapping status and the query genome profile
 			if (bVCFoutput) 
 			{
-				pthread_mutex_lock(&ProfileLock);
 				for (i = 0; i != ReadNum; i++)
 				{
 					//if (strcmp(ReadArr[i].header, "NC_000913_mut_1472703_1473141_0_1_0_0_0:0:0_2:0:0_45ec") == 0) ShowFragPairCluster(ReadArr[i].AlnCanVec);
 					if (ReadArr[i].AlnSummary.score == 0) continue;
-					if ((n = CheckAlnNumber(ReadArr[i].AlnCanVec)) == 1) UpdateProfile((i % 2 == 0), ReadArr + i, ReadArr[i].AlnCanVec);
-					else UpdateMultiHitCount(ReadArr + i, ReadArr[i].AlnCanVec);
+					if (PaddedRegionVec.size() > 0 && !CheckAlnCanOnTarget(ReadArr[i].AlnCanVec))
+					{
+						myOffTargetNum++;
+						continue;
+					}
+					if ((n = CheckAlnNumber(ReadArr[i].AlnCanVec)) == 1) UpdateProfile((i % 2 == 0), ReadArr + i, ReadArr[i].AlnCanVec, ProfileBuffer);
+					else UpdateMultiHitCount(ReadArr + i, ReadArr[i].AlnCanVec, ProfileBuffer);
 				}
-				pthread_mutex_unlock(&ProfileLock);
 			}
 		}
 		else //singled-end reads
@@ -581,8 +614,10 @@ void *ReadMapping(void *arg)
 				SimplePairVec = IdentifySimplePairs(ReadArr[i].rlen, EncodeSeq); delete[] EncodeSeq;
 				ReadArr[i].AlnSummary = AlnSummary; ReadArr[i].AlnCanVec = SimplePairClustering(ReadArr[i].rlen, SimplePairVec);
 				RemoveRedundantAlnCan(ReadArr[i].AlnCanVec); 
-				if (ProduceReadAlignment(ReadArr[i])) MappedNum++;
+				CollectGapAlignments(ReadArr[i], GapAlnVec);
 			}
+			SolveGapAlignments(GapAlnVec, GapAlnCache); GapAlnVec.clear();
+			for (i = 0; i != ReadNum; i++) if (ProduceReadAlignment(ReadArr[i])) MappedNum++;
 			if (bSAMoutput) for (SamStreamVec.clear(), i = 0; i != ReadNum; i++) GenerateSingleSamStream(ReadArr[i], SamStreamVec);
 			pthread_mutex_lock(&OutputLock);
 			iTotalReadNum += ReadNum; iTotalMappingNum += MappedNum;
@@ -609,14 +644,17 @@ void *ReadMapping(void *arg)
 			// update the mapping status and the query genome profile
 			if (bVCFoutput)
 			{
-				pthread_mutex_lock(&ProfileLock);
 				for (i = 0; i != ReadNum; i++)
 				{
 					if (ReadArr[i].AlnSummary.score == 0) continue;
-					if ((n = CheckAlnNumber(ReadArr[i].AlnCanVec)) == 1) UpdateProfile(true, ReadArr + i, ReadArr[i].AlnCanVec);
-					else UpdateMultiHitCount(ReadArr + i, ReadArr[i].AlnCanVec);
+					if (PaddedRegionVec.size() > 0 && !CheckAlnCanOnTarget(ReadArr[i].AlnCanVec))
+					{
+						myOffTargetNum++;
+						continue;
+					}
+					if ((n = CheckAlnNumber(ReadArr[i].AlnCanVec)) == 1) UpdateProfile(true, ReadArr + i, ReadArr[i].AlnCanVec, ProfileBuffer);
+					else UpdateMultiHitCount(ReadArr + i, ReadArr[i].AlnCanVec, ProfileBuffer);
 				}
-				pthread_mutex_unlock(&ProfileLock);
 			}
 		}
 		for (i = 0; i != ReadNum; i++)  FreeReadItem(ReadArr + i);
@@ -624,66 +662,263 @@ void *ReadMapping(void *arg)
 	}
 	delete[] ReadArr;
 
-	if (bVCFoutput)
+	pthread_mutex_lock(&OutputLock);
+	GapAlnLookupNum += GapAlnCache.lookups; GapAlnHitNum += GapAlnCache.hits; GapAlnEvictionNum += GapAlnCache.evictions;
+	pthread_mutex_unlock(&OutputLock);
+	if (bVCFoutput) SaveThreadProfile(tid, ProfileBuffer, INVSiteVec, TNLSiteVec, myOffTargetNum);
+
+	return (void*)(1);
+}
+
+static inline int64_t GetSortKey(const DiscordPair_t& p) { return p.gPos; }
+static inline int64_t GetSortKey(int64_t gPos) { return gPos; }
+
+template<class T> static void MergeSortedRuns(vector<vector<T>*>& RunVec, vector<T>& out)
+{
+	// k-way merge of runs sorted by position
+	int k;
+	size_t total = 0;
+	vector<size_t> IdxVec(RunVec.size(), 0);
+	priority_queue<pair<int64_t, int>, vector<pair<int64_t, int> >, greater<pair<int64_t, int> > > heap;
+
+	for (k = 0; k < (int)RunVec.size(); k++)
 	{
-		sort(TNLSiteVec.begin(), TNLSiteVec.end(), CompByDiscordPos);
-		sort(INVSiteVec.begin(), INVSiteVec.end(), CompByDiscordPos);
+		total += RunVec[k]->size();
+		if (RunVec[k]->size() > 0) heap.push(make_pair(GetSortKey((*RunVec[k])[0]), k));
+	}
+	out.clear(); out.reserve(total);
+	while (!heap.empty())
+	{
+		k = heap.top().second; heap.pop();
+		out.push_back((*RunVec[k])[IdxVec[k]]);
+		if (++IdxVec[k] < RunVec[k]->size()) heap.push(make_pair(GetSortKey((*RunVec[k])[IdxVec[k]]), k));
+	}
+}
 
-		pthread_mutex_lock(&ProfileLock);
-		if ((n = (int)TNLSiteVec.size()) > 0)
-		{
-			copy(TNLSiteVec.begin(), TNLSiteVec.end(), back_inserter(TranslocationSiteVec));
-			inplace_merge(TranslocationSiteVec.begin(), TranslocationSiteVec.end() - n, TranslocationSiteVec.end(), CompByDiscordPos);
-		}
-		if ((n = (int)INVSiteVec.size()) > 0)
+static void *MergeSVEvidenceByType(void *arg)
+{
+	int i, type = *((int*)arg);
+
+	if (type == 0)
+	{
+		vector<int64_t> PosVec;
+		vector<vector<int64_t>*> RunVec;
+		for (i = 0; i < iThreadNum; i++) RunVec.push_back(&ThreadSVEvidenceVec[i].BreakPointVec);
+		MergeSortedRuns(RunVec, PosVec);
+		for (i = 0; i < iThreadNum; i++) vector<int64_t>().swap(ThreadSVEvidenceVec[i].BreakPointVec);
+
+		BreakPointVec.clear();
+		for (vector<int64_t>::iterator iter = PosVec.begin(); iter != PosVec.end(); iter++)
 		{
-			copy(INVSiteVec.begin(), INVSiteVec.end(), back_inserter(InversionSiteVec));
-			inplace_merge(InversionSiteVec.begin(), InversionSiteVec.end() - n, InversionSiteVec.end(), CompByDiscordPos);
+			if (BreakPointVec.size() > 0 && BreakPointVec.back().first == *iter) BreakPointVec.back().second++;
+			else BreakPointVec.push_back(make_pair(*iter, 1));
 		}
-		pthread_mutex_unlock(&ProfileLock);
+	}
+	else
+	{
+		vector<vector<DiscordPair_t>*> RunVec;
+		for (i = 0; i < iThreadNum; i++) RunVec.push_back(type == 1 ? &ThreadSVEvidenceVec[i].INVSiteVec : &ThreadSVEvidenceVec[i].TNLSiteVec);
+		MergeSortedRuns(RunVec, type == 1 ? InversionSiteVec : TranslocationSiteVec);
+		for (i = 0; i < iThreadNum; i++) vector<DiscordPair_t>().swap(*RunVec[i]);
 	}
 	return (void*)(1);
 }
 
-void *CheckMappingCoverage(void *arg)
+void MergeSVEvidence()
 {
-	int cov, tid = *((int*)arg);
-	int64_t gPos, myAlignedBase = 0, myCoverageSum = 0;
+	// breakpoints, inversion sites and translocation sites are merged concurrently
+	int i, TypeArr[3] = { 0, 1, 2 };
+	pthread_t ThreadArr[3];
+
+	for (i = 0; i < 3; i++) pthread_create(&ThreadArr[i], NULL, MergeSVEvidenceByType, &TypeArr[i]);
+	for (i = 0; i < 3; i++) pthread_join(ThreadArr[i], NULL);
+	vector<SVEvidence_t>().swap(ThreadSVEvidenceVec);
+	InversionSiteEnd = InversionSiteVec.size() > 0 ? InversionSiteVec.back().gPos + 1 : 0;
+	TranslocationSiteEnd = TranslocationSiteVec.size() > 0 ? TranslocationSiteVec.back().gPos + 1 : 0;
+}
+
+static int GetCigarStrRefLen(const char* str)
+{
+	// reference length of a CIGAR string such as the MC tag
+	int n, len = 0;
+	char* p;
+
+	while (*str != '\0')
+	{
+		if ((n = (int)strtol(str, &p, 10)) <= 0 || *p == '\0') break;
+		if (*p == 'M' || *p == 'D' || *p == 'N' || *p == '=' || *p == 'X') len += n;
+		str = p + 1;
+	}
+	return len;
+}
 
-	for (gPos = tid; gPos < GenomeSize; gPos += iThreadNum)
+static bool ConvertAlnRecord(bam1_t *b, bool orientation, int64_t gPos, ReadItem_t& read, vector<char>& SeqBuf, AlnCan_t& AlnCan, int& HeadClip, int& TailClip)
+{
+	// the alignment as one gapped fragment pair laid out as the mapper's: the cigar runs in the forward genome orientation
+	// and read.seq is in read orientation (reverse complemented when orientation is false); HeadClip/TailClip are the
+	// clipped bases at the left/right end on the forward strand, hard clips read as N
+	int i, j, op, len, qPos = 0;
+	uint32_t *cigar = bam_get_cigar(b);
+	uint8_t *seq = bam_get_seq(b);
+	FragPair_t& fp = AlnCan.FragPairVec[0];
+
+	if (b->core.l_qseq == 0) return false;
+
+	HeadClip = TailClip = 0; fp.rLen = fp.gLen = 0; fp.cigar.clear(); SeqBuf.clear();
+	for (i = 0; i < (int)b->core.n_cigar; i++)
 	{
-		if ((cov = GetProfileColumnSize(MappingRecordArr[gPos])) > 0)
+		op = bam_cigar_op(cigar[i]); len = bam_cigar_oplen(cigar[i]);
+		switch (op)
 		{
-			myAlignedBase++;
-			myCoverageSum += cov;
-			//if (cov > 45) printf("%lld, %d\n", gPos, cov);
+		case BAM_CHARD_CLIP:
+		case BAM_CSOFT_CLIP:
+			if (op == BAM_CHARD_CLIP) SeqBuf.insert(SeqBuf.end(), len, 'N');
+			else for (j = 0; j < len; j++, qPos++) SeqBuf.push_back(seq_nt16_str[bam_seqi(seq, qPos)]);
+			if (fp.rLen == 0 && fp.gLen == 0) HeadClip += len; else TailClip += len;
+			break;
+		case BAM_CMATCH: case BAM_CEQUAL: case BAM_CDIFF:
+			for (j = 0; j < len; j++, qPos++) SeqBuf.push_back(seq_nt16_str[bam_seqi(seq, qPos)]);
+			PushCigarOp(fp.cigar, CIGAR_M, len); fp.rLen += len; fp.gLen += len;
+			break;
+		case BAM_CINS:
+			for (j = 0; j < len; j++, qPos++) SeqBuf.push_back(seq_nt16_str[bam_seqi(seq, qPos)]);
+			PushCigarOp(fp.cigar, CIGAR_I, len); fp.rLen += len;
+			break;
+		case BAM_CDEL: PushCigarOp(fp.cigar, CIGAR_D, len); fp.gLen += len; break;
+		case BAM_CPAD: break;
+		default: return false; // reference skips are not modelled
 		}
 	}
-	pthread_mutex_lock(&ProfileLock);
-	iAlignedBase += myAlignedBase;
-	iTotalCoverage += myCoverageSum;
-	pthread_mutex_unlock(&ProfileLock);
+	if (fp.rLen == 0 || fp.gLen == 0 || qPos != b->core.l_qseq || gPos + fp.gLen > GenomeSize) return false;
 
-	return (void*)(1);
+	read.rlen = (int)SeqBuf.size(); SeqBuf.push_back('\0'); read.seq = SeqBuf.data();
+	fp.bSimple = false; AlnCan.orientation = orientation;
+	if (orientation) fp.rPos = HeadClip, fp.gPos = gPos;
+	else
+	{
+		SelfComplementarySeq(read.rlen, read.seq);
+		fp.rPos = TailClip; fp.gPos = TwoGenomeSize - (gPos + fp.gLen);
+	}
+	fp.PosDiff = fp.gPos - fp.rPos;
+
+	return true;
 }
 
-pair<int64_t, int64_t> ReportDuplicationRate()
+static void *ProfileAlignmentRecords(void *arg)
 {
-	int64_t gPos, n, total_count;
+	// -aln input: each record becomes the profile, breakpoint and read pair evidence of a mapped read
+	int tid = *((int*)arg);
+	int i, RecNum, ChrIdx, MateChrIdx, HeadClip, TailClip;
+	int64_t gPos, MatePos, ReadNum, MappedNum, PairedNum, myTotalDistance, myReadLengthSum, myOffTargetNum = 0;
+	bool bFirstRead, bUnique;
+	uint16_t flag;
+	uint8_t *tag;
+	bam1_t *b, **RecArr = new bam1_t*[AlnChunkSize];
+	ReadItem_t read;
+	vector<char> SeqBuf;
+	vector<AlnCan_t> AlnCanVec(1);
+	ProfileBuffer_t ProfileBuffer;
+	DiscordPair_t DiscordPair;
+	CoordinatePair_t CoorPair;
+	vector<DiscordPair_t> INVSiteVec, TNLSiteVec;
 
-	n = total_count = 0;
+	for (i = 0; i < AlnChunkSize; i++) RecArr[i] = bam_init1();
+	ProfileBuffer.LockWaitTime = 0; ProfileBuffer.LockNum = ProfileBuffer.ContendedNum = 0;
+	AlnCanVec[0].score = 1; AlnCanVec[0].SamFlag = 0; AlnCanVec[0].PairedAlnCanIdx = -1; AlnCanVec[0].FragPairVec.resize(1);
+	read.header = read.qual = NULL;
 
-	for (gPos = 0; gPos < GenomeSize; gPos++)
+	while (true)
 	{
-		if (MappingRecordArr[gPos].readCount > 0)
+		pthread_mutex_lock(&LibraryLock);
+		for (RecNum = 0; RecNum < AlnChunkSize && sam_read1(aln_in, aln_header, RecArr[RecNum]) >= 0;)
 		{
-			n++;
-			total_count += MappingRecordArr[gPos].readCount;
+			if (RecArr[RecNum]->core.flag & BAM_FPAIRED) bPairEnd = true;
+			RecNum++;
+		}
+		fprintf(stderr, "\r%lld %s reads have been processed in %lld seconds...", (long long)iTotalReadNum, (bPairEnd ? "paired-end" : "singled-end"), (long long)(time(NULL) - StartProcessTime));
+		pthread_mutex_unlock(&LibraryLock);
+
+		if (RecNum == 0) break;
+
+		ReadNum = MappedNum = PairedNum = myTotalDistance = myReadLengthSum = 0;
+		for (i = 0; i < RecNum; i++)
+		{
+			b = RecArr[i]; flag = b->core.flag;
+			if (flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP)) continue;
+			if ((flag & BAM_FSUPPLEMENTARY) == 0) ReadNum++;
+			if ((flag & BAM_FUNMAP) || b->core.tid < 0 || (ChrIdx = AlnChrIdxVec[b->core.tid]) < 0) continue;
+
+			// the mapper reverse complements the second read of a pair before aligning it
+			bFirstRead = (flag & BAM_FREAD2) == 0; gPos = ChromosomeVec[ChrIdx].FowardLocation + b->core.pos;
+			if (!ConvertAlnRecord(b, bFirstRead != bam_is_rev(b), gPos, read, SeqBuf, AlnCanVec[0], HeadClip, TailClip)) continue;
+			if ((flag & BAM_FSUPPLEMENTARY) == 0) MappedNum++;
+			bUnique = (int)b->core.qual >= MinUniqueMapQ;
+
+			// read pair evidence is taken once, from the first read; the mate's span comes from its MC tag when present
+			if (bUnique && (flag & BAM_FPAIRED) && (flag & BAM_FREAD1) && (flag & (BAM_FMUNMAP | BAM_FSUPPLEMENTARY)) == 0 && b->core.mtid >= 0 && (MateChrIdx = AlnChrIdxVec[b->core.mtid]) >= 0
+				&& ((tag = bam_aux_get(b, "MQ")) == NULL || (int)bam_aux2i(tag) >= MinUniqueMapQ))
+			{
+				MatePos = ChromosomeVec[MateChrIdx].FowardLocation + b->core.mpos;
+				CoorPair.gPos1 = AlnCanVec[0].FragPairVec[0].gPos;
+				CoorPair.gPos2 = (flag & BAM_FMREVERSE) ? MatePos : TwoGenomeSize - (MatePos + ((tag = bam_aux_get(b, "MC")) != NULL ? GetCigarStrRefLen(bam_aux2Z(tag)) : AlnCanVec[0].FragPairVec[0].gLen));
+				if ((CoorPair.dist = abs(CoorPair.gPos2 - CoorPair.gPos1)) != 0 && CollectPairEvidence(CoorPair, DiscordPair, INVSiteVec, TNLSiteVec))
+				{
+					myReadLengthSum += read.rlen << 1;
+					PairedNum++; myTotalDistance += CoorPair.dist;
+				}
+			}
+			if (PaddedRegionVec.size() > 0 && !CheckAlnCanOnTarget(AlnCanVec))
+			{
+				myOffTargetNum++;
+				continue;
+			}
+			if (!bUnique)
+			{
+				UpdateMultiHitCount(&read, AlnCanVec, ProfileBuffer);
+				continue;
+			}
+			// clipped ends are breakpoints placed as UpdateProfile() places them (one base to the left on the reverse strand);
+			// reads clipped by more than MaxClipSize are not profiled
+			if (HeadClip > MinBreakPointSize) ProfileBuffer.BreakPointVec.push_back(AlnCanVec[0].orientation ? gPos : gPos - 1);
+			if (TailClip > MinBreakPointSize) ProfileBuffer.BreakPointVec.push_back(gPos + AlnCanVec[0].FragPairVec[0].gLen - (AlnCanVec[0].orientation ? 0 : 1));
+			if (HeadClip <= MaxClipSize && TailClip <= MaxClipSize) UpdateProfile(bFirstRead, &read, AlnCanVec, ProfileBuffer);
 		}
+		pthread_mutex_lock(&OutputLock);
+		iTotalReadNum += ReadNum; iTotalMappingNum += MappedNum; iTotalPairedNum += PairedNum; TotalPairedDistance += myTotalDistance, ReadLengthSum += myReadLengthSum;
+		if (iTotalPairedNum > 1000) avgDist = (int)(1.*TotalPairedDistance / iTotalPairedNum + .5);
+		pthread_mutex_unlock(&OutputLock);
 	}
-	total_count -= n;
+	for (i = 0; i < AlnChunkSize; i++) bam_destroy1(RecArr[i]);
+	delete[] RecArr;
 
-	return make_pair(total_count, n);
+	SaveThreadProfile(tid, ProfileBuffer, INVSiteVec, TNLSiteVec, myOffTargetNum);
+
+	return (void*)(1);
+}
+
+static bool OpenAlignmentFile()
+{
+	// sequences of the -aln header are matched to the reference by name and length
+	int i, UnknownNum = 0;
+	map<string, int>::iterator iter;
+
+	if ((aln_in = sam_open(AlnFileName, "r")) == NULL || (aln_header = sam_hdr_read(aln_in)) == NULL)
+	{
+		fprintf(stderr, "Error! Cannot read the alignments in [%s]\n", AlnFileName);
+		if (aln_in != NULL) sam_close(aln_in);
+		return false;
+	}
+	if (iThreadNum > 1) hts_set_threads(aln_in, iThreadNum);
+
+	AlnChrIdxVec.assign(aln_header->n_targets, -1);
+	for (i = 0; i < aln_header->n_targets; i++)
+	{
+		if ((iter = ChrIdMap.find(aln_header->target_name[i])) != ChrIdMap.end() && ChromosomeVec[iter->second].len == (int)aln_header->target_len[i]) AlnChrIdxVec[i] = iter->second;
+		else UnknownNum++;
+	}
+	if (UnknownNum > 0) fprintf(stderr, "\tWarning! %d of the %d sequences in [%s] do not match the reference and their alignments are ignored\n", UnknownNum, aln_header->n_targets, AlnFileName);
+
+	return true;
 }
 
 void Mapping()
@@ -694,6 +929,8 @@ void Mapping()
 
 	//iThreadNum = 1;
 	ThrIdArr = new int[iThreadNum];  for (i = 0; i < iThreadNum; i++) ThrIdArr[i] = i;
+	ThreadProfileStatVec.resize(iThreadNum); ThreadSVEvidenceVec.resize(iThreadNum);
+	for (i = 0; i < iThreadNum; i++) ThreadProfileStatVec[i].LockWaitTime = 0, ThreadProfileStatVec[i].LockNum = ThreadProfileStatVec[i].ContendedNum = 0;
 
 	if (bSAMoutput && SamFileName != NULL)
 	{
@@ -702,7 +939,16 @@ void Mapping()
 	}
 	if (bSAMoutput) OutputSamHeaders();
 
-	for (int LibraryID = 0; LibraryID < (int)ReadFileNameVec1.size(); LibraryID++)
+	if (AlnFileName != NULL)
+	{
+		if (OpenAlignmentFile())
+		{
+			for (i = 0; i < iThreadNum; i++) pthread_create(&ThreadArr[i], NULL, ProfileAlignmentRecords, &ThrIdArr[i]);
+			for (i = 0; i < iThreadNum; i++) pthread_join(ThreadArr[i], NULL);
+			bam_hdr_destroy(aln_header); sam_close(aln_in);
+		}
+	}
+	else for (int LibraryID = 0; LibraryID < (int)ReadFileNameVec1.size(); LibraryID++)
 	{
 		gzReadFileHandler1 = gzReadFileHandler2 = NULL; ReadFileHandler1 = ReadFileHandler2 = NULL;
 
@@ -759,6 +1005,32 @@ void Mapping()
 		fprintf(log, "%12lld (%6.2f%%) reads are mapped in pairs.\n", (long long)(iTotalPairedNum << 1), (int)(10000 * (1.0*(iTotalPairedNum << 1) / iTotalReadNum) + 0.00005) / 100.0);
 		fprintf(stderr, "%12lld (%6.2f%%) reads are mapped in pairs.\n", (long long)(iTotalPairedNum << 1), (int)(10000 * (1.0*(iTotalPairedNum << 1) / iTotalReadNum) + 0.00005) / 100.0);
 	}
+	if (iTotalReadNum > 0 && PaddedRegionVec.size() > 0)
+	{
+		fprintf(log, "%12lld (%6.2f%%) mapped reads are off-target and not profiled.\n", (long long)OffTargetReadNum, (int)(10000 * (1.0*OffTargetReadNum / iTotalReadNum) + 0.00005) / 100.0);
+		fprintf(stderr, "%12lld (%6.2f%%) mapped reads are off-target and not profiled.\n", (long long)OffTargetReadNum, (int)(10000 * (1.0*OffTargetReadNum / iTotalReadNum) + 0.00005) / 100.0);
+	}
+	if (GapAlnLookupNum > 0)
+	{
+		fprintf(log, "\tGap alignment cache: %lld / %lld hits (%.2f%%), %lld evictions\n", (long long)GapAlnHitNum, (long long)GapAlnLookupNum, 100.0*GapAlnHitNum / GapAlnLookupNum, (long long)GapAlnEvictionNum);
+		fprintf(stderr, "\tGap alignment cache: %lld / %lld hits (%.2f%%), %lld evictions\n", (long long)GapAlnHitNum, (long long)GapAlnLookupNum, 100.0*GapAlnHitNum / GapAlnLookupNum, (long long)GapAlnEvictionNum);
+	}
+	if (bVCFoutput)
+	{
+		double TotalWaitTime = 0, MaxWaitTime = 0;
+		int64_t LockNum = 0, ContendedNum = 0;
+
+		fprintf(log, "\tProfile lock wait per thread (sec):");
+		for (i = 0; i < iThreadNum; i++)
+		{
+			fprintf(log, " %.3f", ThreadProfileStatVec[i].LockWaitTime);
+			TotalWaitTime += ThreadProfileStatVec[i].LockWaitTime; if (ThreadProfileStatVec[i].LockWaitTime > MaxWaitTime) MaxWaitTime = ThreadProfileStatVec[i].LockWaitTime;
+			LockNum += ThreadProfileStatVec[i].LockNum; ContendedNum += ThreadProfileStatVec[i].ContendedNum;
+		}
+		fprintf(log, "\n");
+		fprintf(log, "\tProfile lock wait: total %.3f sec, max %.3f sec per thread, %lld / %lld acquisitions contended\n", TotalWaitTime, MaxWaitTime, (long long)ContendedNum, (long long)LockNum);
+		fprintf(stderr, "\tProfile lock wait: total %.3f sec, max %.3f sec per thread, %lld / %lld acquisitions contended\n", TotalWaitTime, MaxWaitTime, (long long)ContendedNum, (long long)LockNum);
+	}
 	if (bSAMoutput)
 	{
 		if (bSAMFormat) fclose(sam_out);
@@ -766,18 +1038,17 @@ void Mapping()
 	}
 	if (bVCFoutput)
 	{
-		for (i = 0; i < iThreadNum; i++) pthread_create(&ThreadArr[i], NULL, CheckMappingCoverage, &ThrIdArr[i]);
-		for (i = 0; i < iThreadNum; i++) pthread_join(ThreadArr[i], NULL);
+		MaterializeRangeCounters(); BuildIndEventView(); MergeSVEvidence(); ReportProfileMemory();
+		ProfileSummary_t summary = SummarizeProfile(ProfileSize);
+		iAlignedBase = summary.AlignedBase; iTotalCoverage = summary.TotalCoverage;
 
 		avgCov = (int)(1.0*iTotalCoverage / iAlignedBase + .5); if (avgCov < 0) avgCov = 0;
 		fprintf(log, "\tEstimated AvgCoverage = %d\n", avgCov);
 		fprintf(stderr, "\tEstimated AvgCoverage = %d\n", avgCov);
-	}
-	if (bVCFoutput)
-	{
-		pair<int64_t, int64_t> stat = ReportDuplicationRate();
-		fprintf(log, "\tDuplication rate=%4.2f%%\n", 100 * (1.0*stat.first / stat.second));
-		fprintf(stderr, "\tDuplication rate=%4.2f%%\n", 100 * (1.0*stat.first / stat.second));
+
+		int64_t DupNum = summary.ReadStartNum - summary.ReadStartPos;
+		fprintf(log, "\tDuplication rate=%4.2f%%\n", 100 * (1.0*DupNum / summary.ReadStartPos));
+		fprintf(stderr, "\tDuplication rate=%4.2f%%\n", 100 * (1.0*DupNum / summary.ReadStartPos));
 	}
 	if (iTotalReadNum > 0 && iTotalPairedNum > 0)
 	{
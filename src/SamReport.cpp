@@ -23,6 +23,13 @@ void SetSingledAlignmentFlag(ReadItem_t& read)
 	else read.AlnCanVec[i].SamFlag = 0x4;
 }
 
+static int GetMateSamFlag(ReadItem_t& mate, bool bSecondRead)
+{
+	// mate flags of a read that is not in a proper pair; the second read is aligned reverse complemented
+	if (mate.AlnSummary.score == 0) return 0x8; // next segment unmapped
+	return mate.AlnCanVec[mate.AlnSummary.BestAlnCanIdx].orientation == bSecondRead ? 0x20 : 0;
+}
+
 void SetPairedAlignmentFlag(ReadItem_t& read1, ReadItem_t& read2)
 {
 	int i, j;
@@ -32,14 +39,9 @@ void SetPairedAlignmentFlag(ReadItem_t& read1, ReadItem_t& read2)
 	{
 		i = read1.AlnSummary.BestAlnCanIdx;
 		read1.AlnCanVec[i].SamFlag = 0x41;  // first read
-		read1.AlnCanVec[i].SamFlag |= (read1.AlnCanVec[i].orientation ? 0x20 : 0x10);
 
-		if ((j = read1.AlnCanVec[i].PairedAlnCanIdx) != -1 && read2.AlnCanVec[j].score > 0) read1.AlnCanVec[i].SamFlag |= 0x2;// reads are mapped in a proper pair
-		else
-		{
-			read1.AlnCanVec[i].SamFlag |= (read1.AlnCanVec[i].orientation ? 0x10 : 0x20);
-			read1.AlnCanVec[i].SamFlag |= 0x8; // next segment unmapped
-		}
+		if ((j = read1.AlnCanVec[i].PairedAlnCanIdx) != -1 && read2.AlnCanVec[j].score > 0) read1.AlnCanVec[i].SamFlag |= (read1.AlnCanVec[i].orientation ? 0x20 : 0x10) | 0x2;// reads are mapped in a proper pair
+		else read1.AlnCanVec[i].SamFlag |= (read1.AlnCanVec[i].orientation ? 0 : 0x10) | GetMateSamFlag(read2, true);
 
 	}
 	else if (read1.AlnSummary.score > 0)
@@ -49,9 +51,8 @@ void SetPairedAlignmentFlag(ReadItem_t& read1, ReadItem_t& read2)
 			if (read1.AlnCanVec[i].score > 0)
 			{
 				read1.AlnCanVec[i].SamFlag = 0x41; // read1 is the first read in a pair
-				read1.AlnCanVec[i].SamFlag |= (read1.AlnCanVec[i].orientation ? 0x20 : 0x10);
-				if ((j = read1.AlnCanVec[i].PairedAlnCanIdx) != -1 && read2.AlnCanVec[j].score > 0) read1.AlnCanVec[i].SamFlag |= 0x2;// reads are mapped in a proper pair
-				else read1.AlnCanVec[i].SamFlag |= 0x8; // next segment unmapped
+				if ((j = read1.AlnCanVec[i].PairedAlnCanIdx) != -1 && read2.AlnCanVec[j].score > 0) read1.AlnCanVec[i].SamFlag |= (read1.AlnCanVec[i].orientation ? 0x20 : 0x10) | 0x2;// reads are mapped in a proper pair
+				else read1.AlnCanVec[i].SamFlag |= (read1.AlnCanVec[i].orientation ? 0 : 0x10) | GetMateSamFlag(read2, true);
 			}
 		}
 	}
@@ -60,13 +61,8 @@ void SetPairedAlignmentFlag(ReadItem_t& read1, ReadItem_t& read2)
 	{
 		j = read2.AlnSummary.BestAlnCanIdx;
 		read2.AlnCanVec[j].SamFlag = 0x81; // read2 is the second read in a pair
-		read2.AlnCanVec[j].SamFlag |= (read2.AlnCanVec[j].orientation ? 0x10 : 0x20);
-		if ((i = read2.AlnCanVec[j].PairedAlnCanIdx) != -1 && read1.AlnCanVec[i].score > 0) read2.AlnCanVec[j].SamFlag |= 0x2;// reads are mapped in a proper pair
-		else
-		{
-			read2.AlnCanVec[j].SamFlag |= (read2.AlnCanVec[j].orientation ? 0x20 : 0x10);
-			read2.AlnCanVec[j].SamFlag |= 0x8; // next segment unmapped
-		}
+		if ((i = read2.AlnCanVec[j].PairedAlnCanIdx) != -1 && read1.AlnCanVec[i].score > 0) read2.AlnCanVec[j].SamFlag |= (read2.AlnCanVec[j].orientation ? 0x10 : 0x20) | 0x2;// reads are mapped in a proper pair
+		else read2.AlnCanVec[j].SamFlag |= (read2.AlnCanVec[j].orientation ? 0x10 : 0) | GetMateSamFlag(read1, false);
 	}
 	else if (read2.AlnSummary.score > 0)
 	{
@@ -75,9 +71,8 @@ void SetPairedAlignmentFlag(ReadItem_t& read1, ReadItem_t& read2)
 			if (read2.AlnCanVec[j].score > 0)
 			{
 				read2.AlnCanVec[j].SamFlag = 0x81; // read2 is the second read in a pair
-				read2.AlnCanVec[j].SamFlag |= (read2.AlnCanVec[j].orientation ? 0x10 : 0x20);
-				if ((i = read2.AlnCanVec[j].PairedAlnCanIdx) != -1 && read1.AlnCanVec[i].score > 0) read2.AlnCanVec[j].SamFlag |= 0x2;// reads are mapped in a proper pair
-				else read2.AlnCanVec[j].SamFlag |= 0x8; // next segment unmapped
+				if ((i = read2.AlnCanVec[j].PairedAlnCanIdx) != -1 && read1.AlnCanVec[i].score > 0) read2.AlnCanVec[j].SamFlag |= (read2.AlnCanVec[j].orientation ? 0x10 : 0x20) | 0x2;// reads are mapped in a proper pair
+				else read2.AlnCanVec[j].SamFlag |= (read2.AlnCanVec[j].orientation ? 0x10 : 0) | GetMateSamFlag(read1, false);
 			}
 		}
 	}
@@ -120,7 +115,7 @@ string ReverseCIGAR(string CIGAR)
 
 Coordinate_t GetAlnCoordinate(bool orientation, vector<FragPair_t>& FragPairVec)
 {
-	Coordinate_t coor;
+	Coordinate_t coor = { 0, 0 };
 	vector<FragPair_t>::iterator iter;
 
 	if (orientation)
@@ -172,8 +167,8 @@ int CalCoveredBase(string CIGAR)
 string GenerateCIGARstring(int rlen, bool orientation, vector<FragPair_t>& FragPairVec)
 {
 	string CIGAR;
-	int i, j, len, num, c;
-	char state = ' ', buf[10];
+	int i, num, c;
+	char op, state = ' ', buf[10];
 
 	if (!FragPairVec[0].bSimple)
 	{
@@ -209,50 +204,26 @@ string GenerateCIGARstring(int rlen, bool orientation, vector<FragPair_t>& FragP
 			}
 			c += FragPairVec[i].rLen;
 		}
-		else if (FragPairVec[i].aln1.length() > 0)
+		else if (FragPairVec[i].cigar.size() > 0)
 		{
-			len = (int)FragPairVec[i].aln1.length();
-			for (j = 0; j < len; j++)
+			for (vector<uint32_t>::iterator CigarIter = FragPairVec[i].cigar.begin(); CigarIter != FragPairVec[i].cigar.end(); CigarIter++)
 			{
-				if (FragPairVec[i].aln1[j] == '-')
-				{
-					if (state != 'D')
-					{
-						if (c > 0)
-						{
-							sprintf(buf, "%d%c", c, state);
-							CIGAR += buf;
-						}
-						state = 'D'; c = 0;
-					}
-					c++;
-				}
-				else if (FragPairVec[i].aln2[j] == '-')
+				switch (*CigarIter & 0xf)
 				{
-					if (state != 'I')
-					{
-						if (c > 0)
-						{
-							sprintf(buf, "%d%c", c, state);
-							CIGAR += buf;
-						}
-						state = 'I'; c = 0;
-					}
-					c++;
+				case CIGAR_D: op = 'D'; break;
+				case CIGAR_I: op = 'I'; break;
+				default: op = 'M'; // =/X
 				}
-				else
+				if (state != op)
 				{
-					if (state != 'M')
+					if (c > 0)
 					{
-						if (c > 0)
-						{
-							sprintf(buf, "%d%c", c, state); 
-							CIGAR += buf;
-						}
-						state = 'M'; c = 0;
+						sprintf(buf, "%d%c", c, state);
+						CIGAR += buf;
 					}
-					c++;
+					state = op; c = 0;
 				}
+				c += *CigarIter >> 4;
 			}
 		}
 		else if (FragPairVec[i].rLen > 0) // insertion
@@ -317,8 +288,7 @@ string GenerateCIGARstring(int rlen, bool orientation, vector<FragPair_t>& FragP
 
 void GetReverseQualityStr(int len, char* qual, char* rqual)
 {
-	int i, j;
-	for (i = 0, j = len - 1; j != 0; i++, j--) rqual[j] = qual[i];
+	SeqReverseCopy(len, qual, rqual);
 }
 
 void GenerateSingleSamStream(ReadItem_t& read, vector<string>& SamStreamVec)
@@ -374,6 +344,16 @@ void GenerateSingleSamStream(ReadItem_t& read, vector<string>& SamStreamVec)
 	free(buffer);
 }
 
+static string GetMateSamField(int ChrIdx, ReadItem_t& mate)
+{
+	// RNEXT and PNEXT of a read that is not in a proper pair: the mate's best alignment
+	Coordinate_t coor;
+
+	if (mate.AlnSummary.score == 0) return "*\t0";
+	coor = GetAlnCoordinate(mate.AlnCanVec[mate.AlnSummary.BestAlnCanIdx].orientation, mate.AlnCanVec[mate.AlnSummary.BestAlnCanIdx].FragPairVec);
+	return (coor.ChromosomeIdx == ChrIdx ? string("=") : ChromosomeVec[coor.ChromosomeIdx].name) + "\t" + to_string((long long)coor.gPos);
+}
+
 void GeneratePairedSamStream(ReadItem_t& read1, ReadItem_t& read2, vector<string>& SamStreamVec)
 {
 	string CIGAR, rqual;
@@ -393,11 +373,7 @@ void GeneratePairedSamStream(ReadItem_t& read1, ReadItem_t& read2, vector<string
 		SamFlag |= 0x4; // segment unmapped
 		SamFlag |= 0x40; // second fragment
 		if (read2.AlnSummary.score == 0) SamFlag |= 0x8; // next segment unmapped
-		else if (read2.AlnCanVec.size() > 0)
-		{
-			SamFlag |= (read2.AlnCanVec[read2.AlnSummary.BestAlnCanIdx].orientation ? 0x10 : 0x20);
-			SamFlag |= (read2.AlnCanVec[read2.AlnSummary.BestAlnCanIdx].orientation ? 0x20 : 0x10);
-		}
+		else if (read2.AlnCanVec.size() > 0) SamFlag |= GetMateSamFlag(read2, true);
 		len = sprintf(buffer, "%s\t%d\t*\t0\t0\t*\t*\t0\t0\t%s\t%s\tAS:i:0\tXS:i:0", read1.header, SamFlag, read1.seq, (FastQFormat ? read1.qual: "*"));
 		SamStreamVec.push_back(buffer);
 	}
@@ -425,7 +401,7 @@ void GeneratePairedSamStream(ReadItem_t& read1, ReadItem_t& read2, vector<string
 					dist = (int)(coor2.gPos - coor1.gPos + (read1.AlnCanVec[i].orientation ? read2.rlen : 0 - read1.rlen));
 					len = sprintf(buffer, "%s\t%d\t%s\t%lld\t%d\t%s\t=\t%lld\t%d\t%s\t%s\tNM:i:%d\tAS:i:%d\tXS:i:%d", read1.header, read1.AlnCanVec[i].SamFlag, ChromosomeVec[coor1.ChromosomeIdx].name, (long long)coor1.gPos, mapq, CIGAR.c_str(), (long long)coor2.gPos, dist, (read1.AlnCanVec[i].orientation ? seq : rseq), (FastQFormat ? (read1.AlnCanVec[i].orientation ? read1.qual : rqual.c_str()) : "*"), read1.rlen - read1.AlnCanVec[i].score, read1.AlnSummary.score, read1.AlnSummary.sub_score);
 				}
-				else len = sprintf(buffer, "%s\t%d\t%s\t%lld\t%d\t%s\t*\t0\t0\t%s\t%s\tNM:i:%d\tAS:i:%d\tXS:i:%d", read1.header, read1.AlnCanVec[i].SamFlag, ChromosomeVec[coor1.ChromosomeIdx].name, (long long)coor1.gPos, mapq, CIGAR.c_str(), (read1.AlnCanVec[i].orientation ? seq : rseq), (FastQFormat ? (read1.AlnCanVec[i].orientation ? read1.qual : rqual.c_str()) : "*"), read1.rlen - read1.AlnCanVec[i].score, read1.AlnSummary.score, read1.AlnSummary.sub_score);
+				else len = sprintf(buffer, "%s\t%d\t%s\t%lld\t%d\t%s\t%s\t0\t%s\t%s\tNM:i:%d\tAS:i:%d\tXS:i:%d", read1.header, read1.AlnCanVec[i].SamFlag, ChromosomeVec[coor1.ChromosomeIdx].name, (long long)coor1.gPos, mapq, CIGAR.c_str(), GetMateSamField(coor1.ChromosomeIdx, read2).c_str(), (read1.AlnCanVec[i].orientation ? seq : rseq), (FastQFormat ? (read1.AlnCanVec[i].orientation ? read1.qual : rqual.c_str()) : "*"), read1.rlen - read1.AlnCanVec[i].score, read1.AlnSummary.score, read1.AlnSummary.sub_score);
 				SamStreamVec.push_back(buffer);
 				if (bUnique) break;
 			}
@@ -442,11 +418,7 @@ void GeneratePairedSamStream(ReadItem_t& read1, ReadItem_t& read2, vector<string
 		SamFlag |= 0x4; // segment unmapped
 		SamFlag |= 0x80; // second fragment
 		if(read1.AlnSummary.score == 0) SamFlag |= 0x8; // next segment unmapped
-		else if (read1.AlnCanVec.size() > 0)
-		{
-			SamFlag |= (read1.AlnCanVec[read1.AlnSummary.BestAlnCanIdx].orientation ? 0x10 : 0x20);
-			SamFlag |= (read1.AlnCanVec[read1.AlnSummary.BestAlnCanIdx].orientation ? 0x20 : 0x10);
-		}
+		else if (read1.AlnCanVec.size() > 0) SamFlag |= GetMateSamFlag(read1, false);
 		len = sprintf(buffer, "%s\t%d\t*\t0\t0\t*\t*\t0\t0\t%s\t%s\tAS:i:0\tXS:i:0", read2.header, SamFlag, read2.seq, (FastQFormat ? read2.qual : "*"));
 		SamStreamVec.push_back(buffer);
 	}
@@ -473,7 +445,7 @@ void GeneratePairedSamStream(ReadItem_t& read1, ReadItem_t& read2, vector<string
 					dist = 0 - (int)(coor2.gPos - coor1.gPos + (read1.AlnCanVec[i].orientation ? read2.rlen : 0 - read1.rlen));
 					len = sprintf(buffer, "%s\t%d\t%s\t%lld\t%d\t%s\t=\t%lld\t%d\t%s\t%s\tNM:i:%d\tAS:i:%d\tXS:i:%d", read2.header, read2.AlnCanVec[j].SamFlag, ChromosomeVec[coor2.ChromosomeIdx].name, (long long)coor2.gPos, mapq, CIGAR.c_str(), (long long)coor1.gPos, dist, (read2.AlnCanVec[j].orientation ? seq : rseq), (FastQFormat ? (read2.AlnCanVec[j].orientation ? read2.qual : rqual.c_str()) : "*"), read2.rlen - read2.AlnCanVec[j].score, read2.AlnSummary.score, read2.AlnSummary.sub_score);
 				}
-				else len = sprintf(buffer, "%s\t%d\t%s\t%lld\t%d\t%s\t*\t0\t0\t%s\t%s\tNM:i:%d\tAS:i:%d\tXS:i:%d", read2.header, read2.AlnCanVec[j].SamFlag, ChromosomeVec[coor2.ChromosomeIdx].name, (long long)coor2.gPos, mapq, CIGAR.c_str(), (read2.AlnCanVec[j].orientation ? seq : rseq), (FastQFormat ? (read2.AlnCanVec[j].orientation ? read2.qual : rqual.c_str()) : "*"), read2.rlen - read2.AlnCanVec[j].score, read2.AlnSummary.score, read2.AlnSummary.sub_score);
+				else len = sprintf(buffer, "%s\t%d\t%s\t%lld\t%d\t%s\t%s\t0\t%s\t%s\tNM:i:%d\tAS:i:%d\tXS:i:%d", read2.header, read2.AlnCanVec[j].SamFlag, ChromosomeVec[coor2.ChromosomeIdx].name, (long long)coor2.gPos, mapq, CIGAR.c_str(), GetMateSamField(coor2.ChromosomeIdx, read1).c_str(), (read2.AlnCanVec[j].orientation ? seq : rseq), (FastQFormat ? (read2.AlnCanVec[j].orientation ? read2.qual : rqual.c_str()) : "*"), read2.rlen - read2.AlnCanVec[j].score, read2.AlnSummary.score, read2.AlnSummary.sub_score);
 				SamStreamVec.push_back(buffer);
 				if (bUnique) break;
 			}
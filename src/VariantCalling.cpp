@@ -1,10 +1,16 @@
 #include "structure.h"
+#include "htslib/htslib/bgzf.h"
+#include "htslib/htslib/tbx.h"
+#include "htslib/htslib/kstring.h"
+#include "htslib/htslib/vcf.h"
 
 #define MaxQscore 30
-#define BlockSize 100
+#define ScanChunkBlocks 640
 #define BreakPointFreqThr 3
 #define INV_TNL_ThrRatio 0.5
 #define Genotype_Ratio	0.50
+#define VcfBatchSize 65536
+#define FilterContextSize 100 // the farthest neighbor a variant filter looks at (CheckBadHaplotype)
 #define var_SUB 0 // substitution
 #define var_INS 1 // insertion
 #define var_DEL 2 // deletion
@@ -25,13 +31,77 @@ typedef struct
 	uint16_t rigt_score;
 } BreakPoint_t;
 
-FILE *outFile;
+// the depth blocks are indexed by profile position / BlockSize (GetBlockDepth); the arrays start at block DepthBlockBase, and
+// the calling stage keeps the blocks from KeptDepthBlock on as it summarizes a checkpoint block by block
 int* BlockDepthArr;
+static int64_t* CovPrefixArr; // CovPrefixArr[k]: total column depth of profile [0, (DepthBlockBase + k)*BlockSize)
+static int64_t DepthBlockBase, DepthBlockCap, KeptDepthBlock, ScanBlockBeg;
 vector<int> VarNumVec(256);
-int BlockNum, iTotalVarNum;
+int BlockNum, iTotalVarNum; // BlockNum: the depth blocks summarized so far
 vector<Variant_t> VariantVec;
 vector<BreakPoint_t> BreakPointCanVec;
-extern map<int64_t, uint16_t> BreakPointMap;
+static pair<int64_t, uint32_t> BreakPointPeak; // the open breakpoint cluster: its peak and total frequency
+static uint32_t BreakPointFreq;
+static int64_t LoadedEnd; // the genome end of the loaded profile and evidence
+static ProfileSummary_t* ThreadSummaryArr;
+
+// gVCF reference block: DP is the depth of its first column, MinDP the minimum depth
+typedef struct
+{
+	int64_t gPos;
+	uint32_t DP, MinDP;
+} GVCFBlock_t;
+
+static vector<GVCFBlock_t> GVCFBlockVec;
+
+// the variant scan is split into chunks that are handed out to the threads and stitched in genome order
+typedef struct
+{
+	int64_t beg, end;
+	vector<Variant_t> VarVec;
+	vector<GVCFBlock_t> BlockVec;
+	bool bLeadingNOR, bTrailingNOR;
+} VarScanChunk_t;
+
+static int NextVarScanChunk;
+static vector<VarScanChunk_t> VarScanChunkVec;
+// the stitching state carries over from one calling slice to the next
+static bool bOpenNOR;
+static int64_t StitchedEnd;
+
+// VCF records are formatted (and bgzf-compressed for .vcf.gz output) in batches by the threads
+typedef struct
+{
+	int tid, beg, end; // index interval of the record
+	int64_t TextEnd; // end of the record in the batch text
+} VcfRecordSpan_t;
+
+typedef struct
+{
+	int beg, end; // VariantVec[beg, end)
+	int BlockBeg, BlockEnd; // GVCFBlockVec[BlockBeg, BlockEnd)
+	kstring_t text, bgzf;
+	vector<int64_t> BlockOffsetVec;
+	vector<VcfRecordSpan_t> SpanVec;
+	vector<bcf1_t*> BcfRecVec; // reused records of -bcf output
+	int BcfRecNum;
+	int VarNum[var_TNL + 1];
+	bool bOK;
+} VcfBatch_t;
+
+static bool bVcfBgzf;
+static bcf_hdr_t *BcfHdr;
+
+// header dictionary ids of the tags in the BCF records
+typedef struct
+{
+	int RC, NTFREQ, TYPE, END, DP, MIN_DP;
+	int GT, GQ, AD, AF, F1R2, F2R1;
+	int BreakPoint, DUP, Gaps, REF;
+} BcfTagID_t;
+
+static BcfTagID_t BcfTag;
+static const uint8_t BgzfEOFBlock[28] = { 0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43, 0x02, 0, 0x1b, 0, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 
 extern float FrequencyThr;
 extern uint32_t avgReadLength;
@@ -54,43 +124,40 @@ bool CompByVarPos(const Variant_t& p1, const Variant_t& p2)
 	else return p1.gPos < p2.gPos;
 }
 
-int GetPointIndFreq(map<string, uint16_t>& IndMap)
+static bool CompByIndEventPos(const IndEvent_t& ind, int64_t gPos)
 {
-	int n = 0;
-	for (map<string, uint16_t>::iterator iter = IndMap.begin(); iter != IndMap.end(); iter++) n += iter->second;
-	return n;
+	return ind.gPos < gPos;
 }
 
-int GetAreaIndFrequency(int64_t gPos, map<int64_t, map<string, uint16_t> >& IndMap, string& ind_str)
+static bool CompByVariantPos(const Variant_t& var, int64_t gPos)
+{
+	return var.gPos < gPos;
+}
+
+int GetAreaIndFrequency(int64_t gPos, vector<IndEvent_t>& IndVec, bool bDeletion, string& ind_str)
 {
 	int64_t max_pos = 0;
 	int freq = 0, max_freq = 0;
-	map<string, uint16_t>::iterator it;
-	map<int64_t, map<string, uint16_t> >::iterator iter1, iter2;
-	
+	uint32_t max_len = 0;
+	vector<IndEvent_t>::iterator iter, max_iter;
+
 	ind_str.clear();
-	for (iter1 = IndMap.lower_bound(gPos - 5), iter2 = IndMap.upper_bound(gPos + 5); iter1 != iter2; iter1++)
+	for (iter = lower_bound(IndVec.begin(), IndVec.end(), gPos - 5, CompByIndEventPos); iter != IndVec.end() && iter->gPos <= gPos + 5; iter++)
 	{
-		if (abs(iter1->first - gPos) <= 5)
+		freq += iter->count;
+		if (max_freq < (int)iter->count || (max_freq == (int)iter->count && (iter->len & ~IndSpillFlag) > max_len))
 		{
-			for (it = iter1->second.begin(); it != iter1->second.end(); it++)
-			{
-				freq += it->second;
-				if (max_freq < it->second)
-				{
-					ind_str = it->first; 
-					max_freq = it->second;
-					max_pos = iter1->first;
-				}
-				else if (max_freq == it->second && it->first.length() > ind_str.length())
-				{
-					ind_str = it->first;
-					max_pos = iter1->first;
-				}
-			}
+			max_freq = iter->count;
+			max_len = iter->len & ~IndSpillFlag;
+			max_pos = iter->gPos;
+			max_iter = iter;
 		}
 	}
-	if (gPos == max_pos) return freq;
+	if (gPos == max_pos && freq > 0)
+	{
+		ind_str = GetIndEventSeq(*max_iter, bDeletion);
+		return freq;
+	}
 	else return 0;
 }
 
@@ -103,22 +170,98 @@ uint8_t CalQualityScore(int a, int b)
 	return qs;
 }
 
-void *CalBlockReadDepth(void *arg)
+void *ScanProfileBlocks(void *arg)
 {
-	int64_t gPos, end_gPos;
-	int bid, end_bid, sum, tid = *((int*)arg);
-
-	bid = (tid == 0 ? 0 : (int)(BlockNum / iThreadNum)*tid); 
-	end_bid = (tid == iThreadNum - 1 ? BlockNum : (BlockNum / iThreadNum)*(tid + 1));
-	for (; bid < end_bid; bid++)
+	// one contiguous range of depth blocks per thread, scanned in chunks of ScanChunkBlocks blocks
+	int i, j, n, tid = *((int*)arg);
+	int64_t gPos, pPos, end_pPos, len, bid, end_bid, chunk_end, sum;
+	bool bEmpty;
+	int* CovArr = new int[ScanChunkBlocks * BlockSize];
+	uint8_t* RcArr = new uint8_t[ScanChunkBlocks * BlockSize];
+	ProfileSummary_t summary = { 0, 0, 0, 0 };
+
+	bid = ScanBlockBeg + (BlockNum - ScanBlockBeg) * tid / iThreadNum; end_bid = ScanBlockBeg + (BlockNum - ScanBlockBeg) * (tid + 1) / iThreadNum;
+	for (; bid < end_bid; bid = chunk_end)
 	{
-		gPos = (int64_t)bid*BlockSize; if ((end_gPos = gPos + BlockSize) > GenomeSize) end_gPos = GenomeSize;
-		for (sum = 0; gPos < end_gPos; gPos++) sum += GetProfileColumnSize(MappingRecordArr[gPos]);
-		if (sum > 0) BlockDepthArr[bid] = sum / BlockSize;
+		if ((chunk_end = bid + ScanChunkBlocks) > end_bid) chunk_end = end_bid;
+		if ((end_pPos = chunk_end * BlockSize) > ProfileSize) end_pPos = ProfileSize;
+		// the chunk is read one genome-contiguous run at a time
+		for (bEmpty = true, pPos = bid * BlockSize; pPos < end_pPos; pPos += len)
+		{
+			len = GetProfileRun(pPos, end_pPos, gPos); i = (int)(pPos - bid * BlockSize);
+			if (SkipEmptyProfilePages(gPos, gPos + len) < gPos + len) bEmpty = false;
+			GetProfileCoverage(gPos, (int)len, CovArr + i, RcArr + i);
+		}
+		if (bEmpty) continue;
+
+		n = (int)(end_pPos - bid * BlockSize);
+		for (i = 0; i < n; i++)
+		{
+			summary.AlignedBase += (CovArr[i] > 0); summary.TotalCoverage += CovArr[i];
+			summary.ReadStartPos += (RcArr[i] > 0); summary.ReadStartNum += RcArr[i];
+		}
+		for (i = 0; i < n; i += BlockSize)
+		{
+			for (sum = 0, j = i; j < i + BlockSize && j < n; j++) sum += CovArr[j];
+			if (sum > 0) BlockDepthArr[bid - DepthBlockBase + i / BlockSize] = (int)(sum / BlockSize), CovPrefixArr[bid - DepthBlockBase + i / BlockSize + 1] = sum;
+		}
 	}
+	ThreadSummaryArr[tid] = summary;
+	delete[] CovArr; delete[] RcArr;
+
 	return (void*)(1);
 }
 
+ProfileSummary_t SummarizeProfile(int64_t pEnd)
+{
+	// a single pass over the profile up to pEnd gives the block depths and the coverage and duplication statistics of the blocks
+	// not summarized yet; only whole blocks are summarized before the profile end
+	int i, *ThrIDarr;
+	int64_t b, n, *PrefixArr;
+	int* DepthArr;
+	pthread_t *ThreadArr;
+	ProfileSummary_t summary = { 0, 0, 0, 0 };
+
+	if ((n = pEnd < ProfileSize ? pEnd / BlockSize : (ProfileSize + BlockSize - 1) / BlockSize) <= BlockNum) return summary;
+	if (n - DepthBlockBase > DepthBlockCap)
+	{
+		// the arrays drop the blocks before KeptDepthBlock and leave room for the blocks loaded next
+		DepthBlockCap = pEnd < ProfileSize ? 2 * (n - KeptDepthBlock) : n - KeptDepthBlock;
+		DepthArr = new int[DepthBlockCap](); PrefixArr = new int64_t[DepthBlockCap + 1]();
+		if (BlockDepthArr != NULL)
+		{
+			copy(BlockDepthArr + (KeptDepthBlock - DepthBlockBase), BlockDepthArr + (BlockNum - DepthBlockBase), DepthArr);
+			copy(CovPrefixArr + (KeptDepthBlock - DepthBlockBase), CovPrefixArr + (BlockNum - DepthBlockBase + 1), PrefixArr);
+			delete[] BlockDepthArr; delete[] CovPrefixArr;
+		}
+		BlockDepthArr = DepthArr; CovPrefixArr = PrefixArr; DepthBlockBase = KeptDepthBlock;
+	}
+	ScanBlockBeg = BlockNum; BlockNum = (int)n;
+	ThrIDarr = new int[iThreadNum]; ThreadArr = new pthread_t[iThreadNum];
+	ThreadSummaryArr = new ProfileSummary_t[iThreadNum];
+
+	for (i = 0; i < iThreadNum; i++) ThrIDarr[i] = i;
+	for (i = 0; i < iThreadNum; i++) pthread_create(&ThreadArr[i], NULL, ScanProfileBlocks, &ThrIDarr[i]);
+	for (i = 0; i < iThreadNum; i++) pthread_join(ThreadArr[i], NULL);
+	// the scan left the block sums, which become the sampled coverage prefix sums
+	for (b = ScanBlockBeg - DepthBlockBase; b < BlockNum - DepthBlockBase; b++) CovPrefixArr[b + 1] += CovPrefixArr[b];
+	for (i = 0; i < iThreadNum; i++)
+	{
+		summary.AlignedBase += ThreadSummaryArr[i].AlignedBase; summary.TotalCoverage += ThreadSummaryArr[i].TotalCoverage;
+		summary.ReadStartPos += ThreadSummaryArr[i].ReadStartPos; summary.ReadStartNum += ThreadSummaryArr[i].ReadStartNum;
+	}
+	delete[] ThreadSummaryArr; delete[] ThrIDarr; delete[] ThreadArr;
+
+	return summary;
+}
+
+bool CheckIndEventRange(vector<IndEvent_t>& IndVec, int64_t begPos, int64_t endPos)
+{
+	vector<IndEvent_t>::iterator iter = lower_bound(IndVec.begin(), IndVec.end(), begPos, CompByIndEventPos);
+
+	return iter != IndVec.end() && iter->gPos < endPos;
+}
+
 bool CheckDiploidFrequency(int cov, vector<pair<char, int> >& vec)
 {
 	int sum = vec[0].second + vec[1].second;
@@ -128,56 +271,56 @@ bool CheckDiploidFrequency(int cov, vector<pair<char, int> >& vec)
 
 bool CheckBreakPoints(int64_t gPos)
 {
-	map<int64_t, uint16_t>::iterator iter1, iter2;
-	
-	iter1 = BreakPointMap.lower_bound(gPos - 10);
-	iter2 = BreakPointMap.lower_bound(gPos + 10);
-	if (abs(iter1->first - gPos) <= 10 || abs(iter2->first - gPos) <= 10) return true;
+	vector<pair<int64_t, uint32_t> >::iterator iter = lower_bound(BreakPointVec.begin(), BreakPointVec.end(), make_pair(gPos - 10, (uint32_t)0));
+
+	if (iter != BreakPointVec.end() && iter->first <= gPos + 10) return true;
 	else return false;
 }
 
-void ShowMetaInfo()
-{
-	fprintf(outFile, "##fileformat=VCFv4.2\n");
-	fprintf(outFile, "##reference=%s\n", (RefFileName != NULL ? RefFileName: IndexFileName));
-	fprintf(outFile, "##source=MapCaller %s\n", VersionStr);
-	fprintf(outFile, "##command_line=\"%s\"\n", CmdLine.c_str());
-	fprintf(outFile, "##ALT=<ID=NON_REF,Description=\"Represents any possible alternative allele at this location\">\n");
-	fprintf(outFile, "##INFO=<ID=RC,Number=1,Type=Integer,Description=\"Number of reads with start coordinate at this position.\">\n");
-	fprintf(outFile, "##INFO=<ID=NTFREQ,Number=4,Type=Integer,Description=\"base depth\">\n");
-	fprintf(outFile, "##INFO=<ID=END,Number=1,Type=Integer,Description=\"Last position(inclusive) of the reported block\">\n");
-	fprintf(outFile, "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Read depth\">\n");
-	fprintf(outFile, "##INFO=<ID=TYPE,Number=A,Type=String,Description=\"The type of allele, either snv, ins, del, or BP(breakpoint).\">\n");
-	fprintf(outFile, "##FORMAT=<ID=AD,Number=R,Type=Integer,Description=\"Allelic depths for the ref and alt alleles in the order listed\">\n");
-	fprintf(outFile, "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Approximate read depth\">\n");
-	fprintf(outFile, "##FORMAT=<ID=AF,Number=A,Type=Float,Description=\"Allele fractions of alternate alleles\">\n");
-	fprintf(outFile, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n");
-	fprintf(outFile, "##FORMAT=<ID=PL,Number=G,Type=Integer,Description=\"Normalized, Phred - scaled likelihoods for genotypes as defined in the VCF specification\">\n");
-	if (bGVCF) fprintf(outFile, "##FORMAT=<ID=MIN_DP,Number=1,Type=Integer,Description=\"Minimum depth in gVCF output block.\">\n");
-	fprintf(outFile, "##FORMAT=<ID=F1R2,Number=R,Type=Integer,Description=\"Count of reads in F1R2 pair orientation supporting each allele\">\n");
-	fprintf(outFile, "##FORMAT=<ID=F2R1,Number=R,Type=Integer,Description=\"Count of reads in F2R1 pair orientation supporting each allele\">\n");
-	fprintf(outFile, "##FORMAT=<ID=GQ,Number=1,Type=Integer,Description=\"Genotype Quality\">\n");
-	fprintf(outFile, "##FILTER=<ID=PASS,Description=\"All filters passed\">\n");
-	//fprintf(outFile, "##FILTER=<ID=LowDepth,Description=\"Read depth < %d\">\n", MinReadDepth);
-	fprintf(outFile, "##FILTER=<ID=REF,Description=\"Genotyping model thinks this site is reference.\">\n");
-	fprintf(outFile, "##FILTER=<ID=BreakPoint,Description=\"It is predicted as a breakpoint\">\n");
-	fprintf(outFile, "##FILTER=<ID=DUP,Description=\"Duplicated regions(>=%dbp).\">\n", MinCNVsize);
-	fprintf(outFile, "##FILTER=<ID=Gaps,Description=\"Region without any read alignment(>=%dbp).\">\n", MinUnmappedSize);
-	fprintf(outFile, "##FILTER=<ID=q10,Description=\"Confidence score below 10\">\n");
-	if (bFilter) fprintf(outFile, "##FILTER=<ID=bad_haplotype,Description=\"Variants with variable frequencies on same haplotype\">\n");
-	if (bFilter) fprintf(outFile, "##FILTER=<ID=str_contraction,Description=\"Variant appears in repetitive region\">\n");
-	for (int i = 0; i < iChromsomeNum; i++) fprintf(outFile, "##contig=<ID=%s,length=%d>\n", ChromosomeVec[i].name, ChromosomeVec[i].len);
-	fprintf(outFile, "#CHROM	POS	ID	REF	ALT	QUAL	FILTER	INFO	FORMAT	%s\n", sample_id);
-}
-
-void IdentifyBreakPointCandidates()
+void ShowMetaInfo(kstring_t *hdr)
 {
+	ksprintf(hdr, "##fileformat=VCFv4.2\n");
+	ksprintf(hdr, "##reference=%s\n", (RefFileName != NULL ? RefFileName: IndexFileName));
+	ksprintf(hdr, "##source=MapCaller %s\n", VersionStr);
+	ksprintf(hdr, "##command_line=\"%s\"\n", CmdLine.c_str());
+	ksprintf(hdr, "##ALT=<ID=NON_REF,Description=\"Represents any possible alternative allele at this location\">\n");
+	ksprintf(hdr, "##INFO=<ID=RC,Number=1,Type=Integer,Description=\"Number of reads with start coordinate at this position.\">\n");
+	ksprintf(hdr, "##INFO=<ID=NTFREQ,Number=4,Type=Integer,Description=\"base depth\">\n");
+	ksprintf(hdr, "##INFO=<ID=END,Number=1,Type=Integer,Description=\"Last position(inclusive) of the reported block\">\n");
+	ksprintf(hdr, "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Read depth\">\n");
+	ksprintf(hdr, "##INFO=<ID=TYPE,Number=A,Type=String,Description=\"The type of allele, either snv, ins, del, or BP(breakpoint).\">\n");
+	ksprintf(hdr, "##FORMAT=<ID=AD,Number=R,Type=Integer,Description=\"Allelic depths for the ref and alt alleles in the order listed\">\n");
+	ksprintf(hdr, "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Approximate read depth\">\n");
+	ksprintf(hdr, "##FORMAT=<ID=AF,Number=A,Type=Float,Description=\"Allele fractions of alternate alleles\">\n");
+	ksprintf(hdr, "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n");
+	ksprintf(hdr, "##FORMAT=<ID=PL,Number=G,Type=Integer,Description=\"Normalized, Phred - scaled likelihoods for genotypes as defined in the VCF specification\">\n");
+	if (bGVCF) ksprintf(hdr, "##FORMAT=<ID=MIN_DP,Number=1,Type=Integer,Description=\"Minimum depth in gVCF output block.\">\n");
+	ksprintf(hdr, "##FORMAT=<ID=F1R2,Number=R,Type=Integer,Description=\"Count of reads in F1R2 pair orientation supporting each allele\">\n");
+	ksprintf(hdr, "##FORMAT=<ID=F2R1,Number=R,Type=Integer,Description=\"Count of reads in F2R1 pair orientation supporting each allele\">\n");
+	ksprintf(hdr, "##FORMAT=<ID=GQ,Number=1,Type=Integer,Description=\"Genotype Quality\">\n");
+	ksprintf(hdr, "##FILTER=<ID=PASS,Description=\"All filters passed\">\n");
+	//ksprintf(hdr, "##FILTER=<ID=LowDepth,Description=\"Read depth < %d\">\n", MinReadDepth);
+	ksprintf(hdr, "##FILTER=<ID=REF,Description=\"Genotyping model thinks this site is reference.\">\n");
+	ksprintf(hdr, "##FILTER=<ID=BreakPoint,Description=\"It is predicted as a breakpoint\">\n");
+	ksprintf(hdr, "##FILTER=<ID=DUP,Description=\"Duplicated regions(>=%dbp).\">\n", MinCNVsize);
+	ksprintf(hdr, "##FILTER=<ID=Gaps,Description=\"Region without any read alignment(>=%dbp).\">\n", MinUnmappedSize);
+	ksprintf(hdr, "##FILTER=<ID=q10,Description=\"Confidence score below 10\">\n");
+	if (bFilter) ksprintf(hdr, "##FILTER=<ID=bad_haplotype,Description=\"Variants with variable frequencies on same haplotype\">\n");
+	if (bFilter) ksprintf(hdr, "##FILTER=<ID=str_contraction,Description=\"Variant appears in repetitive region\">\n");
+	for (int i = 0; i < iChromsomeNum; i++) ksprintf(hdr, "##contig=<ID=%s,length=%d>\n", ChromosomeVec[i].name, ChromosomeVec[i].len);
+	ksprintf(hdr, "#CHROM	POS	ID	REF	ALT	QUAL	FILTER	INFO	FORMAT	%s\n", sample_id);
+}
+
+void IdentifyBreakPointCandidates(int64_t end)
+{
+	// the clipped read ends are clustered as they are loaded: an entry at end, past which nothing is loaded yet, closes the
+	// open cluster if no later entry could join it; the sweep continues from BreakPointPeak and BreakPointFreq
 	BreakPoint_t bp;
-	uint32_t total_freq;
-	pair<int64_t, uint16_t> p;
+	uint32_t& total_freq = BreakPointFreq;
+	pair<int64_t, uint32_t>& p = BreakPointPeak;
 
-	BreakPointMap.insert(make_pair(TwoGenomeSize, 0)); total_freq = 0; p = make_pair(0, 0);
-	for (map<int64_t, uint16_t>::iterator iter = BreakPointMap.begin(); iter != BreakPointMap.end(); iter++)
+	BreakPointVec.push_back(make_pair(end, 0));
+	for (vector<pair<int64_t, uint32_t> >::iterator iter = BreakPointVec.begin(); iter != BreakPointVec.end(); iter++)
 	{
 		if (iter->first - p.first > avgReadLength) // break
 		{
@@ -202,22 +345,59 @@ void IdentifyBreakPointCandidates()
 		}
 		//printf("Pos=%lld freq=%d\n", (long long)iter->first, iter->second);
 	}
+	vector<pair<int64_t, uint32_t> >().swap(BreakPointVec);
 }
 
-int CalRegionCov(int64_t begPos, int64_t endPos)
+static inline int GetBlockDepth(int64_t gPos)
 {
-	int cov = 0;
-	int64_t gPos;
+	int64_t pPos = GetProfilePos(gPos);
+
+	return pPos < 0 ? 0 : BlockDepthArr[pPos / BlockSize - DepthBlockBase];
+}
+
+static bool CompByBreakPointPos(const BreakPoint_t& bp, int64_t gPos)
+{
+	return bp.gPos < gPos;
+}
+
+static inline uint32_t GetBreakPointCanIdx(int64_t gPos)
+{
+	return (uint32_t)(lower_bound(BreakPointCanVec.begin(), BreakPointCanVec.end(), gPos, CompByBreakPointPos) - BreakPointCanVec.begin());
+}
 
+static int64_t GetCoveragePrefix(int64_t gPos)
+{
+	// total column depth of [0, gPos): the sampled prefix sum at the nearer block boundary, corrected by at most BlockSize/2 columns;
+	// the target layout holds whole blocks, so a profile position inside a block is that of gPos itself
+	int i, n, CovArr[BlockSize];
+	uint8_t RcArr[BlockSize];
+	int64_t pPos = GetProfileBound(gPos), bid = pPos / BlockSize, cov;
+
+	if ((n = (int)(pPos % BlockSize)) == 0) return CovPrefixArr[bid - DepthBlockBase];
+	if (n <= BlockSize / 2 || (bid + 1) * BlockSize > ProfileSize)
+	{
+		GetProfileCoverage(gPos - n, n, CovArr, RcArr);
+		for (cov = CovPrefixArr[bid - DepthBlockBase], i = 0; i < n; i++) cov += CovArr[i];
+	}
+	else
+	{
+		GetProfileCoverage(gPos, (n = BlockSize - n), CovArr, RcArr);
+		for (cov = CovPrefixArr[bid + 1 - DepthBlockBase], i = 0; i < n; i++) cov -= CovArr[i];
+	}
+	return cov;
+}
+
+int CalRegionCov(int64_t begPos, int64_t endPos)
+{
 	if (begPos < 0) begPos = 0; if (endPos > GenomeSize) endPos = GenomeSize - 1;
 	if (endPos < begPos) return 0;
-	for (gPos = begPos; gPos <= endPos; gPos++) cov += GetProfileColumnSize(MappingRecordArr[gPos]);
-	if (endPos >= begPos) return (int)(cov / (endPos - begPos + 1));
-	else return 0;
+
+	return (int)((GetCoveragePrefix(endPos < GenomeSize ? endPos + 1 : GenomeSize) - GetCoveragePrefix(begPos)) / (endPos - begPos + 1));
 }
 
-void IdentifyTranslocations()
+void IdentifyTranslocations(int64_t beg, int64_t end)
 {
+	// the breakpoint candidates within [beg, end)
 	int64_t gPos;
 	Variant_t Variant;
 	vector<int64_t> vec;
@@ -226,15 +406,16 @@ void IdentifyTranslocations()
 	uint32_t i, j, n, TNLnum, num, score, LCov, RCov, cov_thr, Lscore, Rscore;
 
 	//for (Iter1 = TranslocationSiteVec.begin(); Iter1 != TranslocationSiteVec.end(); Iter1++)  printf("Pos=%lld Dist=%lld\n", (long long)Iter1->gPos, (long long)Iter1->dist);
-	for (num = (int)BreakPointCanVec.size(), TNLnum = i = 0; i < num; i++)
+	for (i = GetBreakPointCanIdx(beg), num = GetBreakPointCanIdx(end), TNLnum = 0; i < num; i++)
 	{
 		gPos = BreakPointCanVec[i].gPos;
 		
 		LCov = CalRegionCov(gPos - FragmentSize, gPos - (avgReadLength >> 1));
-		cov_thr = BlockDepthArr[(int)(gPos / BlockSize)] >> 1;
+		cov_thr = GetBlockDepth(gPos) >> 1;
 		DiscordPair.gPos = gPos - FragmentSize; Iter1 = lower_bound(TranslocationSiteVec.begin(), TranslocationSiteVec.end(), DiscordPair, CompByDiscordPos);
 		DiscordPair.gPos = gPos - (avgReadLength >> 1); Iter2 = lower_bound(TranslocationSiteVec.begin(), TranslocationSiteVec.end(), DiscordPair, CompByDiscordPos);
-		if (Iter1 == TranslocationSiteVec.end() || Iter2 == TranslocationSiteVec.end()) continue;
+		// the vector may only hold the sites around the calling slice, so its end is TranslocationSiteEnd
+		if (TranslocationSiteEnd <= gPos - (avgReadLength >> 1)) continue;
 		vec.clear(); for (; Iter1 != Iter2; Iter1++) vec.push_back((Iter1->dist / 1000)); 
 		sort(vec.begin(), vec.end()); vec.push_back(TwoGenomeSize); n = (int)vec.size();
 		for (Lscore = 0, score = j = 1; j < n; j++)
@@ -252,7 +433,7 @@ void IdentifyTranslocations()
 		RCov = CalRegionCov(gPos, gPos + FragmentSize);
 		DiscordPair.gPos = gPos; Iter1 = upper_bound(TranslocationSiteVec.begin(), TranslocationSiteVec.end(), DiscordPair, CompByDiscordPos);
 		DiscordPair.gPos = gPos + FragmentSize; Iter2 = lower_bound(TranslocationSiteVec.begin(), TranslocationSiteVec.end(), DiscordPair, CompByDiscordPos);
-		if (Iter1 == TranslocationSiteVec.end() || Iter2 == TranslocationSiteVec.end()) continue;
+		if (TranslocationSiteEnd <= gPos + FragmentSize) continue;
 		vec.clear(); for (; Iter1 != Iter2; Iter1++) vec.push_back((Iter1->dist / 1000));
 		sort(vec.begin(), vec.end()); vec.push_back(TwoGenomeSize); n = (int)vec.size();
 		for (Rscore = 0, score = j = 1; j < n; j++)
@@ -273,7 +454,7 @@ void IdentifyTranslocations()
 			TNLnum++;
 			Variant.gPos = gPos;
 			Variant.VarType = var_TNL;
-			Variant.DP = GetProfileColumnSize(MappingRecordArr[gPos]);
+			Variant.DP = GetProfileColumnSize(GetProfileColumn(gPos));
 			Variant.AD_alt = Lscore > Rscore ? Lscore : Rscore;
 			Variant.qscore = CalQualityScore(Variant.AD_alt, cov_thr);
 			VariantVec.push_back(Variant);
@@ -282,8 +463,9 @@ void IdentifyTranslocations()
 	if (TNLnum > 0) inplace_merge(VariantVec.begin(), VariantVec.end() - TNLnum, VariantVec.end(), CompByVarPos);
 }
 
-void IdentifyInversions()
+void IdentifyInversions(int64_t beg, int64_t end)
 {
+	// the breakpoint candidates within [beg, end)
 	int64_t gPos;
 	Variant_t Variant;
 	vector<int64_t> vec;
@@ -292,13 +474,14 @@ void IdentifyInversions()
 	uint32_t i, j, n, LCov, RCov, cov_thr, INVnum, num, score, Lscore, Rscore;
 
 	//for (Iter1 = InversionSiteVec.begin(); Iter1 != InversionSiteVec.end(); Iter1++) printf("Pos=%lld Dist=%lld\n", (long long)Iter1->gPos, (long long)Iter1->dist);
-	for (num = (int)BreakPointCanVec.size(), INVnum = i = 0; i < num; i++)
+	for (i = GetBreakPointCanIdx(beg), num = GetBreakPointCanIdx(end), INVnum = 0; i < num; i++)
 	{
 		gPos = BreakPointCanVec[i].gPos; LCov = CalRegionCov(gPos - FragmentSize, gPos - (avgReadLength >> 1));
-		cov_thr = BlockDepthArr[(int)(gPos / BlockSize)] >> 1;
+		cov_thr = GetBlockDepth(gPos) >> 1;
 		DiscordPair.gPos = gPos - FragmentSize; Iter1 = lower_bound(InversionSiteVec.begin(), InversionSiteVec.end(), DiscordPair, CompByDiscordPos);
 		DiscordPair.gPos = gPos - (avgReadLength >> 1); Iter2 = lower_bound(InversionSiteVec.begin(), InversionSiteVec.end(), DiscordPair, CompByDiscordPos);
-		if (Iter1 == InversionSiteVec.end() || Iter2 == InversionSiteVec.end()) continue;
+		// the vector may only hold the sites around the calling slice, so its end is InversionSiteEnd
+		if (InversionSiteEnd <= gPos - (avgReadLength >> 1)) continue;
 		vec.clear(); for (; Iter1 != Iter2; Iter1++) vec.push_back((Iter1->dist / 1000));
 		sort(vec.begin(), vec.end()); vec.push_back(TwoGenomeSize);
 		for (n = (int)vec.size(), Lscore = 0, score = j = 1; j < n; j++)
@@ -316,7 +499,7 @@ void IdentifyInversions()
 		RCov = CalRegionCov(gPos, gPos + FragmentSize);
 		DiscordPair.gPos = gPos; Iter1 = upper_bound(InversionSiteVec.begin(), InversionSiteVec.end(), DiscordPair, CompByDiscordPos);
 		DiscordPair.gPos = gPos + FragmentSize; Iter2 = lower_bound(InversionSiteVec.begin(), InversionSiteVec.end(), DiscordPair, CompByDiscordPos);
-		if (Iter1 == InversionSiteVec.end() || Iter2 == InversionSiteVec.end()) continue;
+		if (InversionSiteEnd <= gPos + FragmentSize) continue;
 		vec.clear(); for (; Iter1 != Iter2; Iter1++) vec.push_back((Iter1->dist / 1000));
 		sort(vec.begin(), vec.end()); vec.push_back(TwoGenomeSize);
 		for (n = (int)vec.size(), Rscore = 0, score = j = 1; j < n; j++)
@@ -336,7 +519,7 @@ void IdentifyInversions()
 		{
 			INVnum++;
 			Variant.gPos = gPos;
-			Variant.DP = GetProfileColumnSize(MappingRecordArr[gPos]);
+			Variant.DP = GetProfileColumnSize(GetProfileColumn(gPos));
 			Variant.AD_alt = Lscore > Rscore ? Lscore : Rscore;
 			Variant.VarType = var_INV;
 			Variant.qscore = CalQualityScore(Variant.AD_alt, cov_thr);
@@ -348,19 +531,10 @@ void IdentifyInversions()
 
 bool CheckNearbyVariant(int i, int dist)
 {
+	// a calling slice may hold a single variant
 	bool bRet = false;
-	if (i == 0)
-	{
-		if (VariantVec[i + 1].gPos - VariantVec[i].gPos <= dist) bRet = true;
-	}
-	else if (i == iTotalVarNum - 1)
-	{
-		if (VariantVec[i].gPos - VariantVec[i - 1].gPos <= dist) bRet = true;
-	}
-	else
-	{
-		if ((VariantVec[i + 1].gPos - VariantVec[i].gPos) <= dist || (VariantVec[i].gPos - VariantVec[i - 1].gPos) <= dist) bRet = true;
-	}
+	if (i + 1 < iTotalVarNum && VariantVec[i + 1].gPos - VariantVec[i].gPos <= dist) bRet = true;
+	if (i > 0 && VariantVec[i].gPos - VariantVec[i - 1].gPos <= dist) bRet = true;
 	return bRet;
 }
 
@@ -374,7 +548,7 @@ bool CheckBadHaplotype(int i, int dist)
 		if (VariantVec[j].gPos - VariantVec[i].gPos > dist) break;
 		if (VariantVec[j].VarType == 0)
 		{
-			diff = abs(VariantVec[i].AD_alt - VariantVec[j].AD_alt);
+			diff = abs((int)VariantVec[i].AD_alt - (int)VariantVec[j].AD_alt);
 			if (diff > 5 && (VariantVec[i].AD_alt > VariantVec[j].AD_alt ? VariantVec[i].AD_alt >> 2 : VariantVec[j].AD_alt >> 2)) bRet = true;
 			break;
 		}
@@ -384,7 +558,7 @@ bool CheckBadHaplotype(int i, int dist)
 		if (VariantVec[i].gPos - VariantVec[j].gPos > dist) break;
 		if (VariantVec[j].VarType == 0)
 		{
-			diff = abs(VariantVec[i].AD_alt - VariantVec[j].AD_alt);
+			diff = abs((int)VariantVec[i].AD_alt - (int)VariantVec[j].AD_alt);
 			if (diff > 10 && (VariantVec[i].AD_alt > VariantVec[j].AD_alt ? (int)(VariantVec[i].AD_alt * 0.33) : (int)(VariantVec[j].AD_alt * 0.33))) bRet = true;
 			break;
 		}
@@ -395,13 +569,14 @@ bool CheckBadHaplotype(int i, int dist)
 void ShowNeighboringProfile(int64_t gPos, Coordinate_t coor)
 {
 	int64_t i, p;
+	MappingRecord_t Profile;
 
 	for (i = -5; i <= 5; i++)
 	{
 		if (i == 0) printf("*");
-		p = gPos + i;
+		p = gPos + i; Profile = GetProfileColumn(p);
 		coor = DetermineCoordinate(p);
-		printf("%s-%lld\t\t%d\t%d\t%d\t%d\tR=%d\tdepth=%d\n", ChromosomeVec[coor.ChromosomeIdx].name, (long long)coor.gPos, (int)MappingRecordArr[p].A, (int)MappingRecordArr[p].C, (int)MappingRecordArr[p].G, (int)MappingRecordArr[p].T, (int)MappingRecordArr[p].multi_hit, GetProfileColumnSize(MappingRecordArr[p]));
+		printf("%s-%lld\t\t%d\t%d\t%d\t%d\tR=%d\tdepth=%d\n", ChromosomeVec[coor.ChromosomeIdx].name, (long long)coor.gPos, (int)Profile.A, (int)Profile.C, (int)Profile.G, (int)Profile.T, (int)Profile.multi_hit, GetProfileColumnSize(Profile));
 	}
 	printf("\n\n");
 }
@@ -417,7 +592,8 @@ string DetermineFileter(int VarIdx)
 
 	if (bFilter)
 	{
-		if ((int)MappingRecordArr[VariantVec[VarIdx].gPos].multi_hit > (int)(GetProfileColumnSize(MappingRecordArr[VariantVec[VarIdx].gPos])*0.05)) filter_str += "str_contraction;";
+		MappingRecord_t Profile = GetProfileColumn(VariantVec[VarIdx].gPos);
+		if ((int)Profile.multi_hit > (int)(GetProfileColumnSize(Profile)*0.05)) filter_str += "str_contraction;";
 		if (CheckBadHaplotype(VarIdx, 100)) filter_str += "bad_haplotype;";
 	}
 	if (filter_str == "") filter_str = "PASS";
@@ -426,77 +602,495 @@ string DetermineFileter(int VarIdx)
 	return filter_str;
 }
 
-void GenVariantCallingFile()
+static inline void PutVcfSite(Coordinate_t& coor, int64_t gPos, kstring_t *s)
 {
-	int i;
-	float AlleleFreq;
+	kputs(ChromosomeVec[coor.ChromosomeIdx].name, s); kputc('\t', s); kputw((int)coor.gPos, s); kputs("\t.\t", s); kputc(RefSequence[gPos], s);
+}
+
+static inline void PutVcfNTFreq(MappingRecord_t& Profile, kstring_t *s)
+{
+	kputs("NTFREQ=", s); kputw((int)Profile.A, s); kputc(',', s); kputw((int)Profile.C, s); kputc(',', s); kputw((int)Profile.G, s); kputc(',', s); kputw((int)Profile.T, s);
+}
+
+static inline void PutVcfStrandCounts(MappingRecord_t& Profile, kstring_t *s)
+{
+	kputw((int)Profile.F1, s); kputc(',', s); kputw((int)Profile.R2, s); kputc(':', s); kputw((int)Profile.F2, s); kputc(',', s); kputw((int)Profile.R1, s);
+}
+
+// GT:GQ:DP:AD:AF:F1R2:F2R1 of a SUB/INS/DEL record
+static void PutVcfSample(Variant_t& var, MappingRecord_t& Profile, kstring_t *s)
+{
+	float AlleleFreq = 1.0*var.AD_alt / var.DP;
+
+	kputs("GT:GQ:DP:AD:AF:F1R2:F2R1\t", s); kputs(GenotypeLabel[var.GenoType], s); kputc(':', s); kputw(var.qscore, s); kputc(':', s); kputw((int)var.DP, s); kputc(':', s);
+	kputw((int)var.AD_ref, s); kputc(',', s); kputw((int)var.AD_alt, s); ksprintf(s, ":%.2f:", AlleleFreq); PutVcfStrandCounts(Profile, s); kputc('\n', s);
+}
+
+static inline void AddVcfRecordSpan(Coordinate_t& coor, int end, VcfBatch_t& batch)
+{
+	if (bVcfBgzf)
+	{
+		VcfRecordSpan_t span;
+		span.tid = coor.ChromosomeIdx; span.beg = (int)coor.gPos - 1; span.end = end; span.TextEnd = (int64_t)batch.text.l;
+		batch.SpanVec.push_back(span);
+	}
+}
+
+// formats one variant record; returns the (exclusive) end of the record on the chromosome, or -1 if it is not reported
+static int FormatVcfRecord(int i, VcfBatch_t& batch)
+{
+	int end;
+	int64_t gPos;
 	Coordinate_t coor;
-	string filter_str;
-	int64_t gPos, gPosEnd;
-	map<string, uint16_t>::iterator IndSeqMapIter;
+	kstring_t *s = &batch.text;
+	Variant_t& var = VariantVec[i];
+	MappingRecord_t Profile;
+
+	gPos = var.gPos; coor = DetermineCoordinate(gPos); end = (int)coor.gPos;
 
-	outFile = fopen(VcfFileName, "w"); ShowMetaInfo();
+	if (var.VarType == var_SUB || var.VarType == var_INS || var.VarType == var_DEL)
+	{
+		if (var.VarType != var_SUB && var.ALTstr.length() > 5) return -1;
+
+		batch.VarNum[var.VarType]++; Profile = GetProfileColumn(gPos);
+		PutVcfSite(coor, gPos, s);
+		if (var.VarType == var_SUB) kputc('\t', s), kputs(var.ALTstr.c_str(), s);
+		else if (var.VarType == var_INS) kputc('\t', s), kputc(RefSequence[gPos], s), kputs(var.ALTstr.c_str(), s);
+		else kputs(var.ALTstr.c_str(), s), kputc('\t', s), kputc(RefSequence[gPos], s), end += (int)var.ALTstr.length();
+		kputc('\t', s); kputw(var.qscore, s); kputc('\t', s); kputs(DetermineFileter(i).c_str(), s);
+		kputs("\tRC=", s); kputw((int)Profile.readCount, s);
+		if (var.VarType == var_SUB) kputc(';', s), PutVcfNTFreq(Profile, s), kputs(";TYPE=snv\t", s);
+		else if (var.VarType == var_INS) kputs(";TYPE=ins\t", s);
+		else kputs(";TYPE=del\t", s);
+		PutVcfSample(var, Profile, s);
+	}
+	else if (var.VarType == var_TNL || var.VarType == var_INV)
+	{
+		batch.VarNum[var.VarType]++;
+		PutVcfSite(coor, gPos, s); kputs(var.VarType == var_TNL ? "\t<TNL>" : "\t<INV>", s); kputs("\t30\tBreakPoint\tTYPE=BP\tGT:GQ:DP:AD\t.:.:0:.\n", s);
+	}
+	else if (var.VarType == var_CNV || var.VarType == var_UMR)
+	{
+		if ((int)var.DP < (var.VarType == var_CNV ? MinCNVsize : MinUnmappedSize)) return -1;
 
-	//sort(VariantVec.begin(), VariantVec.end(), CompByVarPos);
-	for (i = 0; i < iTotalVarNum; i++)
+		end = (int)(coor.gPos + var.DP - 1);
+		PutVcfSite(coor, gPos, s); kputs(var.VarType == var_CNV ? "\t<*>\t0\tDUP\tEND=" : "\t<*>\t0\tGaps\tEND=", s); kputw(end, s); kputs("\tGT:GQ:DP:AD\t.:.:0:.\n", s);
+	}
+	else if (var.VarType == var_MON)
 	{
-		gPos = VariantVec[i].gPos; coor = DetermineCoordinate(gPos);
+		Profile = GetProfileColumn(gPos);
+		PutVcfSite(coor, gPos, s); kputs("\t.\t0\tREF\tDP=", s); kputw((int)var.DP, s); kputs(";RC=", s); kputw((int)Profile.readCount, s); kputc(';', s); PutVcfNTFreq(Profile, s);
+		kputs("\tGT:F1R2:F2R1\t", s); kputs(GenotypeLabel[var.GenoType], s); kputc(':', s); PutVcfStrandCounts(Profile, s); kputc('\n', s);
+	}
+	else return -1;
 
-		if(VariantVec[i].VarType < 3) filter_str = DetermineFileter(i);
-		else filter_str = ".";
+	AddVcfRecordSpan(coor, end, batch);
 
-		if (VariantVec[i].VarType == var_SUB)
-		{
-			VarNumVec[var_SUB]++; AlleleFreq = 1.0*VariantVec[i].AD_alt / VariantVec[i].DP;
-			//fprintf(outFile, "%s	%d	.	%c	%s	%d	%s	DP=%d;AD=%d;RC=%d;AF=%.3f;NTFREQ=%d,%d,%d,%d;GT=%s;TYPE=snv\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[VariantVec[i].gPos], VariantVec[i].ALTstr.c_str(), VariantVec[i].qscore, filter_str.c_str(), VariantVec[i].DP, VariantVec[i].AD, (int)MappingRecordArr[gPos].readCount, 1.0*VariantVec[i].AD / VariantVec[i].DP, (int)MappingRecordArr[gPos].A, (int)MappingRecordArr[gPos].C, (int)MappingRecordArr[gPos].G, (int)MappingRecordArr[gPos].T, GenotypeLabel[VariantVec[i].GenoType]);
-			fprintf(outFile, "%s	%d	.	%c	%s	%d	%s	RC=%d;NTFREQ=%d,%d,%d,%d;TYPE=snv	GT:GQ:DP:AD:AF:F1R2:F2R1	%s:%d:%d:%d,%d:%.2f:%d,%d:%d,%d\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[VariantVec[i].gPos], VariantVec[i].ALTstr.c_str(), VariantVec[i].qscore, filter_str.c_str(), (int)MappingRecordArr[gPos].readCount, (int)MappingRecordArr[gPos].A, (int)MappingRecordArr[gPos].C, (int)MappingRecordArr[gPos].G, (int)MappingRecordArr[gPos].T, GenotypeLabel[VariantVec[i].GenoType], VariantVec[i].qscore, VariantVec[i].DP, VariantVec[i].AD_ref, VariantVec[i].AD_alt, AlleleFreq, MappingRecordArr[gPos].F1, MappingRecordArr[gPos].R2, MappingRecordArr[gPos].F2, MappingRecordArr[gPos].R1);
-		}
-		else if (VariantVec[i].VarType == var_INS)
+	return end;
+}
+
+// the last position of the gVCF block: up to the next record (variant vi or the next block) or the chromosome end
+static bool CompByBlockPos(const GVCFBlock_t& block, int64_t gPos)
+{
+	return block.gPos < gPos;
+}
+
+static int64_t GetGVCFBlockEnd(int bi, int vi, Coordinate_t& coor)
+{
+	int64_t gPosEnd, next = -1;
+
+	if (vi < iTotalVarNum) next = VariantVec[vi].gPos;
+	if (bi + 1 < (int)GVCFBlockVec.size() && (next < 0 || GVCFBlockVec[bi + 1].gPos < next)) next = GVCFBlockVec[bi + 1].gPos;
+
+	gPosEnd = ChromosomeVec[coor.ChromosomeIdx].FowardLocation + ChromosomeVec[coor.ChromosomeIdx].len - 1;
+	if (next >= 0 && next < gPosEnd) gPosEnd = next - 1;
+	// with -regions a block does not extend past its target region
+	if ((next = GetRegionEnd(TargetRegionVec, GVCFBlockVec[bi].gPos) - 1) < gPosEnd) gPosEnd = next;
+
+	return gPosEnd;
+}
+
+// formats the gVCF block bi, which is followed by the variant vi
+static void FormatGVCFBlock(int bi, int vi, VcfBatch_t& batch)
+{
+	int end;
+	kstring_t *s = &batch.text;
+	GVCFBlock_t& block = GVCFBlockVec[bi];
+	Coordinate_t coor = DetermineCoordinate(block.gPos);
+
+	end = (int)DetermineCoordinate(GetGVCFBlockEnd(bi, vi, coor)).gPos;
+	PutVcfSite(coor, block.gPos, s); kputs("\t<*>\t0\tREF\tEND=", s); kputw(end, s); kputs(";DP=", s); kputw((int)block.DP, s); kputs(";MIN_DP=", s); kputw((int)block.MinDP, s); kputs("\tGT:GQ:DP:AD\t.:.:0:.\n", s);
+	AddVcfRecordSpan(coor, end, batch);
+}
+
+// cuts a text buffer into BGZF blocks; BlockOffsetVec[k] is the compressed offset of the k-th block (the last entry is the total size)
+static bool CompressBgzfBlocks(kstring_t *text, kstring_t *bgzf, vector<int64_t>& BlockOffsetVec)
+{
+	size_t p, len, dlen;
+
+	bgzf->l = 0; BlockOffsetVec.clear(); BlockOffsetVec.push_back(0);
+	for (p = 0; p < text->l; p += len)
+	{
+		len = text->l - p; if (len > BGZF_BLOCK_SIZE) len = BGZF_BLOCK_SIZE;
+		if (ks_resize(bgzf, bgzf->l + BGZF_MAX_BLOCK_SIZE) < 0) return false;
+		dlen = BGZF_MAX_BLOCK_SIZE;
+		if (bgzf_compress(bgzf->s + bgzf->l, &dlen, text->s + p, len, -1) != 0) return false;
+		bgzf->l += dlen; BlockOffsetVec.push_back((int64_t)bgzf->l);
+	}
+	return true;
+}
+
+// virtual offset of the text position TextEnd of a batch written at FileOffset
+static inline uint64_t GetBgzfVirtualOffset(int64_t FileOffset, vector<int64_t>& BlockOffsetVec, int64_t TextEnd)
+{
+	return (uint64_t)(FileOffset + BlockOffsetVec[TextEnd / BGZF_BLOCK_SIZE]) << 16 | (uint64_t)(TextEnd % BGZF_BLOCK_SIZE);
+}
+
+// GenotypeLabel as BCF genotypes: ploidy, alleles
+static const int32_t BcfGenotypeArr[][3] = { { 1, bcf_gt_missing, 0 }, { 1, bcf_gt_unphased(0), 0 }, { 1, bcf_gt_unphased(1), 0 }, { 2, bcf_gt_unphased(0), bcf_gt_unphased(0) }, { 2, bcf_gt_unphased(0), bcf_gt_unphased(1) }, { 2, bcf_gt_unphased(1), bcf_gt_unphased(1) }, { 2, bcf_gt_unphased(1), bcf_gt_unphased(2) } };
+
+static void InitBcfTagID()
+{
+	BcfTag.RC = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "RC"); BcfTag.NTFREQ = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "NTFREQ"); BcfTag.TYPE = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "TYPE");
+	BcfTag.END = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "END"); BcfTag.DP = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "DP"); BcfTag.MIN_DP = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "MIN_DP");
+	BcfTag.GT = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "GT"); BcfTag.GQ = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "GQ"); BcfTag.AD = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "AD");
+	BcfTag.AF = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "AF"); BcfTag.F1R2 = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "F1R2"); BcfTag.F2R1 = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "F2R1");
+	BcfTag.BreakPoint = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "BreakPoint"); BcfTag.DUP = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "DUP"); BcfTag.Gaps = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "Gaps"); BcfTag.REF = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, "REF");
+}
+
+// CHROM, POS, ID, alleles, QUAL and FILTER are encoded into the shared block in this order
+static void PutBcfSite(bcf1_t *rec, Coordinate_t& coor, string& ref, string& alt, float qual, int32_t *flt, int n_flt)
+{
+	size_t p, q;
+
+	bcf_clear(rec); rec->rid = coor.ChromosomeIdx; rec->pos = (int)coor.gPos - 1; rec->rlen = (int)ref.length(); rec->qual = qual; rec->n_sample = 1;
+	bcf_enc_size(&rec->shared, 0, BCF_BT_CHAR);
+	bcf_enc_vchar(&rec->shared, (int)ref.length(), ref.c_str()); rec->n_allele = 1;
+	for (p = 0; p < alt.length(); p = q + 1, rec->n_allele++)
+	{
+		if ((q = alt.find(',', p)) == string::npos) q = alt.length();
+		bcf_enc_vchar(&rec->shared, (int)(q - p), alt.c_str() + p);
+	}
+	bcf_enc_vint(&rec->shared, n_flt, flt, -1);
+}
+
+static inline void PutBcfInfo(bcf1_t *rec, int key, int32_t *v, int n)
+{
+	bcf_enc_int1(&rec->shared, key); bcf_enc_vint(&rec->shared, n, v, -1); rec->n_info++;
+}
+
+static inline void PutBcfInfoString(bcf1_t *rec, int key, const char *str)
+{
+	bcf_enc_int1(&rec->shared, key); bcf_enc_vchar(&rec->shared, (int)strlen(str), str); rec->n_info++;
+}
+
+static inline void PutBcfFormat(bcf1_t *rec, int key, int32_t *v, int n)
+{
+	bcf_enc_int1(&rec->indiv, key); bcf_enc_vint(&rec->indiv, n, v, n); rec->n_fmt++;
+}
+
+static inline void PutBcfNTFreq(bcf1_t *rec, MappingRecord_t& Profile)
+{
+	int32_t v[4] = { (int32_t)Profile.A, (int32_t)Profile.C, (int32_t)Profile.G, (int32_t)Profile.T };
+	PutBcfInfo(rec, BcfTag.NTFREQ, v, 4);
+}
+
+static inline void PutBcfStrandCounts(bcf1_t *rec, MappingRecord_t& Profile)
+{
+	int32_t F1R2[2] = { (int32_t)Profile.F1, (int32_t)Profile.R2 }, F2R1[2] = { (int32_t)Profile.F2, (int32_t)Profile.R1 };
+	PutBcfFormat(rec, BcfTag.F1R2, F1R2, 2); PutBcfFormat(rec, BcfTag.F2R1, F2R1, 2);
+}
+
+// the .:.:0:. sample of the breakpoint and region records
+static void PutBcfEmptySample(bcf1_t *rec)
+{
+	int32_t v = bcf_gt_missing;
+
+	PutBcfFormat(rec, BcfTag.GT, &v, 1);
+	v = bcf_int32_missing; PutBcfFormat(rec, BcfTag.GQ, &v, 1);
+	v = 0; PutBcfFormat(rec, BcfTag.DP, &v, 1);
+	v = bcf_int32_missing; PutBcfFormat(rec, BcfTag.AD, &v, 1);
+}
+
+// encodes the BCF record of the variant with the same content as FormatVcfRecord; returns false if it is not reported
+static bool BuildBcfRecord(int i, bcf1_t *rec, VcfBatch_t& batch)
+{
+	char buf[16];
+	float AlleleFreq;
+	string ref, alt, filter_str;
+	Coordinate_t coor;
+	int64_t gPos;
+	int32_t v[2], flt[4], n_flt = 0;
+	Variant_t& var = VariantVec[i];
+	MappingRecord_t Profile;
+	size_t p, q;
+
+	gPos = var.gPos; coor = DetermineCoordinate(gPos); ref = RefSequence[gPos];
+
+	if (var.VarType == var_SUB || var.VarType == var_INS || var.VarType == var_DEL)
+	{
+		if (var.VarType != var_SUB && var.ALTstr.length() > 5) return false;
+
+		batch.VarNum[var.VarType]++; Profile = GetProfileColumn(gPos);
+		if (var.VarType == var_SUB) alt = var.ALTstr;
+		else if (var.VarType == var_INS) alt = ref + var.ALTstr;
+		else alt = ref, ref += var.ALTstr;
+		filter_str = DetermineFileter(i);
+		for (p = 0; p < filter_str.length() && n_flt < 4; p = q + 1)
 		{
-			if(VariantVec[i].ALTstr.length() > 5) continue;
-			
-			VarNumVec[var_INS]++; AlleleFreq = 1.0*VariantVec[i].AD_alt / VariantVec[i].DP;
-			//fprintf(outFile, "%s	%d	.	%c	%c%s	%d	%s	DP=%d;AD=%d;RC=%d;AF=%.3f;GT=%s;TYPE=ins\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos], RefSequence[gPos], VariantVec[i].ALTstr.c_str(), VariantVec[i].qscore, filter_str.c_str(), VariantVec[i].DP, VariantVec[i].AD, (int)MappingRecordArr[gPos].readCount, AlleleFreq, GenotypeLabel[VariantVec[i].GenoType]);
-			fprintf(outFile, "%s	%d	.	%c	%c%s	%d	%s	RC=%d;TYPE=ins	GT:GQ:DP:AD:AF:F1R2:F2R1	%s:%d:%d:%d,%d:%.2f:%d,%d:%d,%d\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos], RefSequence[gPos], VariantVec[i].ALTstr.c_str(), VariantVec[i].qscore, filter_str.c_str(), (int)MappingRecordArr[gPos].readCount, GenotypeLabel[VariantVec[i].GenoType], VariantVec[i].qscore, VariantVec[i].DP, VariantVec[i].AD_ref, VariantVec[i].AD_alt, AlleleFreq, MappingRecordArr[gPos].F1, MappingRecordArr[gPos].R2, MappingRecordArr[gPos].F2, MappingRecordArr[gPos].R1);
+			if ((q = filter_str.find(';', p)) == string::npos) q = filter_str.length();
+			flt[n_flt++] = bcf_hdr_id2int(BcfHdr, BCF_DT_ID, filter_str.substr(p, q - p).c_str());
 		}
-		else if (VariantVec[i].VarType == var_DEL)
+		PutBcfSite(rec, coor, ref, alt, var.qscore, flt, n_flt);
+
+		v[0] = Profile.readCount; PutBcfInfo(rec, BcfTag.RC, v, 1);
+		if (var.VarType == var_SUB) PutBcfNTFreq(rec, Profile);
+		PutBcfInfoString(rec, BcfTag.TYPE, var.VarType == var_SUB ? "snv" : (var.VarType == var_INS ? "ins" : "del"));
+
+		PutBcfFormat(rec, BcfTag.GT, (int32_t*)BcfGenotypeArr[var.GenoType] + 1, BcfGenotypeArr[var.GenoType][0]);
+		v[0] = var.qscore; PutBcfFormat(rec, BcfTag.GQ, v, 1);
+		v[0] = var.DP; PutBcfFormat(rec, BcfTag.DP, v, 1);
+		v[0] = var.AD_ref; v[1] = var.AD_alt; PutBcfFormat(rec, BcfTag.AD, v, 2);
+		// AF is rounded as in the VCF output
+		AlleleFreq = 1.0*var.AD_alt / var.DP; snprintf(buf, 16, "%.2f", AlleleFreq); AlleleFreq = strtof(buf, NULL);
+		bcf_enc_int1(&rec->indiv, BcfTag.AF); bcf_enc_vfloat(&rec->indiv, 1, &AlleleFreq); rec->n_fmt++;
+		PutBcfStrandCounts(rec, Profile);
+	}
+	else if (var.VarType == var_TNL || var.VarType == var_INV)
+	{
+		batch.VarNum[var.VarType]++;
+		alt = (var.VarType == var_TNL ? "<TNL>" : "<INV>"); flt[0] = BcfTag.BreakPoint;
+		PutBcfSite(rec, coor, ref, alt, 30, flt, 1);
+		PutBcfInfoString(rec, BcfTag.TYPE, "BP");
+		PutBcfEmptySample(rec);
+	}
+	else if (var.VarType == var_CNV || var.VarType == var_UMR)
+	{
+		if ((int)var.DP < (var.VarType == var_CNV ? MinCNVsize : MinUnmappedSize)) return false;
+
+		alt = "<*>"; flt[0] = (var.VarType == var_CNV ? BcfTag.DUP : BcfTag.Gaps);
+		PutBcfSite(rec, coor, ref, alt, 0, flt, 1);
+		v[0] = (int32_t)(coor.gPos + var.DP - 1); PutBcfInfo(rec, BcfTag.END, v, 1); rec->rlen = v[0] - rec->pos;
+		PutBcfEmptySample(rec);
+	}
+	else if (var.VarType == var_MON)
+	{
+		Profile = GetProfileColumn(gPos); flt[0] = BcfTag.REF;
+		PutBcfSite(rec, coor, ref, alt, 0, flt, 1);
+		v[0] = var.DP; PutBcfInfo(rec, BcfTag.DP, v, 1);
+		v[0] = Profile.readCount; PutBcfInfo(rec, BcfTag.RC, v, 1);
+		PutBcfNTFreq(rec, Profile);
+		PutBcfFormat(rec, BcfTag.GT, (int32_t*)BcfGenotypeArr[var.GenoType] + 1, BcfGenotypeArr[var.GenoType][0]);
+		PutBcfStrandCounts(rec, Profile);
+	}
+	else return false;
+
+	return true;
+}
+
+static void BuildBcfBlockRecord(int bi, int vi, bcf1_t *rec)
+{
+	int32_t v, flt = BcfTag.REF;
+	string ref, alt = "<*>";
+	GVCFBlock_t& block = GVCFBlockVec[bi];
+	Coordinate_t coor = DetermineCoordinate(block.gPos);
+
+	ref = RefSequence[block.gPos];
+	PutBcfSite(rec, coor, ref, alt, 0, &flt, 1);
+	v = (int32_t)DetermineCoordinate(GetGVCFBlockEnd(bi, vi, coor)).gPos; PutBcfInfo(rec, BcfTag.END, &v, 1); rec->rlen = v - rec->pos;
+	v = block.DP; PutBcfInfo(rec, BcfTag.DP, &v, 1);
+	v = block.MinDP; PutBcfInfo(rec, BcfTag.MIN_DP, &v, 1);
+	PutBcfEmptySample(rec);
+}
+
+static inline bcf1_t *GetBcfRecord(VcfBatch_t& batch)
+{
+	if (batch.BcfRecNum == (int)batch.BcfRecVec.size()) batch.BcfRecVec.push_back(bcf_init());
+	return batch.BcfRecVec[batch.BcfRecNum];
+}
+
+void *FormatVcfBatch(void *arg)
+{
+	int i, bi;
+	VcfBatch_t& batch = *((VcfBatch_t*)arg);
+
+	batch.text.l = 0; batch.SpanVec.clear(); batch.BcfRecNum = 0; memset(batch.VarNum, 0, sizeof(batch.VarNum));
+	// gVCF blocks go before the variants at larger positions
+	for (i = batch.beg, bi = batch.BlockBeg; i < batch.end || bi < batch.BlockEnd;)
+	{
+		if (bi < batch.BlockEnd && (i == batch.end || GVCFBlockVec[bi].gPos < VariantVec[i].gPos))
 		{
-			if (VariantVec[i].ALTstr.length() > 5) continue;
-			VarNumVec[var_DEL]++; AlleleFreq = 1.0*VariantVec[i].AD_alt / VariantVec[i].DP;
-			//fprintf(outFile, "%s	%d	.	%c%s	%c	%d	%s	DP=%d;AD=%d;RC=%d;AF=%.3f;GT=%s;TYPE=del\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos], VariantVec[i].ALTstr.c_str(), RefSequence[gPos], VariantVec[i].qscore, filter_str.c_str(), VariantVec[i].DP, VariantVec[i].AD, (int)MappingRecordArr[gPos].readCount, AlleleFreq, GenotypeLabel[VariantVec[i].GenoType]);
-			fprintf(outFile, "%s	%d	.	%c%s	%c	%d	%s	RC=%d;TYPE=del	GT:GQ:DP:AD:AF:F1R2:F2R1	%s:%d:%d:%d,%d:%.2f:%d,%d:%d,%d\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos], VariantVec[i].ALTstr.c_str(), RefSequence[gPos], VariantVec[i].qscore, filter_str.c_str(), (int)MappingRecordArr[gPos].readCount, GenotypeLabel[VariantVec[i].GenoType], VariantVec[i].qscore, VariantVec[i].DP, VariantVec[i].AD_ref, VariantVec[i].AD_alt, AlleleFreq, MappingRecordArr[gPos].F1, MappingRecordArr[gPos].R2, MappingRecordArr[gPos].F2, MappingRecordArr[gPos].R1);
+			if (!bBCFFormat) FormatGVCFBlock(bi, i, batch);
+			else BuildBcfBlockRecord(bi, i, GetBcfRecord(batch)), batch.BcfRecNum++;
+			bi++;
 		}
-		else if (VariantVec[i].VarType == var_TNL)
+		else
 		{
-			VarNumVec[var_TNL]++;
-			fprintf(outFile, "%s	%d	.	%c	<TNL>	30	BreakPoint	TYPE=BP	GT:GQ:DP:AD	.:.:0:.\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos]);
+			if (!bBCFFormat) FormatVcfRecord(i, batch);
+			else if (BuildBcfRecord(i, GetBcfRecord(batch), batch)) batch.BcfRecNum++;
+			i++;
 		}
-		else if (VariantVec[i].VarType == var_INV)
+	}
+	batch.bOK = bVcfBgzf ? CompressBgzfBlocks(&batch.text, &batch.bgzf, batch.BlockOffsetVec) : true;
+
+	return (void*)(1);
+}
+
+static hts_idx_t *InitVcfIndex(uint64_t offset0, int& fmt)
+{
+	int i, min_shift = 14, n_lvls = 5;
+
+	// tabix cannot address positions beyond 2^29
+	for (fmt = HTS_FMT_TBI, i = 0; i < iChromsomeNum; i++) if (ChromosomeVec[i].len >= (1 << 29)) fmt = HTS_FMT_CSI;
+	if (fmt == HTS_FMT_CSI) n_lvls = (TBX_MAX_SHIFT - min_shift + 2) / 3;
+
+	return hts_idx_init(iChromsomeNum, fmt, offset0, min_shift, n_lvls);
+}
+
+// tabix meta data: the VCF tbx_conf_t followed by the '\0'-terminated sequence names in tid order
+static void SetVcfIndexMeta(hts_idx_t *idx)
+{
+	int i, l;
+	uint8_t *meta;
+	uint32_t x[7] = { (uint32_t)tbx_conf_vcf.preset, (uint32_t)tbx_conf_vcf.sc, (uint32_t)tbx_conf_vcf.bc, (uint32_t)tbx_conf_vcf.ec, (uint32_t)tbx_conf_vcf.meta_char, (uint32_t)tbx_conf_vcf.line_skip, 0 };
+
+	for (i = 0; i < iChromsomeNum; i++) x[6] += strlen(ChromosomeVec[i].name) + 1;
+	meta = (uint8_t*)malloc(28 + x[6]); memcpy(meta, x, 28);
+	for (l = 28, i = 0; i < iChromsomeNum; i++)
+	{
+		memcpy(meta + l, ChromosomeVec[i].name, strlen(ChromosomeVec[i].name) + 1);
+		l += strlen(ChromosomeVec[i].name) + 1;
+	}
+	hts_idx_set_meta(idx, l, meta, 0);
+}
+
+// the output file stays open while the calling slices are written one after another
+typedef struct
+{
+	FILE *outFile;
+	htsFile *BcfFile;
+	hts_idx_t *idx;
+	int fmt;
+	int64_t FileOffset;
+	bool bOK;
+	pthread_t *ThreadArr;
+	VcfBatch_t *BatchArr;
+} VcfWriter_t;
+
+static VcfWriter_t VcfWriter;
+
+static void OpenVariantCallingFile()
+{
+	int i;
+	vector<int64_t> HdrBlockOffsetVec;
+	kstring_t hdr = { 0, 0, NULL }, hdr_bgzf = { 0, 0, NULL };
+	VcfWriter_t& w = VcfWriter;
+
+	w.outFile = NULL; w.BcfFile = NULL; w.idx = NULL; w.fmt = HTS_FMT_TBI; w.FileOffset = 0; w.bOK = true;
+	bVcfBgzf = !bBCFFormat && (strlen(VcfFileName) > 3 && strcmp(VcfFileName + strlen(VcfFileName) - 3, ".gz") == 0);
+	ShowMetaInfo(&hdr);
+	if (bBCFFormat)
+	{
+		// the records are encoded as bcf1_t by the threads and compressed by the BGZF threads of the writer
+		BcfHdr = bcf_hdr_init("r");
+		if (bcf_hdr_parse(BcfHdr, hdr.s) != 0 || (bGVCF && bcf_hdr_append(BcfHdr, "##INFO=<ID=MIN_DP,Number=1,Type=Integer,Description=\"Minimum depth in gVCF output block.\">") != 0)) w.bOK = false;
+		else if ((w.BcfFile = hts_open(VcfFileName, "wb")) == NULL) w.bOK = false;
+		else
 		{
-			VarNumVec[var_INV]++;
-			fprintf(outFile, "%s	%d	.	%c	<INV>	30	BreakPoint	TYPE=BP	GT:GQ:DP:AD	.:.:0:.\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos]);
+			bcf_hdr_sync(BcfHdr); InitBcfTagID();
+			if (iThreadNum > 1) hts_set_threads(w.BcfFile, iThreadNum);
+			if (bcf_hdr_write(w.BcfFile, BcfHdr) != 0) w.bOK = false;
 		}
-		else if (VariantVec[i].VarType == var_CNV)
+	}
+	else if (bVcfBgzf)
+	{
+		w.outFile = fopen(VcfFileName, "w");
+		if (!CompressBgzfBlocks(&hdr, &hdr_bgzf, HdrBlockOffsetVec)) w.bOK = false;
+		else
 		{
-			//gPosEnd = ChromosomeVec[coor.ChromosomeIdx].FowardLocation + ChromosomeVec[coor.ChromosomeIdx].len - 1;
-			if (VariantVec[i].DP >= MinCNVsize) fprintf(outFile, "%s	%d	.	%c	<*>	0	DUP	END=%d	GT:GQ:DP:AD	.:.:0:.\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos], (int)(coor.gPos + VariantVec[i].DP - 1));
+			fwrite(hdr_bgzf.s, 1, hdr_bgzf.l, w.outFile); w.FileOffset = (int64_t)hdr_bgzf.l;
+			w.idx = InitVcfIndex(GetBgzfVirtualOffset(0, HdrBlockOffsetVec, (int64_t)hdr.l), w.fmt);
 		}
-		else if (VariantVec[i].VarType == var_UMR)
+	}
+	else w.outFile = fopen(VcfFileName, "w"), fwrite(hdr.s, 1, hdr.l, w.outFile);
+	free(hdr.s); free(hdr_bgzf.s);
+
+	w.ThreadArr = new pthread_t[iThreadNum]; w.BatchArr = new VcfBatch_t[iThreadNum];
+	for (i = 0; i < iThreadNum; i++) w.BatchArr[i].text.l = w.BatchArr[i].text.m = 0, w.BatchArr[i].text.s = NULL, w.BatchArr[i].bgzf.l = w.BatchArr[i].bgzf.m = 0, w.BatchArr[i].bgzf.s = NULL;
+}
+
+static void GenVariantCallingFile(int VarBeg, int VarEnd, int BlockEnd)
+{
+	// writes VariantVec[VarBeg, VarEnd) and GVCFBlockVec[0, BlockEnd); the records around them are only read
+	int i, j, k, b, BatchNum;
+	VcfWriter_t& w = VcfWriter;
+	pthread_t *ThreadArr = w.ThreadArr;
+	VcfBatch_t *BatchArr = w.BatchArr;
+
+	// records are formatted (and compressed) in parallel by VcfBatchSize and written in order
+	for (i = VarBeg, b = 0; w.bOK && (i < VarEnd || b < BlockEnd);)
+	{
+		for (BatchNum = 0; BatchNum < iThreadNum && (i < VarEnd || b < BlockEnd); BatchNum++)
 		{
-			if(VariantVec[i].DP >= MinUnmappedSize) fprintf(outFile, "%s	%d	.	%c	<*>	0	Gaps	END=%d	GT:GQ:DP:AD	.:.:0:.\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos], (int)(coor.gPos + VariantVec[i].DP - 1));
+			BatchArr[BatchNum].beg = i; BatchArr[BatchNum].end = i = min(VarEnd, i + VcfBatchSize);
+			BatchArr[BatchNum].BlockBeg = b; BatchArr[BatchNum].BlockEnd = b = (i < VarEnd ? (int)(lower_bound(GVCFBlockVec.begin(), GVCFBlockVec.end(), VariantVec[i].gPos, CompByBlockPos) - GVCFBlockVec.begin()) : BlockEnd);
+			pthread_create(&ThreadArr[BatchNum], NULL, FormatVcfBatch, &BatchArr[BatchNum]);
 		}
-		else if (VariantVec[i].VarType == var_NOR)
+		for (j = 0; j < BatchNum; j++) pthread_join(ThreadArr[j], NULL);
+
+		for (j = 0; w.bOK && j < BatchNum; j++)
 		{
-			gPosEnd = ChromosomeVec[coor.ChromosomeIdx].FowardLocation + ChromosomeVec[coor.ChromosomeIdx].len - 1;
-			if (i + 1 < iTotalVarNum && VariantVec[i + 1].gPos < gPosEnd) gPosEnd = VariantVec[i + 1].gPos - 1;
-			fprintf(outFile, "%s	%d	.	%c	<*>	0	REF	END=%d;DP=%d;MIN_DP=%d	GT:GQ:DP:AD	.:.:0:.\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos], (int)DetermineCoordinate(gPosEnd).gPos, VariantVec[i].DP, VariantVec[i].AD_alt);
+			VcfBatch_t& batch = BatchArr[j];
+
+			for (k = 0; k <= var_TNL; k++) VarNumVec[k] += batch.VarNum[k];
+			if (bBCFFormat)
+			{
+				for (k = 0; w.bOK && k < batch.BcfRecNum; k++) if (bcf_write(w.BcfFile, BcfHdr, batch.BcfRecVec[k]) != 0) w.bOK = false;
+			}
+			else if (!bVcfBgzf) fwrite(batch.text.s, 1, batch.text.l, w.outFile);
+			else if (!batch.bOK) w.bOK = false;
+			else
+			{
+				for (vector<VcfRecordSpan_t>::iterator iter = batch.SpanVec.begin(); iter != batch.SpanVec.end(); iter++)
+				{
+					if (hts_idx_push(w.idx, iter->tid, iter->beg, iter->end, GetBgzfVirtualOffset(w.FileOffset, batch.BlockOffsetVec, iter->TextEnd), 1) < 0) w.bOK = false;
+				}
+				fwrite(batch.bgzf.s, 1, batch.bgzf.l, w.outFile); w.FileOffset += (int64_t)batch.bgzf.l;
+			}
 		}
-		else if (VariantVec[i].VarType == var_MON)
+	}
+}
+
+static void CloseVariantCallingFile()
+{
+	int i;
+	VcfWriter_t& w = VcfWriter;
+
+	if (bVcfBgzf)
+	{
+		fwrite(BgzfEOFBlock, 1, 28, w.outFile);
+		if (w.bOK)
 		{
-			fprintf(outFile, "%s	%d	.	%c	.	0	REF	DP=%d;RC=%d;NTFREQ=%d,%d,%d,%d	GT:F1R2:F2R1	%s:%d,%d:%d,%d\n", ChromosomeVec[coor.ChromosomeIdx].name, (int)coor.gPos, RefSequence[gPos], VariantVec[i].DP, (int)MappingRecordArr[gPos].readCount, (int)MappingRecordArr[gPos].A, (int)MappingRecordArr[gPos].C, (int)MappingRecordArr[gPos].G, (int)MappingRecordArr[gPos].T, GenotypeLabel[VariantVec[i].GenoType], MappingRecordArr[gPos].F1, MappingRecordArr[gPos].R2, MappingRecordArr[gPos].F2, MappingRecordArr[gPos].R1);
+			hts_idx_finish(w.idx, (uint64_t)w.FileOffset << 16); SetVcfIndexMeta(w.idx);
+			if (hts_idx_save_as(w.idx, VcfFileName, NULL, w.fmt) != 0) w.bOK = false;
 		}
+		if (w.idx != NULL) hts_idx_destroy(w.idx);
+		if (!w.bOK) fprintf(stderr, "Warning: failed to write the bgzip-compressed VCF file or its index [%s]\n", VcfFileName);
+	}
+	if (bBCFFormat)
+	{
+		if (w.BcfFile != NULL && hts_close(w.BcfFile) != 0) w.bOK = false;
+		if (!w.bOK) fprintf(stderr, "Warning: failed to write the BCF file [%s]\n", VcfFileName);
+		bcf_hdr_destroy(BcfHdr);
+	}
+	else std::fclose(w.outFile);
+
+	for (i = 0; i < iThreadNum; i++)
+	{
+		free(w.BatchArr[i].text.s), free(w.BatchArr[i].bgzf.s);
+		for (vector<bcf1_t*>::iterator iter = w.BatchArr[i].BcfRecVec.begin(); iter != w.BatchArr[i].BcfRecVec.end(); iter++) bcf_destroy(*iter);
 	}
-	std::fclose(outFile);
+	delete[] w.BatchArr; delete[] w.ThreadArr;
 }
 
 bool CheckNeighboringCoverage(int64_t gPos, int cov)
@@ -506,7 +1100,7 @@ bool CheckNeighboringCoverage(int64_t gPos, int cov)
 	for (p = -5; p <= 5; p++)
 	{
 		if (p == 0) continue;
-		c = GetProfileColumnSize(MappingRecordArr[gPos + p]);
+		c = GetProfileColumnSize(GetProfileColumn(gPos + p));
 		diff += abs(cov - c);
 	}
 	diff /= 10;
@@ -514,14 +1108,14 @@ bool CheckNeighboringCoverage(int64_t gPos, int cov)
 	else return true;
 }
 
-uint16_t GetRefCount(unsigned char ref_base, int64_t gPos)
+uint32_t GetRefCount(unsigned char ref_base, int64_t gPos)
 {
 	switch (ref_base)
 	{
-	case 0: return (uint16_t)MappingRecordArr[gPos].A;
-	case 1: return (uint16_t)MappingRecordArr[gPos].C;
-	case 2: return (uint16_t)MappingRecordArr[gPos].G;
-	case 3: return (uint16_t)MappingRecordArr[gPos].T;
+	case 0: return GetProfileColumn(gPos).A;
+	case 1: return GetProfileColumn(gPos).C;
+	case 2: return GetProfileColumn(gPos).G;
+	case 3: return GetProfileColumn(gPos).T;
 	default: return 0;
 	}
 }
@@ -547,37 +1141,190 @@ uint8_t DetermineGenotype(int cov, int alt_read_count, int alt_num)
 	return genotype;
 }
 
-void *IdentifyVariants(void *arg)
+static int64_t GetChromosomeEnd(int64_t gPos)
+{
+	// the start of the next chromosome
+	int i = DetermineCoordinate(gPos).ChromosomeIdx;
+	return i + 1 < iChromsomeNum ? ChromosomeVec[i + 1].FowardLocation : GenomeSize;
+}
+
+static void LoadCallingWindow(int64_t gPos)
+{
+	// loads a checkpoint ('call', 'merge') up to gPos and as far beyond as the calling reads: the coverage windows and the discordant
+	// pairs of a breakpoint (FragmentSize), the filter context and the depth blocks around them; a mapping run holds the whole profile
+	int64_t end = LoadProfileCheckpointBlocks(gPos + FragmentSize + FilterContextSize + 2 * BlockSize);
+
+	if (end == LoadedEnd) return;
+	LoadedEnd = end;
+	SummarizeProfile(end < GenomeSize ? GetProfileBound(end) : ProfileSize);
+	IdentifyBreakPointCandidates(end < GenomeSize ? end : TwoGenomeSize);
+}
+
+static int64_t GetVarScanCut(int64_t gPos)
 {
-	bool bNormal;
+	// moves a chunk boundary to just after a covered column, where no gap or dup run is open
+	int64_t p;
+
+	if (gPos <= 0) return 0;
+	for (p = gPos - 1; p < GenomeSize;)
+	{
+		if (p >= LoadedEnd) LoadCallingWindow(p);
+		else if ((p = SkipEmptyProfilePages(p, LoadedEnd)) < LoadedEnd && GetProfileColumnSize(GetProfileColumn(p++)) > 0) return p;
+	}
+	return GenomeSize;
+}
+
+static int64_t GetCallingSliceEnd(int64_t beg)
+{
+	// a calling slice holds whole chromosomes: one that reaches CallingSliceSize, or several smaller ones
+	int i;
+
+	for (i = 1; i < iChromsomeNum; i++) if (ChromosomeVec[i].FowardLocation > beg && ChromosomeVec[i].FowardLocation - beg >= CallingSliceSize) break;
+	if (i == iChromsomeNum) return GenomeSize;
+
+	// it ends where the scan chunks of a whole-genome scan break
+	return TargetRegionVec.size() > 0 ? ChromosomeVec[i].FowardLocation : GetVarScanCut(ChromosomeVec[i].FowardLocation);
+}
+
+static void PartitionVarScan(int64_t beg, int64_t end)
+{
+	// chunks of ScanChunkBlocks blocks of the slice [beg, end) that also break at chromosome starts; with -regions only the target regions are covered
+	int i;
+	int64_t gPos, ChunkSize = (int64_t)ScanChunkBlocks * BlockSize;
+	vector<int64_t> CutVec;
+	VarScanChunk_t chunk;
+	vector<pair<int64_t, int64_t> >::iterator iter;
+
+	VarScanChunkVec.clear(); chunk.bLeadingNOR = chunk.bTrailingNOR = false; NextVarScanChunk = 0;
+	if (TargetRegionVec.size() > 0)
+	{
+		for (iter = lower_bound(TargetRegionVec.begin(), TargetRegionVec.end(), make_pair(beg, (int64_t)0)); iter != TargetRegionVec.end() && iter->first < end; iter++)
+		{
+			for (chunk.beg = iter->first; chunk.beg < iter->second; chunk.beg = chunk.end)
+			{
+				if ((chunk.end = chunk.beg + ChunkSize) >= iter->second || (chunk.end = GetVarScanCut(chunk.end)) > iter->second) chunk.end = iter->second;
+				VarScanChunkVec.push_back(chunk);
+			}
+		}
+		return;
+	}
+	for (CutVec.push_back(beg), gPos = (beg / ChunkSize + 1) * ChunkSize; gPos < end; gPos += ChunkSize) CutVec.push_back(gPos);
+	for (i = 1; i < iChromsomeNum; i++) if (ChromosomeVec[i].FowardLocation > beg && ChromosomeVec[i].FowardLocation < end) CutVec.push_back(ChromosomeVec[i].FowardLocation);
+	sort(CutVec.begin(), CutVec.end()); CutVec.push_back(end);
+
+	for (chunk.beg = beg, i = 1; i < (int)CutVec.size(); i++)
+	{
+		if ((chunk.end = (i + 1 < (int)CutVec.size() ? min(GetVarScanCut(CutVec[i]), end) : end)) <= chunk.beg) continue;
+		VarScanChunkVec.push_back(chunk); chunk.beg = chunk.end;
+	}
+}
+
+// gVCF blocks are split where the depth crosses a -gvcf_dp_bands boundary
+static inline int GetDepthBand(int cov)
+{
+	return GVCFDepthBandVec.size() == 0 ? 0 : (int)(upper_bound(GVCFDepthBandVec.begin(), GVCFDepthBandVec.end(), cov) - GVCFDepthBandVec.begin());
+}
+
+static inline void UpdateCoverageRuns(int64_t gPos, int cov, bool bMultiHit, int& gap, int& dup, bool& bNormal, vector<Variant_t>& MyVariantVec)
+{
+	// extends or closes the unmapped (gap) and multi-hit only (dup) runs at gPos
+	Variant_t Variant;
+
+	if (cov == 0 && !bMultiHit) bNormal = false, gap++;
+	else if (gap > 0)
+	{
+		if (gap >= MinUnmappedSize)
+		{
+			Variant.VarType = var_UMR; 	Variant.gPos = gPos - gap; Variant.DP = gap;
+			MyVariantVec.push_back(Variant);
+		}
+		gap = 0;
+	}
+	if (cov == 0 && bMultiHit) bNormal = false, dup++;
+	else if (dup > 0)
+	{
+		if (dup > MinCNVsize)
+		{
+			Variant.VarType = var_CNV; Variant.gPos = gPos - dup; Variant.DP = dup;
+			MyVariantVec.push_back(Variant);
+		}
+		dup = 0;
+	}
+}
+
+static void IdentifyChunkVariants(VarScanChunk_t& chunk)
+{
+	bool bNormal, bCandidateScan;
 	Variant_t Variant;
-	int64_t gPos, end;
+	int64_t gPos, end, next, SegBeg, SegEnd;
 	unsigned char ref_base;
 	string ins_str, del_str;
 	vector<pair<char, int> > vec;
-	vector<Variant_t> MyVariantVec;
-	map<int64_t, map<string, uint16_t> >::iterator IndMapIter;
-	int n, gap, dup, cov, cov_thr, freq_thr, ins_thr, del_thr, ins_freq, del_freq, tid = *((int*)arg);
-
-	gPos = (tid == 0 ? 0 : (GenomeSize / iThreadNum)*tid);
-	end = (tid == iThreadNum - 1 ? GenomeSize : (GenomeSize / iThreadNum)*(tid + 1));
-
+	vector<Variant_t>& MyVariantVec = chunk.VarVec;
+	vector<GVCFBlock_t>& BlockVec = chunk.BlockVec;
+	size_t OpenBlockVarNum = 0; // number of variants reported when the last block was opened
+	int64_t BlockChrEnd = 0; // the chromosome end of the last block
+	GVCFBlock_t block;
+	MappingRecord_t Profile;
+	int n, gap, dup, cov, cov_thr, freq_thr, ins_thr, del_thr, ins_freq, del_freq;
+	vector<IndEvent_t>::iterator InsIter, DelIter;
+	int* CovArr = NULL;
+	uint8_t* FlagArr = NULL;
+
+	// a chunk starts right after a covered column, so gap and dup start from zero as in a whole-genome scan
+	gPos = chunk.beg; end = chunk.end;
 	gap = dup = 0;
+
+	// without gVCF blocks or monomorphic sites only candidate columns (a non-reference base reaching MinAlleleDepth or an indel event)
+	// need the full model; the others only extend the gap/dup runs
+	if ((bCandidateScan = !bGVCF && !bMonomorphic))
+	{
+		CovArr = new int[ScanChunkBlocks * BlockSize]; FlagArr = new uint8_t[ScanChunkBlocks * BlockSize];
+		InsIter = lower_bound(InsertEventVec.begin(), InsertEventVec.end(), gPos, CompByIndEventPos);
+		DelIter = lower_bound(DeleteEventVec.begin(), DeleteEventVec.end(), gPos, CompByIndEventPos);
+	}
+	SegBeg = SegEnd = gPos;
 	for (; gPos < end; gPos++)
 	{
-		cov = GetProfileColumnSize(MappingRecordArr[gPos]);
+		// untouched profile pages without nearby indels are one unmapped run
+		if ((next = SkipEmptyProfilePages(gPos, end)) > gPos && !CheckIndEventRange(InsertEventVec, gPos - 5, next + 5) && !CheckIndEventRange(DeleteEventVec, gPos - 5, next + 5))
+		{
+			if (dup > MinCNVsize)
+			{
+				Variant.VarType = var_CNV; Variant.gPos = gPos - dup; Variant.DP = dup;
+				MyVariantVec.push_back(Variant);
+			}
+			dup = 0; gap += (int)(next - gPos); gPos = next - 1;
+			continue;
+		}
+		if (bCandidateScan)
+		{
+			if (gPos >= SegEnd)
+			{
+				SegBeg = gPos; if ((SegEnd = gPos + ScanChunkBlocks * BlockSize) > end) SegEnd = end;
+				GetProfileCandidates(SegBeg, (int)(SegEnd - SegBeg), MinAlleleDepth, CovArr, FlagArr);
+			}
+			while (InsIter != InsertEventVec.end() && InsIter->gPos < gPos) InsIter++;
+			while (DelIter != DeleteEventVec.end() && DelIter->gPos < gPos) DelIter++;
+			if ((FlagArr[gPos - SegBeg] & CandAltAllele) == 0 && (InsIter == InsertEventVec.end() || InsIter->gPos != gPos) && (DelIter == DeleteEventVec.end() || DelIter->gPos != gPos))
+			{
+				UpdateCoverageRuns(gPos, CovArr[gPos - SegBeg], (FlagArr[gPos - SegBeg] & CandMultiHit) != 0, gap, dup, bNormal, MyVariantVec);
+				continue;
+			}
+		}
+		Profile = GetProfileColumn(gPos); cov = GetProfileColumnSize(Profile);
 		bNormal = true; ref_base = nst_nt4_table[(unsigned short)RefSequence[gPos]];
-		//if (bSomatic && (MappingRecordArr[gPos].multi_hit > (int)(cov*0.05))) continue;
-		if ((cov_thr = BlockDepthArr[(int)(gPos / BlockSize)] >> 1) < MinAlleleDepth) cov_thr = MinAlleleDepth;
+		//if (bSomatic && (Profile.multi_hit > (int)(cov*0.05))) continue;
+		if ((cov_thr = GetBlockDepth(gPos) >> 1) < MinAlleleDepth) cov_thr = MinAlleleDepth;
 		if (bSomatic && cov_thr > MinAlleleDepth) cov_thr = MinAlleleDepth;
 
 		if ((ins_thr = (int)(cov_thr*0.25)) < MinAlleleDepth) ins_thr = MinAlleleDepth;
 		if ((del_thr = (int)(cov_thr*0.35)) < MinAlleleDepth) del_thr = MinAlleleDepth;
-		ins_freq = GetAreaIndFrequency(gPos, InsertSeqMap, ins_str); del_freq = GetAreaIndFrequency(gPos, DeleteSeqMap, del_str);
+		ins_freq = GetAreaIndFrequency(gPos, InsertEventVec, false, ins_str); del_freq = GetAreaIndFrequency(gPos, DeleteEventVec, true, del_str);
 
 		if (ins_freq >= ins_thr)
 		{
-			Variant.gPos = gPos; Variant.VarType = var_INS; Variant.DP = BlockDepthArr[(int)(gPos / BlockSize)]; Variant.AD_alt = ins_freq;
+			Variant.gPos = gPos; Variant.VarType = var_INS; Variant.DP = GetBlockDepth(gPos); Variant.AD_alt = ins_freq;
 			if (Variant.DP < Variant.AD_alt) Variant.DP = Variant.AD_alt; Variant.ALTstr = ins_str;
 			Variant.AD_ref = Variant.DP - Variant.AD_alt; Variant.GenoType = DetermineGenotype(Variant.DP, Variant.AD_alt, 1);
 			Variant.qscore = (int)(100.0*Variant.AD_alt / cov);
@@ -587,7 +1334,7 @@ void *IdentifyVariants(void *arg)
 		}
 		if (del_freq >= del_thr)
 		{
-			Variant.gPos = gPos; Variant.VarType = var_DEL; Variant.DP = BlockDepthArr[(int)(gPos / BlockSize)]; Variant.AD_alt = del_freq;
+			Variant.gPos = gPos; Variant.VarType = var_DEL; Variant.DP = GetBlockDepth(gPos); Variant.AD_alt = del_freq;
 			if (Variant.DP < Variant.AD_alt) Variant.DP = Variant.AD_alt; Variant.ALTstr = del_str; Variant.ALTstr.resize((n = (int)del_str.length())); //strncpy((char*)Variant.ALTstr.c_str(), RefSequence + gPos + 1, n);
 			Variant.AD_ref = Variant.DP - Variant.AD_alt; Variant.GenoType = DetermineGenotype(Variant.DP, Variant.AD_alt, 1);
 			Variant.qscore = (int)(100.0*Variant.AD_alt / cov);
@@ -602,15 +1349,15 @@ void *IdentifyVariants(void *arg)
 
 			if (freq_thr < MinAlleleDepth) freq_thr = MinAlleleDepth;
 
-			if (ref_base != 0 && (int)MappingRecordArr[gPos].A >= freq_thr) vec.push_back(make_pair('A', (int)MappingRecordArr[gPos].A));
-			if (ref_base != 1 && (int)MappingRecordArr[gPos].C >= freq_thr) vec.push_back(make_pair('C', (int)MappingRecordArr[gPos].C));
-			if (ref_base != 2 && (int)MappingRecordArr[gPos].G >= freq_thr) vec.push_back(make_pair('G', (int)MappingRecordArr[gPos].G));
-			if (ref_base != 3 && (int)MappingRecordArr[gPos].T >= freq_thr) vec.push_back(make_pair('T', (int)MappingRecordArr[gPos].T));
+			if (ref_base != 0 && (int)Profile.A >= freq_thr) vec.push_back(make_pair('A', (int)Profile.A));
+			if (ref_base != 1 && (int)Profile.C >= freq_thr) vec.push_back(make_pair('C', (int)Profile.C));
+			if (ref_base != 2 && (int)Profile.G >= freq_thr) vec.push_back(make_pair('G', (int)Profile.G));
+			if (ref_base != 3 && (int)Profile.T >= freq_thr) vec.push_back(make_pair('T', (int)Profile.T));
 			
 			Variant.AD_ref = GetRefCount(ref_base, gPos);
 			if (vec.size() == 1)
 			{
-				Variant.gPos = gPos; Variant.VarType = var_SUB; Variant.DP = (uint16_t)cov; Variant.AD_alt = (uint16_t)vec[0].second;
+				Variant.gPos = gPos; Variant.VarType = var_SUB; Variant.DP = (uint32_t)cov; Variant.AD_alt = (uint32_t)vec[0].second;
 				if ((Variant.GenoType = DetermineGenotype(cov, Variant.AD_alt, 1)) != 0)
 				{
 					Variant.ALTstr = vec[0].first; //Variant.qscore = (int)(30.0*Variant.AD_alt / cov);
@@ -620,7 +1367,7 @@ void *IdentifyVariants(void *arg)
 			}
 			else if (vec.size() ==  2 && CheckDiploidFrequency(cov, vec))
 			{
-				Variant.gPos = gPos; Variant.VarType = var_SUB; Variant.GenoType = 1; Variant.DP = (uint16_t)cov; Variant.AD_alt = (uint16_t)(vec[0].second + vec[1].second);
+				Variant.gPos = gPos; Variant.VarType = var_SUB; Variant.GenoType = 1; Variant.DP = (uint32_t)cov; Variant.AD_alt = (uint32_t)(vec[0].second + vec[1].second);
 				if ((Variant.GenoType = DetermineGenotype(cov, Variant.AD_alt, 2)) != 0)
 				{
 					Variant.ALTstr.resize(3); Variant.ALTstr[0] = vec[0].first; Variant.ALTstr[1] = ',';  Variant.ALTstr[2] = vec[1].first;
@@ -629,36 +1376,19 @@ void *IdentifyVariants(void *arg)
 				}
 			}
 		}
-		if (cov == 0 && MappingRecordArr[gPos].multi_hit == 0) bNormal=false, gap++;
-		else if(gap > 0)
-		{
-			if (gap >= MinUnmappedSize)
-			{
-				Variant.VarType = var_UMR; 	Variant.gPos = gPos - gap; Variant.DP = gap;
-				MyVariantVec.push_back(Variant);
-			}
-			gap = 0;
-		}
-		if (cov == 0 && MappingRecordArr[gPos].multi_hit > 0) bNormal = false, dup++;
-		else if (dup > 0)
-		{
-			if (dup > MinCNVsize)
-			{
-				Variant.VarType = var_CNV; Variant.gPos = gPos - dup; Variant.DP = dup;
-				MyVariantVec.push_back(Variant);
-			}
-			dup = 0; 
-		}
+		UpdateCoverageRuns(gPos, cov, Profile.multi_hit > 0, gap, dup, bNormal, MyVariantVec);
 		if (bGVCF && bNormal && cov > 0)
 		{
-			if (MyVariantVec.size() == 0 || MyVariantVec.rbegin()->VarType != var_NOR)
+			// the open block is extended until a variant is reported, the depth leaves its band or a chromosome starts
+			if (BlockVec.size() > 0 && OpenBlockVarNum == MyVariantVec.size() && gPos < BlockChrEnd && GetDepthBand(cov) == GetDepthBand((int)BlockVec.rbegin()->DP))
 			{
-				Variant.qscore = 0; Variant.gPos = gPos; Variant.VarType = var_NOR; Variant.DP = Variant.AD_alt = cov; Variant.ALTstr.clear();
-				MyVariantVec.push_back(Variant);
+				if ((int)BlockVec.rbegin()->MinDP > cov) BlockVec.rbegin()->MinDP = (uint32_t)cov;
 			}
 			else
 			{
-				if (MyVariantVec.rbegin()->AD_alt > cov) MyVariantVec.rbegin()->AD_alt = (uint16_t)cov;
+				if (BlockVec.size() == 0 && MyVariantVec.size() == 0) chunk.bLeadingNOR = true;
+				block.gPos = gPos; block.DP = block.MinDP = (uint32_t)cov;
+				BlockVec.push_back(block); OpenBlockVarNum = MyVariantVec.size(); BlockChrEnd = GetChromosomeEnd(gPos);
 			}
 		}
 		if (bMonomorphic && bNormal && cov > 0)
@@ -669,34 +1399,84 @@ void *IdentifyVariants(void *arg)
 		}
 		//printf("%lld: cov=%d, cnv=%d, umr=%d\n", gPos, cov, dup, gap); ShowProfileColumn(gPos);
 	}
-	if ((n = (int)MyVariantVec.size()) > 0)
+	if (bCandidateScan)
 	{
-		sort(MyVariantVec.begin(), MyVariantVec.end(), CompByVarPos);
-		pthread_mutex_lock(&VarLock);
-		copy(MyVariantVec.begin(), MyVariantVec.end(), back_inserter(VariantVec)); inplace_merge(VariantVec.begin(), VariantVec.end() - n, VariantVec.end(), CompByVarPos);
-		pthread_mutex_unlock(&VarLock);
+		delete[] CovArr; delete[] FlagArr;
+	}
+	// a gVCF block may continue from the previous chunk (leading) or into the next one (trailing)
+	chunk.bTrailingNOR = BlockVec.size() > 0 && OpenBlockVarNum == MyVariantVec.size();
+	if (MyVariantVec.size() > 0) sort(MyVariantVec.begin(), MyVariantVec.end(), CompByVarPos);
+}
+
+void *IdentifyVariants(void *arg)
+{
+	int idx;
+
+	while (true)
+	{
+		pthread_mutex_lock(&VarLock); idx = NextVarScanChunk++; pthread_mutex_unlock(&VarLock);
+		if (idx >= (int)VarScanChunkVec.size()) break;
+		IdentifyChunkVariants(VarScanChunkVec[idx]);
 	}
 	return (void*)(1);
 }
 
-void RemoveConsecutiveGenomicVariant()
+static void StitchVarScanChunks()
 {
-	vector<Variant_t>::iterator iter, next_iter;
+	// concatenates the chunk results in genome order; a leading gVCF block joins the block left open by the previous chunks (or slices)
+	vector<GVCFBlock_t>::iterator BlockIter;
+	vector<VarScanChunk_t>::iterator iter;
 
-	for (iter = VariantVec.begin(), next_iter = iter + 1; next_iter != VariantVec.end(); iter++, next_iter++)
+	for (iter = VarScanChunkVec.begin(); iter != VarScanChunkVec.end(); iter++)
 	{
-		if (iter->VarType == var_NOR && next_iter->VarType == var_NOR)
+		// chunks of different target regions are not contiguous
+		if (iter->beg != StitchedEnd) bOpenNOR = false;
+		StitchedEnd = iter->end;
+		if (iter->VarVec.size() == 0 && iter->BlockVec.size() == 0) continue;
+
+		BlockIter = iter->BlockVec.begin();
+		if (bOpenNOR && iter->bLeadingNOR && BlockIter->gPos < GetChromosomeEnd(GVCFBlockVec.rbegin()->gPos) && GetDepthBand((int)BlockIter->DP) == GetDepthBand((int)GVCFBlockVec.rbegin()->DP))
 		{
-			iter = VariantVec.erase(next_iter);
-			next_iter = iter + 1;
+			if (GVCFBlockVec.rbegin()->MinDP > BlockIter->MinDP) GVCFBlockVec.rbegin()->MinDP = BlockIter->MinDP;
+			BlockIter++;
 		}
+		GVCFBlockVec.insert(GVCFBlockVec.end(), BlockIter, iter->BlockVec.end());
+		VariantVec.insert(VariantVec.end(), iter->VarVec.begin(), iter->VarVec.end());
+		bOpenNOR = iter->bTrailingNOR;
+
+		vector<Variant_t>().swap(iter->VarVec); vector<GVCFBlock_t>().swap(iter->BlockVec);
 	}
+	VarScanChunkVec.clear();
+}
+
+template <class T> static void DropLeadingEntries(vector<T>& vec, size_t n)
+{
+	// the vector is only copied once at least half of it has been called
+	if (n > 0 && 2 * n >= vec.size()) vector<T>(vec.begin() + n, vec.end()).swap(vec);
+}
+
+static void ReleaseCalledSlice(int64_t& ReleasedPos, int64_t end)
+{
+	// frees the profile pages, depth blocks and events before end, except the coverage windows the next slice still reads back
+	DiscordPair_t DiscordPair;
+
+	if ((end -= 2 * BlockSize) <= ReleasedPos) return;
+	ReleaseProfilePages(ReleasedPos, end); ReleasedPos = end;
+	if ((KeptDepthBlock = GetProfileBound(end) / BlockSize) > BlockNum) KeptDepthBlock = BlockNum;
+	DropLeadingEntries(BreakPointCanVec, GetBreakPointCanIdx(end));
+
+	DropLeadingEntries(InsertEventVec, lower_bound(InsertEventVec.begin(), InsertEventVec.end(), end, CompByIndEventPos) - InsertEventVec.begin());
+	DropLeadingEntries(DeleteEventVec, lower_bound(DeleteEventVec.begin(), DeleteEventVec.end(), end, CompByIndEventPos) - DeleteEventVec.begin());
+	DiscordPair.gPos = end;
+	DropLeadingEntries(InversionSiteVec, lower_bound(InversionSiteVec.begin(), InversionSiteVec.end(), DiscordPair, CompByDiscordPos) - InversionSiteVec.begin());
+	DropLeadingEntries(TranslocationSiteVec, lower_bound(TranslocationSiteVec.begin(), TranslocationSiteVec.end(), DiscordPair, CompByDiscordPos) - TranslocationSiteVec.begin());
 }
 
 void VariantCalling()
 {
 	FILE *log;
-	int i, *ThrIDarr;
+	int i, n, *ThrIDarr, VarBeg, VarEnd, BlockEnd;
+	int64_t beg, end, WriteEnd, ReleasedPos = 0;
 	time_t t = time(NULL);
 	pthread_t *ThreadArr = new pthread_t[iThreadNum];
 
@@ -706,28 +1486,48 @@ void VariantCalling()
 
 	//if (ObserveBegPos != -1) printf("Profile[%lld-%lld]\n", (long long)ObserveBegPos, (long long)ObserveEndPos), ShowVariationProfile(ObserveBegPos, ObserveEndPos);
 
-	BlockNum = (int)(GenomeSize / BlockSize); if (((int64_t)BlockNum * BlockSize) < GenomeSize) BlockNum += 1; 
-	BlockDepthArr = new int[BlockNum]();
-	for (i = 0; i < iThreadNum; i++) pthread_create(&ThreadArr[i], NULL, CalBlockReadDepth, &ThrIDarr[i]);
-	for (i = 0; i < iThreadNum; i++) pthread_join(ThreadArr[i], NULL);
-
 	fprintf(log, "Identify all variants (min_alt_allele_depth=%d)...\n", MinAlleleDepth); fflush(stderr);
 	fprintf(stderr, "Identify all variants (min_alt_allele_depth=%d)...\n", MinAlleleDepth); fflush(stderr);
+	fprintf(log, "\tWrite all the predicted sample variations to file [%s]...\n", VcfFileName); 
+	fprintf(stderr, "\tWrite all the predicted sample variations to file [%s]...\n", VcfFileName);
 
-	iThreadNum = 1;
-	for (i = 0; i < iThreadNum; i++) pthread_create(&ThreadArr[i], NULL, IdentifyVariants, &ThrIDarr[i]);
-	for (i = 0; i < iThreadNum; i++) pthread_join(ThreadArr[i], NULL);
-	if (bGVCF) RemoveConsecutiveGenomicVariant();
+	// the genome is called slice by slice: each slice is loaded (from a checkpoint), scanned, written and then released from the profile
+	OpenVariantCallingFile();
+	bOpenNOR = false; StitchedEnd = VarBeg = 0;
+	for (beg = 0; beg < GenomeSize; beg = end)
+	{
+		end = GetCallingSliceEnd(beg); LoadCallingWindow(end);
 
-	// Identify structural variants
-	IdentifyBreakPointCandidates();
-	if (BreakPointCanVec.size() > 0 && InversionSiteVec.size() > 0) IdentifyInversions();
-	if (BreakPointCanVec.size() > 0 && TranslocationSiteVec.size() > 0) IdentifyTranslocations();
+		PartitionVarScan(beg, end);
+		for (i = 0; i < iThreadNum; i++) pthread_create(&ThreadArr[i], NULL, IdentifyVariants, &ThrIDarr[i]);
+		for (i = 0; i < iThreadNum; i++) pthread_join(ThreadArr[i], NULL);
+		StitchVarScanChunks();
 
-	iTotalVarNum = (int)VariantVec.size();
-	fprintf(log, "\tWrite all the predicted sample variations to file [%s]...\n", VcfFileName); 
-	fprintf(stderr, "\tWrite all the predicted sample variations to file [%s]...\n", VcfFileName);
-	GenVariantCallingFile();
+		// Identify structural variants
+		if (BreakPointCanVec.size() > 0 && InversionSiteVec.size() > 0) IdentifyInversions(beg, end);
+		if (BreakPointCanVec.size() > 0 && TranslocationSiteVec.size() > 0) IdentifyTranslocations(beg, end);
+
+		// the records from WriteEnd on are written with the next slice, which may continue the last gVCF block
+		// and adds the variants the filters look at; the output does not depend on the slice size
+		if ((WriteEnd = end) < GenomeSize)
+		{
+			WriteEnd -= FilterContextSize;
+			if (GVCFBlockVec.size() > 0 && GVCFBlockVec.rbegin()->gPos < WriteEnd) WriteEnd = GVCFBlockVec.rbegin()->gPos;
+		}
+		iTotalVarNum = (int)VariantVec.size();
+		VarEnd = (int)(lower_bound(VariantVec.begin(), VariantVec.end(), WriteEnd, CompByVariantPos) - VariantVec.begin());
+		BlockEnd = (int)(lower_bound(GVCFBlockVec.begin(), GVCFBlockVec.end(), WriteEnd, CompByBlockPos) - GVCFBlockVec.begin());
+		GenVariantCallingFile(VarBeg, VarEnd, BlockEnd);
+
+		// the written variants within FilterContextSize of the deferred ones are kept for the filters
+		n = (int)(lower_bound(VariantVec.begin(), VariantVec.begin() + VarEnd, WriteEnd - FilterContextSize, CompByVariantPos) - VariantVec.begin());
+		VariantVec.erase(VariantVec.begin(), VariantVec.begin() + n); VarBeg = VarEnd - n;
+		GVCFBlockVec.erase(GVCFBlockVec.begin(), GVCFBlockVec.begin() + BlockEnd);
+
+		// the discordant pairs and coverage windows of the next slice's breakpoints reach FragmentSize back; deferred records read their profile columns
+		ReleaseCalledSlice(ReleasedPos, min(end - FragmentSize, WriteEnd));
+	}
+	CloseVariantCallingFile();
 	fprintf(log, "\t%d(snp); %d(ins); %d(del); %d(trans); %d(inversion)\n", VarNumVec[var_SUB], VarNumVec[var_INS], VarNumVec[var_DEL], VarNumVec[var_TNL] >> 1, VarNumVec[var_INV] >> 1);
 	fprintf(stderr, "\t%d(snp); %d(ins); %d(del); %d(trans); %d(inversion)\n", VarNumVec[var_SUB], VarNumVec[var_INS], VarNumVec[var_DEL], VarNumVec[var_TNL] >> 1, VarNumVec[var_INV] >> 1);
 
@@ -736,5 +1536,6 @@ void VariantCalling()
 
 	fclose(log);
 
-	delete[] ThrIDarr; delete[] ThreadArr; delete[] BlockDepthArr;
+	delete[] ThrIDarr; delete[] ThreadArr; delete[] BlockDepthArr; delete[] CovPrefixArr;
+	vector<Variant_t>().swap(VariantVec); vector<GVCFBlock_t>().swap(GVCFBlockVec);
 }
@@ -1,6 +1,7 @@
 #include "structure.h"
 #include <emmintrin.h>
 #include <smmintrin.h>
+#include <immintrin.h>
 
 //copyright: Heng Li
 
@@ -22,19 +23,19 @@ void ksw_reset_extz(ksw_extz_t *ez)
 	ez->max = 0, ez->score = ez->mqe = ez->mte = KSW_NEG_INF;
 }
 
-string ksw_backtrack(const uint8_t *p, const int *off, const int *off_end, int n_col, int i0, int j0)
+void ksw_backtrack(const uint8_t *p, const int *off, const int *off_end, int n_col, int i0, int j0, vector<uint32_t>& cigar)
 {
 	int i = i0, j = j0, r, state = 0;
 	uint32_t tmp;
-	string cigar;
 
+	cigar.clear();
 	while (i >= 0 && j >= 0) { // at the beginning of the loop, _state_ tells us which state to check
 		int force_state = -1;
 
 		r = i + j;
 		if (i < off[r]) force_state = 2;
 		if (off_end && i > off_end[r]) force_state = 1;
-		tmp = force_state < 0 ? p[r * n_col + i - off[r]] : 0;
+		tmp = force_state < 0 ? p[(size_t)r * n_col + i - off[r]] : 0;
 
 		if (state == 0) state = tmp & 7; // if requesting the H state, find state one maximizes it.
 		else if (!(tmp >> (state + 2) & 1)) state = 0; // if requesting other states, _state_ stays the same if it is a continuation; otherwise, set to H
@@ -42,34 +43,27 @@ string ksw_backtrack(const uint8_t *p, const int *off, const int *off_end, int n
 		if (force_state >= 0) state = force_state;
 		if (state == 0)
 		{
-			cigar.push_back('M');
+			PushCigarOp(cigar, CIGAR_M, 1);
 			--i, --j; // match
 		}
 		else if (state == 1 || state == 3)
 		{
-			cigar.push_back('D');
+			PushCigarOp(cigar, CIGAR_D, 1);
 			--i; // deletion
 		}
 		else
 		{
-			cigar.push_back('I');
+			PushCigarOp(cigar, CIGAR_I, 1);
 			--j; // insertion
 		}
 	}
-	if (i >= 0)
-	{
-		cigar.append(string().assign(i + 1, 'D'));
-	}
-	if (j >= 0)
-	{
-		cigar.append(string().assign(j + 1, 'I'));
-	}
-	return cigar;
+	if (i >= 0) PushCigarOp(cigar, CIGAR_D, i + 1);
+	if (j >= 0) PushCigarOp(cigar, CIGAR_I, j + 1);
+	reverse(cigar.begin(), cigar.end());
 }
 
-string ksw_extz2_sse(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, int8_t q, int8_t e, int w, ksw_extz_t *ez)
+void ksw_extz2_sse(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, int8_t q, int8_t e, int w, ksw_extz_t *ez, vector<uint32_t>& cigar)
 {
-	string cigar;
 
 #define __dp_code_block1 \
 	z = _mm_add_epi8(_mm_load_si128(&s[t]), qe2_); \
@@ -101,8 +95,8 @@ string ksw_extz2_sse(int qlen, const uint8_t *query, int tlen, const uint8_t *ta
 	__m128i q_, qe2_, zero_, flag1_, flag2_, flag8_, flag16_, sc_mch_, sc_mis_, m1_, max_sc_;
 	__m128i *u, *v, *x, *y, *s, *p = 0;
 
-	ksw_reset_extz(ez);
-	if (m <= 0 || qlen <= 0 || tlen <= 0) return cigar;
+	ksw_reset_extz(ez); cigar.clear();
+	if (m <= 0 || qlen <= 0 || tlen <= 0) return;
 
 	zero_ = _mm_set1_epi8(0);
 	q_ = _mm_set1_epi8(q);
@@ -125,7 +119,7 @@ string ksw_extz2_sse(int qlen, const uint8_t *query, int tlen, const uint8_t *ta
 	//	max_sc = max_sc > mat[t] ? max_sc : mat[t];
 	//	min_sc = min_sc < mat[t] ? min_sc : mat[t];
 	//}
-	//if (-min_sc > 2 * (q + e)) return cigar; // otherwise, we won't see any mismatches
+	//if (-min_sc > 2 * (q + e)) return; // otherwise, we won't see any mismatches
 
 	mem = (uint8_t*)calloc(tlen_ * 6 + qlen_ + 1, 16);
 	u = (__m128i*)(((size_t)mem + 15) >> 4 << 4); // 16-byte aligned
@@ -175,8 +169,8 @@ string ksw_extz2_sse(int qlen, const uint8_t *query, int tlen, const uint8_t *ta
 			_mm_storeu_si128((__m128i*)((uint8_t*)s + t), tmp);
 		}
 		// core loop
-		x1_ = _mm_cvtsi32_si128(x1);
-		v1_ = _mm_cvtsi32_si128(v1);
+		x1_ = _mm_cvtsi32_si128((uint8_t)x1);
+		v1_ = _mm_cvtsi32_si128((uint8_t)v1);
 		st_ = st / 16, en_ = en / 16;
 
 		__m128i *pr = p + r * n_col_ - st_;
@@ -240,33 +234,330 @@ string ksw_extz2_sse(int qlen, const uint8_t *query, int tlen, const uint8_t *ta
 
 		last_st = st, last_en = en;
 		}
-	cigar = ksw_backtrack((uint8_t*)p, off, off_end, n_col_ * 16, tlen - 1, qlen - 1);
-	//printf("cigar=%s\n", cigar.c_str());
+	ksw_backtrack((uint8_t*)p, off, off_end, n_col_ * 16, tlen - 1, qlen - 1, cigar);
+	free(mem); free(H); free(mem2); free(off);
+}
+
+__attribute__((target("avx2")))
+void ksw_extz2_avx2(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, int8_t q, int8_t e, int w, ksw_extz_t *ez, vector<uint32_t>& cigar)
+{
+	// same recurrence as ksw_extz2_sse() with 32 cells per vector
+	int r, t, qe = q + e, n_col_, *off = 0, *off_end = 0, tlen_, qlen_, last_st, last_en, wl, wr;
+	int32_t *H = 0;
+	uint8_t *qr, *sf, *mem, *mem2 = 0;
+	__m256i q_, qe2_, zero_, flag1_, flag2_, flag8_, flag16_, sc_mch_, sc_mis_, m1_, max_sc_;
+	__m256i *u, *v, *x, *y, *s, *p = 0;
+
+	ksw_reset_extz(ez); cigar.clear();
+	if (m <= 0 || qlen <= 0 || tlen <= 0) return;
+
+	zero_ = _mm256_set1_epi8(0);
+	q_ = _mm256_set1_epi8(q);
+	qe2_ = _mm256_set1_epi8((q + e) * 2);
+	flag1_ = _mm256_set1_epi8(1);
+	flag2_ = _mm256_set1_epi8(2);
+	flag8_ = _mm256_set1_epi8(0x08);
+	flag16_ = _mm256_set1_epi8(0x10);
+	sc_mch_ = _mm256_set1_epi8(mat[0]);
+	sc_mis_ = _mm256_set1_epi8(mat[1]);
+	m1_ = _mm256_set1_epi8(m - 1); // wildcard
+	max_sc_ = _mm256_set1_epi8(mat[0] + (q + e) * 2);
+
+	if (w < 0) w = tlen > qlen ? tlen : qlen;
+	wl = wr = w;
+	tlen_ = (tlen + 31) / 32;
+	n_col_ = ((w + 1 < tlen ? (w + 1 < qlen ? w + 1 : qlen) : tlen) + 31) / 32 + 1;
+	qlen_ = (qlen + 31) / 32;
+
+	mem = (uint8_t*)calloc(tlen_ * 6 + qlen_ + 1, 32);
+	u = (__m256i*)(((size_t)mem + 31) >> 5 << 5); // 32-byte aligned
+	v = u + tlen_, x = v + tlen_, y = x + tlen_, s = y + tlen_, sf = (uint8_t*)(s + tlen_), qr = sf + tlen_ * 32;
+
+	H = (int32_t*)malloc(tlen_ * 32 * 4);
+	for (t = 0; t < tlen_ * 32; ++t) H[t] = KSW_NEG_INF;
+
+	mem2 = (uint8_t*)malloc(((qlen + tlen - 1) * n_col_ + 1) * 32);
+	p = (__m256i*)(((size_t)mem2 + 31) >> 5 << 5);
+	off = (int*)malloc((qlen + tlen - 1) * sizeof(int) * 2);
+	off_end = off + qlen + tlen - 1;
+
+	for (t = 0; t < qlen; ++t) qr[t] = query[qlen - 1 - t];
+	memcpy(sf, target, tlen);
+
+	for (r = 0, last_st = last_en = -1; r < qlen + tlen - 1; ++r) {
+		int st = 0, en = tlen - 1, st0, en0, st_, en_;
+		int8_t x1, v1;
+		uint8_t *qrr = qr + (qlen - 1 - r), *u8 = (uint8_t*)u, *v8 = (uint8_t*)v;
+		__m256i x1_, v1_;
+		// find the boundaries
+		if (st < r - qlen + 1) st = r - qlen + 1;
+		if (en > r) en = r;
+		if (st < (r - wr + 1) >> 1) st = (r - wr + 1) >> 1; // take the ceil
+		if (en >(r + wl) >> 1) en = (r + wl) >> 1; // take the floor
+
+		st0 = st, en0 = en;
+		st = st / 32 * 32, en = (en + 32) / 32 * 32 - 1;
+		// set boundary conditions
+		if (st > 0) {
+			if (st - 1 >= last_st && st - 1 <= last_en)
+				x1 = ((uint8_t*)x)[st - 1], v1 = v8[st - 1]; // (r-1,s-1) calculated in the last round
+			else x1 = v1 = 0; // not calculated; set to zeros
+		}
+		else x1 = 0, v1 = r ? q : 0;
+		if (en >= r) ((uint8_t*)y)[r] = 0, u8[r] = r ? q : 0;
+		// loop fission: set scores first
+		for (t = st0; t <= en0; t += 32) {
+			__m256i sq, st, tmp, mask;
+			sq = _mm256_loadu_si256((__m256i*)&sf[t]);
+			st = _mm256_loadu_si256((__m256i*)&qrr[t]);
+			mask = _mm256_or_si256(_mm256_cmpeq_epi8(sq, m1_), _mm256_cmpeq_epi8(st, m1_));
+			tmp = _mm256_cmpeq_epi8(sq, st);
+			tmp = _mm256_blendv_epi8(sc_mis_, sc_mch_, tmp);
+			tmp = _mm256_andnot_si256(mask, tmp);
+			_mm256_storeu_si256((__m256i*)((uint8_t*)s + t), tmp);
+		}
+		// core loop
+		x1_ = _mm256_setr_epi32((uint8_t)x1, 0, 0, 0, 0, 0, 0, 0);
+		v1_ = _mm256_setr_epi32((uint8_t)v1, 0, 0, 0, 0, 0, 0, 0);
+		st_ = st / 32, en_ = en / 32;
+
+		__m256i *pr = p + r * n_col_ - st_;
+		off[r] = st, off_end[r] = en;
+		for (t = st_; t <= en_; ++t) {
+			__m256i d, z, a, b, xt1, vt1, ut, tmp;
+			z = _mm256_add_epi8(_mm256_load_si256(&s[t]), qe2_);
+			xt1 = _mm256_load_si256(&x[t]);                // xt1 <- x[r-1][t..t+31]
+			tmp = _mm256_srli_si256(_mm256_permute2x128_si256(xt1, xt1, 0x81), 15); // tmp <- x[r-1][t+31]
+			xt1 = _mm256_or_si256(_mm256_alignr_epi8(xt1, _mm256_permute2x128_si256(xt1, xt1, 0x08), 15), x1_); // xt1 <- x[r-1][t-1..t+30]
+			x1_ = tmp;
+			vt1 = _mm256_load_si256(&v[t]);                // vt1 <- v[r-1][t..t+31]
+			tmp = _mm256_srli_si256(_mm256_permute2x128_si256(vt1, vt1, 0x81), 15); // tmp <- v[r-1][t+31]
+			vt1 = _mm256_or_si256(_mm256_alignr_epi8(vt1, _mm256_permute2x128_si256(vt1, vt1, 0x08), 15), v1_); // vt1 <- v[r-1][t-1..t+30]
+			v1_ = tmp;
+			a = _mm256_add_epi8(xt1, vt1);
+			ut = _mm256_load_si256(&u[t]);
+			b = _mm256_add_epi8(_mm256_load_si256(&y[t]), ut);
+
+			d = _mm256_and_si256(_mm256_cmpgt_epi8(a, z), flag1_); // d = a > z? 1 : 0
+			z = _mm256_max_epi8(z, a);
+			tmp = _mm256_cmpgt_epi8(b, z);
+			d = _mm256_blendv_epi8(d, flag2_, tmp);        // d = b > z? 2 : d
+
+			z = _mm256_max_epu8(z, b);
+			z = _mm256_min_epu8(z, max_sc_);
+			_mm256_store_si256(&u[t], _mm256_sub_epi8(z, vt1));
+			_mm256_store_si256(&v[t], _mm256_sub_epi8(z, ut));
+			z = _mm256_sub_epi8(z, q_);
+			a = _mm256_sub_epi8(a, z);
+			b = _mm256_sub_epi8(b, z);
+
+			tmp = _mm256_cmpgt_epi8(a, zero_);
+			_mm256_store_si256(&x[t], _mm256_and_si256(tmp, a));
+			d = _mm256_or_si256(d, _mm256_and_si256(tmp, flag8_));  // d = a > 0? 0x08 : 0
+			tmp = _mm256_cmpgt_epi8(b, zero_);
+			_mm256_store_si256(&y[t], _mm256_and_si256(tmp, b));
+			d = _mm256_or_si256(d, _mm256_and_si256(tmp, flag16_)); // d = b > 0? 0x10 : 0
+			_mm256_store_si256(&pr[t], d);
+		}
+		// compute H[]
+		if (r > 0) {
+			H[en0] = en0 > 0 ? H[en0 - 1] + u8[en0] - qe : H[en0] + v8[en0] - qe; // special casing the last element
+			for (t = st0; t < en0; ++t) H[t] += (int32_t)v8[t] - qe;
+		}
+		else H[0] = v8[0] - qe - qe; // special casing r==0
+		// update ez
+		if (en0 == tlen - 1 && H[en0] > ez->mte)
+			ez->mte = H[en0], ez->mte_q = r - en;
+		if (r - st0 == qlen - 1 && H[st0] > ez->mqe)
+			ez->mqe = H[st0], ez->mqe_t = st0;
+		if (r == qlen + tlen - 2 && en0 == tlen - 1)
+			ez->score = H[tlen - 1];
+
+		last_st = st, last_en = en;
+	}
+	ksw_backtrack((uint8_t*)p, off, off_end, n_col_ * 32, tlen - 1, qlen - 1, cigar);
+	free(mem); free(H); free(mem2); free(off);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void ksw_extz2_avx512(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, int8_t q, int8_t e, int w, ksw_extz_t *ez, vector<uint32_t>& cigar)
+{
+	// same recurrence as ksw_extz2_sse() with 64 cells per vector; comparisons yield k-masks
+	int r, t, qe = q + e, n_col_, *off = 0, *off_end = 0, tlen_, qlen_, last_st, last_en, wl, wr;
+	int32_t *H = 0;
+	uint8_t *qr, *sf, *mem, *mem2 = 0;
+	__m512i q_, qe2_, zero_, flag1_, flag2_, flag8_, flag16_, sc_mch_, sc_mis_, m1_, max_sc_;
+	__m512i *u, *v, *x, *y, *s, *p = 0;
+
+	ksw_reset_extz(ez); cigar.clear();
+	if (m <= 0 || qlen <= 0 || tlen <= 0) return;
+
+	zero_ = _mm512_set1_epi8(0);
+	q_ = _mm512_set1_epi8(q);
+	qe2_ = _mm512_set1_epi8((q + e) * 2);
+	flag1_ = _mm512_set1_epi8(1);
+	flag2_ = _mm512_set1_epi8(2);
+	flag8_ = _mm512_set1_epi8(0x08);
+	flag16_ = _mm512_set1_epi8(0x10);
+	sc_mch_ = _mm512_set1_epi8(mat[0]);
+	sc_mis_ = _mm512_set1_epi8(mat[1]);
+	m1_ = _mm512_set1_epi8(m - 1); // wildcard
+	max_sc_ = _mm512_set1_epi8(mat[0] + (q + e) * 2);
+
+	if (w < 0) w = tlen > qlen ? tlen : qlen;
+	wl = wr = w;
+	tlen_ = (tlen + 63) / 64;
+	n_col_ = ((w + 1 < tlen ? (w + 1 < qlen ? w + 1 : qlen) : tlen) + 63) / 64 + 1;
+	qlen_ = (qlen + 63) / 64;
+
+	mem = (uint8_t*)calloc(tlen_ * 6 + qlen_ + 1, 64);
+	u = (__m512i*)(((size_t)mem + 63) >> 6 << 6); // 64-byte aligned
+	v = u + tlen_, x = v + tlen_, y = x + tlen_, s = y + tlen_, sf = (uint8_t*)(s + tlen_), qr = sf + tlen_ * 64;
+
+	H = (int32_t*)malloc(tlen_ * 64 * 4);
+	for (t = 0; t < tlen_ * 64; ++t) H[t] = KSW_NEG_INF;
+
+	mem2 = (uint8_t*)malloc(((qlen + tlen - 1) * n_col_ + 1) * 64);
+	p = (__m512i*)(((size_t)mem2 + 63) >> 6 << 6);
+	off = (int*)malloc((qlen + tlen - 1) * sizeof(int) * 2);
+	off_end = off + qlen + tlen - 1;
+
+	for (t = 0; t < qlen; ++t) qr[t] = query[qlen - 1 - t];
+	memcpy(sf, target, tlen);
+
+	for (r = 0, last_st = last_en = -1; r < qlen + tlen - 1; ++r) {
+		int st = 0, en = tlen - 1, st0, en0, st_, en_;
+		int8_t x1, v1;
+		uint8_t *qrr = qr + (qlen - 1 - r), *u8 = (uint8_t*)u, *v8 = (uint8_t*)v;
+		__m512i x1_, v1_;
+		// find the boundaries
+		if (st < r - qlen + 1) st = r - qlen + 1;
+		if (en > r) en = r;
+		if (st < (r - wr + 1) >> 1) st = (r - wr + 1) >> 1; // take the ceil
+		if (en >(r + wl) >> 1) en = (r + wl) >> 1; // take the floor
+
+		st0 = st, en0 = en;
+		st = st / 64 * 64, en = (en + 64) / 64 * 64 - 1;
+		// set boundary conditions
+		if (st > 0) {
+			if (st - 1 >= last_st && st - 1 <= last_en)
+				x1 = ((uint8_t*)x)[st - 1], v1 = v8[st - 1]; // (r-1,s-1) calculated in the last round
+			else x1 = v1 = 0; // not calculated; set to zeros
+		}
+		else x1 = 0, v1 = r ? q : 0;
+		if (en >= r) ((uint8_t*)y)[r] = 0, u8[r] = r ? q : 0;
+		// loop fission: set scores first
+		for (t = st0; t <= en0; t += 64) {
+			__m512i sq, st, tmp;
+			__mmask64 mask;
+			sq = _mm512_loadu_si512((void*)&sf[t]);
+			st = _mm512_loadu_si512((void*)&qrr[t]);
+			mask = _mm512_cmpeq_epi8_mask(sq, m1_) | _mm512_cmpeq_epi8_mask(st, m1_);
+			tmp = _mm512_mask_blend_epi8(_mm512_cmpeq_epi8_mask(sq, st), sc_mis_, sc_mch_);
+			tmp = _mm512_maskz_mov_epi8(~mask, tmp);
+			_mm512_storeu_si512((void*)((uint8_t*)s + t), tmp);
+		}
+		// core loop
+		x1_ = _mm512_maskz_set1_epi8(1, (uint8_t)x1);
+		v1_ = _mm512_maskz_set1_epi8(1, (uint8_t)v1);
+		st_ = st / 64, en_ = en / 64;
+
+		__m512i *pr = p + r * n_col_ - st_;
+		off[r] = st, off_end[r] = en;
+		for (t = st_; t <= en_; ++t) {
+			__m512i d, z, a, b, xt1, vt1, ut, tmp;
+			__mmask64 k;
+			z = _mm512_add_epi8(_mm512_load_si512(&s[t]), qe2_);
+			xt1 = _mm512_load_si512(&x[t]);                // xt1 <- x[r-1][t..t+63]
+			tmp = _mm512_bsrli_epi128(_mm512_maskz_alignr_epi64(0x01, xt1, xt1, 7), 7); // tmp <- x[r-1][t+63]
+			xt1 = _mm512_or_si512(_mm512_alignr_epi8(xt1, _mm512_maskz_alignr_epi64(0xfc, xt1, xt1, 6), 15), x1_); // xt1 <- x[r-1][t-1..t+62]
+			x1_ = tmp;
+			vt1 = _mm512_load_si512(&v[t]);                // vt1 <- v[r-1][t..t+63]
+			tmp = _mm512_bsrli_epi128(_mm512_maskz_alignr_epi64(0x01, vt1, vt1, 7), 7); // tmp <- v[r-1][t+63]
+			vt1 = _mm512_or_si512(_mm512_alignr_epi8(vt1, _mm512_maskz_alignr_epi64(0xfc, vt1, vt1, 6), 15), v1_); // vt1 <- v[r-1][t-1..t+62]
+			v1_ = tmp;
+			a = _mm512_add_epi8(xt1, vt1);
+			ut = _mm512_load_si512(&u[t]);
+			b = _mm512_add_epi8(_mm512_load_si512(&y[t]), ut);
+
+			d = _mm512_maskz_mov_epi8(_mm512_cmpgt_epi8_mask(a, z), flag1_); // d = a > z? 1 : 0
+			z = _mm512_max_epi8(z, a);
+			d = _mm512_mask_blend_epi8(_mm512_cmpgt_epi8_mask(b, z), d, flag2_); // d = b > z? 2 : d
+
+			z = _mm512_max_epu8(z, b);
+			z = _mm512_min_epu8(z, max_sc_);
+			_mm512_store_si512(&u[t], _mm512_sub_epi8(z, vt1));
+			_mm512_store_si512(&v[t], _mm512_sub_epi8(z, ut));
+			z = _mm512_sub_epi8(z, q_);
+			a = _mm512_sub_epi8(a, z);
+			b = _mm512_sub_epi8(b, z);
+
+			k = _mm512_cmpgt_epi8_mask(a, zero_);
+			_mm512_store_si512(&x[t], _mm512_maskz_mov_epi8(k, a));
+			d = _mm512_or_si512(d, _mm512_maskz_mov_epi8(k, flag8_));  // d = a > 0? 0x08 : 0
+			k = _mm512_cmpgt_epi8_mask(b, zero_);
+			_mm512_store_si512(&y[t], _mm512_maskz_mov_epi8(k, b));
+			d = _mm512_or_si512(d, _mm512_maskz_mov_epi8(k, flag16_)); // d = b > 0? 0x10 : 0
+			_mm512_store_si512(&pr[t], d);
+		}
+		// compute H[]
+		if (r > 0) {
+			H[en0] = en0 > 0 ? H[en0 - 1] + u8[en0] - qe : H[en0] + v8[en0] - qe; // special casing the last element
+			for (t = st0; t < en0; ++t) H[t] += (int32_t)v8[t] - qe;
+		}
+		else H[0] = v8[0] - qe - qe; // special casing r==0
+		// update ez
+		if (en0 == tlen - 1 && H[en0] > ez->mte)
+			ez->mte = H[en0], ez->mte_q = r - en;
+		if (r - st0 == qlen - 1 && H[st0] > ez->mqe)
+			ez->mqe = H[st0], ez->mqe_t = st0;
+		if (r == qlen + tlen - 2 && en0 == tlen - 1)
+			ez->score = H[tlen - 1];
+
+		last_st = st, last_en = en;
+	}
+	ksw_backtrack((uint8_t*)p, off, off_end, n_col_ * 64, tlen - 1, qlen - 1, cigar);
 	free(mem); free(H); free(mem2); free(off);
+}
+
+typedef void(*ksw_extz2_func)(int qlen, const uint8_t *query, int tlen, const uint8_t *target, int8_t m, int8_t q, int8_t e, int w, ksw_extz_t *ez, vector<uint32_t>& cigar);
+static ksw_extz2_func ksw_extz2 = ksw_extz2_sse;
+
+bool ksw2_set_kernel(int level)
+{
+	// level 0 = SSE4.1, 1 = AVX2, 2 = AVX-512BW; false if the CPU does not support it
+	__builtin_cpu_init();
+	if (level == 2 && __builtin_cpu_supports("avx512bw")) ksw_extz2 = ksw_extz2_avx512;
+	else if (level == 1 && __builtin_cpu_supports("avx2")) ksw_extz2 = ksw_extz2_avx2;
+	else if (level == 0) ksw_extz2 = ksw_extz2_sse;
+	else return false;
 
-	return cigar;
+	return true;
 }
 
-void ksw2_alignment(int m, string& s1, int n, string& s2)
+void ksw2_init()
 {
+	const char* KernelName = "SSE4.1";
+
+	if (ksw2_set_kernel(2)) KernelName = "AVX-512BW";
+	else if (ksw2_set_kernel(1)) KernelName = "AVX2";
+	else ksw2_set_kernel(0);
+
+	fprintf(stderr, "ksw2 alignment kernel: %s\n", KernelName);
+}
+
+int ksw2_alignment(int m, string& s1, int n, string& s2, vector<uint32_t>& cigar)
+{
+	int i;
 	ksw_extz_t ez;
-	int i, p, len;
-	string cigar, aln1, aln2;
 
 	uint8_t *str1 = (uint8_t*)malloc(m), *str2 = (uint8_t*)malloc(n);
 	for (i = 0; i < m; ++i) str1[i] = nst_nt4_table[(uint8_t)s1[i]];
 	for (i = 0; i < n; ++i) str2[i] = nst_nt4_table[(uint8_t)s2[i]];
 
-	cigar = ksw_extz2_sse(m, str1, n, str2, 5, 2, 1, -1, &ez);
+	// s1 is the query and s2 is the target; ksw2 reports target-only columns as D
+	ksw_extz2(m, str1, n, str2, 5, 2, 1, -1, &ez, cigar);
 	free(str1); free(str2);
 
-	len = (int)cigar.length();
-	for (p = 0, i = len - 1; i >= 0; i--,p++)
-	{
-		switch (cigar[i])
-		{
-		case 'D': s1.insert(s1.begin() + p, 1, '-'); break;
-		case 'I': s2.insert(s2.begin() + p, 1, '-'); break;
-		}
-	}
+	return ez.score;
 }
@@ -21,22 +21,27 @@ map<int64_t, bool> KnowSiteMap;
 int64_t GenomeSize, TwoGenomeSize;
 vector<Chromosome_t> ChromosomeVec;
 float FrequencyThr, MaxMisMatchRate;
-MappingRecord_t* MappingRecordArr = NULL;
-vector<string> ReadFileNameVec1, ReadFileNameVec2;
+vector<string> ReadFileNameVec1, ReadFileNameVec2, ProfileFileNameVec;
+vector<int> GVCFDepthBandVec;
+vector<pair<int64_t, int64_t> > TargetRegionVec, PaddedRegionVec;
 int64_t ObservGenomicPos, ObserveBegPos, ObserveEndPos;
 pthread_mutex_t LibraryLock, ProfileLock, OutputLock, VarLock;
-char *RefSequence, *RefFileName, *KnownSiteFileName, *IndexFileName, *SamFileName, *VcfFileName, *LogFileName, *sample_id;
-int iThreadNum, MaxPosDiff, iPloidy, FragmentSize, MaxClipSize, MinReadDepth, MinAlleleDepth, MinVarConfScore, MinCNVsize, MinUnmappedSize;
-bool bDebugMode, bFilter, bPairEnd, bUnique, bSAMoutput, bSAMFormat, bGVCF, bMonomorphic, bVCFoutput, bSomatic, gzCompressed, FastQFormat, NW_ALG;
+char *RefSequence, *RefFileName, *KnownSiteFileName, *IndexFileName, *SamFileName, *VcfFileName, *LogFileName, *RegionFileName, *AlnFileName, *sample_id;
+int iThreadNum, MaxPosDiff, iPloidy, FragmentSize, MaxClipSize, MinReadDepth, MinAlleleDepth, MinVarConfScore, MinCNVsize, MinUnmappedSize, RegionPadding, MinUniqueMapQ, CallingSliceSize;
+bool bDebugMode, bFilter, bPairEnd, bUnique, bSAMoutput, bSAMFormat, bBCFFormat, bGVCF, bMonomorphic, bVCFoutput, bSomatic, bDeepCoverage, gzCompressed, FastQFormat, NW_ALG;
 
 void ShowProgramUsage(const char* program)
 {
 	fprintf(stderr, "MapCaller v%s\n\n", VersionStr);
-	fprintf(stderr, "Usage: %s -i Index_Prefix -f <ReadFile_A1 ReadFile_B1 ...> [-f2 <ReadFile_A2 ReadFile_B2 ...>]\n\n", program);
+	fprintf(stderr, "Usage: %s -i Index_Prefix -f <ReadFile_A1 ReadFile_B1 ...> [-f2 <ReadFile_A2 ReadFile_B2 ...>]\n", program);
+	fprintf(stderr, "       %s call -i Index_Prefix -profile ProfileFile [variant calling options]\n", program);
+	fprintf(stderr, "       %s merge -i Index_Prefix -profile <ProfileFile_1 ProfileFile_2 ...> [variant calling options]\n\n", program);
 	fprintf(stderr, "Options: -i STR        BWT_Index_Prefix\n");
 	fprintf(stderr, "         -r STR        Reference filename (format:fa)\n");
 	fprintf(stderr, "         -f            files with #1 mates reads (format:fa, fq, fq.gz)\n");
 	fprintf(stderr, "         -f2           files with #2 mates reads (format:fa, fq, fq.gz)\n");
+	fprintf(stderr, "         -aln STR      aligned reads (format:bam, cram) to call variants from instead of mapping reads\n");
+	fprintf(stderr, "         -min_mapq INT alignments of -aln with a lower MAPQ are counted as multi-hits [%d]\n", MinUniqueMapQ);
 	fprintf(stderr, "         -t INT        number of threads [%d]\n", iThreadNum);
 	fprintf(stderr, "         -size         sequencing fragment size [%d]\n", FragmentSize);
 	fprintf(stderr, "         -indel INT	maximal indel size [%d]\n", MaxPosDiff);
@@ -48,8 +53,15 @@ void ShowProgramUsage(const char* program)
 	fprintf(stderr, "         -sam          SAM output filename [NULL]\n");
 	fprintf(stderr, "         -bam          BAM output filename [NULL]\n");
 	fprintf(stderr, "         -alg STR      gapped alignment algorithm (option: nw|ksw2)\n");
-	fprintf(stderr, "         -vcf          VCF output filename [%s]\n", VcfFileName);
+	fprintf(stderr, "         -vcf          VCF output filename, bgzip-compressed and indexed if it ends with .gz [%s]\n", VcfFileName);
+	fprintf(stderr, "         -bcf          BCF output filename (instead of VCF) [NULL]\n");
 	fprintf(stderr, "         -gvcf         GVCF mode [false]\n");
+	fprintf(stderr, "         -gvcf_dp_bands STR  comma-separated depths where gVCF reference blocks are split, e.g. 5,10,20 [NULL]\n");
+	fprintf(stderr, "         -regions STR  BED file of target regions; only they are profiled and called [NULL]\n");
+	fprintf(stderr, "         -region_pad INT  padding around the target regions in the profile [%d]\n", RegionPadding);
+	fprintf(stderr, "         -slice_size INT  variants are called in slices of whole chromosomes of about INT bp, which are released once written;\n");
+	fprintf(stderr, "                       the profile is still built in full before calling [%d]\n", CallingSliceSize);
+	fprintf(stderr, "         -profile STR  alignment profile checkpoint (written after mapping, read by 'call'; with -no_vcf only the checkpoint is written) [NULL]\n");
 	fprintf(stderr, "         -log STR      log filename [%s]\n", LogFileName);
 	fprintf(stderr, "         -monomorphic  report all loci which do not have any potential alternates.\n");
 	fprintf(stderr, "         -min_cnv INT  the minimal cnv size to be reported [%d].\n", MinCNVsize);
@@ -57,6 +69,9 @@ void ShowProgramUsage(const char* program)
 	fprintf(stderr, "         -ploidy INT   number of sets of chromosomes in a cell (1:monoploid, 2:diploid) [%d]\n", iPloidy);
 	fprintf(stderr, "         -m            output multiple alignments\n");
 	fprintf(stderr, "         -somatic      detect somatic mutations [false]\n");
+	fprintf(stderr, "         -depth INT    expected read depth; %d or more (%d for single-end reads) selects the deep-coverage profile [0]\n", DeepCoverageDepth, DeepCoverageDepth / 2);
+	fprintf(stderr, "         -deep         use 32-bit profile counters (40 bytes/bp instead of 8); without it, columns deeper than\n");
+	fprintf(stderr, "                       about %dx spill to a hash table (~70 bytes each, slower updates) [false]\n", DeepCoverageDepth);
 	fprintf(stderr, "         -no_vcf       No VCF output [false]\n");
 	fprintf(stderr, "         -p            paired-end reads are interlaced in the same file\n");
 	fprintf(stderr, "         -filter       apply variant filters (under test) [false]\n");
@@ -153,7 +168,8 @@ void ReadLibInput(const char* LibFileName)
 
 int main(int argc, char* argv[])
 {
-	int i;
+	int i, ArgBeg = 1, ExpectedDepth = 0;
+	bool bCallOnly = false, bMerge = false, bNoCalling = false, bCheckpointOnly = false;
 	string parameter, str, random_prefix;
 
 	bGVCF = false;
@@ -168,7 +184,9 @@ int main(int argc, char* argv[])
 	bSAMoutput = false;
 	bSAMFormat = true;
 	bSomatic = false;
+	bDeepCoverage = false;
 	bVCFoutput = true;
+	bBCFFormat = false;
 	gzCompressed = false;
 	bMonomorphic = false;
 
@@ -183,12 +201,15 @@ int main(int argc, char* argv[])
 	FrequencyThr = 0.2;
 	MinVarConfScore = 10;
 	MinUnmappedSize = 50;
+	RegionPadding = 100;
+	CallingSliceSize = 1 << 24;
+	MinUniqueMapQ = 1;
 	MaxMisMatchRate = 0.05;
 	sample_id = (char*)"unknown";
 	LogFileName = (char*)"job.log";
 	VcfFileName = (char*)"output.vcf";
 	ObservGenomicPos = ObserveBegPos = ObserveEndPos = -1;
-	RefSequence = RefFileName = IndexFileName = SamFileName = KnownSiteFileName = NULL;
+	RefSequence = RefFileName = IndexFileName = SamFileName = KnownSiteFileName = RegionFileName = AlnFileName = NULL;
 
 	if (argc == 1 || strcmp(argv[1], "-h") == 0) ShowProgramUsage(argv[0]);
 	else if (strcmp(argv[1], "update") == 0)
@@ -209,7 +230,11 @@ int main(int argc, char* argv[])
 	{
 		for (CmdLine = argv[0], i = 1; i < argc; i++) CmdLine += " " + (string)argv[i];
 
-		for (i = 1; i < argc; i++)
+		// 'call' re-runs variant calling on a saved alignment profile (-profile) without mapping; 'merge' sums the profiles of read shards first
+		if (strcmp(argv[1], "call") == 0) bCallOnly = true, ArgBeg = 2;
+		else if (strcmp(argv[1], "merge") == 0) bCallOnly = bMerge = true, ArgBeg = 2;
+
+		for (i = ArgBeg; i < argc; i++)
 		{
 			parameter = argv[i];
 
@@ -292,11 +317,33 @@ int main(int argc, char* argv[])
 			}
 			else if (parameter == "-maxmm" && i + 1 < argc) MaxMisMatchRate = atof(argv[++i]);
 			else if (parameter == "-maxclip" && i + 1 < argc) MaxClipSize = atoi(argv[++i]);
-			else if (parameter == "-vcf" && i + 1 < argc) VcfFileName = argv[++i];
+			else if (parameter == "-vcf" && i + 1 < argc) VcfFileName = argv[++i], bBCFFormat = false;
+			else if (parameter == "-bcf" && i + 1 < argc) VcfFileName = argv[++i], bBCFFormat = true;
 			else if (parameter == "-gvcf") bGVCF = true;
+			else if (parameter == "-gvcf_dp_bands" && i + 1 < argc)
+			{
+				stringstream ss(argv[++i]);
+				while (getline(ss, str, ',')) if (str != "") GVCFDepthBandVec.push_back(atoi(str.c_str()));
+				sort(GVCFDepthBandVec.begin(), GVCFDepthBandVec.end());
+			}
+			else if (parameter == "-aln" && i + 1 < argc) AlnFileName = argv[++i];
+			else if (parameter == "-min_mapq" && i + 1 < argc) MinUniqueMapQ = atoi(argv[++i]);
+			else if (parameter == "-regions" && i + 1 < argc) RegionFileName = argv[++i];
+			else if (parameter == "-region_pad" && i + 1 < argc) RegionPadding = atoi(argv[++i]);
+			else if (parameter == "-slice_size" && i + 1 < argc) CallingSliceSize = atoi(argv[++i]);
+			else if (parameter == "-profile")
+			{
+				while (++i < argc && argv[i][0] != '-') ProfileFileNameVec.push_back(argv[i]);
+				i--;
+			}
 			else if (parameter == "-monomorphic") bMonomorphic = true;
-			else if (parameter == "-no_vcf") bVCFoutput = false;
+			else if (parameter == "-no_vcf") { bVCFoutput = false; bNoCalling = true; }
 			else if (parameter == "-somatic") bSomatic = true;
+			else if (parameter == "-deep") bDeepCoverage = true;
+			else if (parameter == "-depth" && i + 1 < argc)
+			{
+				ExpectedDepth = atoi(argv[++i]);
+			}
 			else if (parameter == "-pair" || parameter == "-p") bPairEnd = true;
 			else if (parameter == "-obs" && i + 1 < argc) ObservGenomicPos = atoi(argv[++i]);
 			else if (parameter == "-obr" && i + 2 < argc)
@@ -322,7 +369,41 @@ int main(int argc, char* argv[])
 		if (bGVCF && bMonomorphic) bGVCF = false;
 		if (iMaxDuplicate <= 0 || iMaxDuplicate > 15) iMaxDuplicate = 15;
 
-		if (ReadFileNameVec1.size() == 0)
+		if (bCallOnly)
+		{
+			struct stat s;
+			if (ProfileFileNameVec.size() == 0 || (bMerge ? ProfileFileNameVec.size() < 2 : ProfileFileNameVec.size() > 1))
+			{
+				fprintf(stderr, "Warning! Please specify %s profile checkpoint%s (-profile)!\n", bMerge ? "two or more" : "one", bMerge ? "s" : "");
+				ShowProgramUsage(argv[0]);
+				exit(0);
+			}
+			for (vector<string>::iterator iter = ProfileFileNameVec.begin(); iter != ProfileFileNameVec.end(); iter++)
+			{
+				if (stat(iter->c_str(), &s) == -1)
+				{
+					fprintf(stderr, "Cannot access file:[%s]\n", (char*)iter->c_str());
+					exit(0);
+				}
+			}
+			bVCFoutput = true; bSAMoutput = false;
+		}
+		else if (AlnFileName != NULL)
+		{
+			struct stat s;
+			if (ReadFileNameVec1.size() > 0)
+			{
+				fprintf(stderr, "Warning! Please specify either reads (-f) or aligned reads (-aln)!\n");
+				exit(0);
+			}
+			if (stat(AlnFileName, &s) == -1)
+			{
+				fprintf(stderr, "Cannot access file:[%s]\n", AlnFileName);
+				exit(0);
+			}
+			bVCFoutput = true; bSAMoutput = false;
+		}
+		else if (ReadFileNameVec1.size() == 0)
 		{
 			fprintf(stderr, "Warning! Please specify a valid read input!\n");
 			ShowProgramUsage(argv[0]);
@@ -335,6 +416,19 @@ int main(int argc, char* argv[])
 			fprintf(stderr, "Read2:\n"); for (vector<string>::iterator iter = ReadFileNameVec2.begin(); iter != ReadFileNameVec2.end(); iter++) fprintf(stderr, "\t%s\n", (char*)iter->c_str());
 			exit(0);
 		}
+		// single-end reads fill only two of the four strand counters, so their columns overflow at half the depth
+		if (ExpectedDepth >= (AlnFileName == NULL && ReadFileNameVec2.size() == 0 && !bPairEnd ? DeepCoverageDepth / 2 : DeepCoverageDepth)) bDeepCoverage = true;
+		if (!bCallOnly && ProfileFileNameVec.size() > 0)
+		{
+			if (ProfileFileNameVec.size() > 1)
+			{
+				fprintf(stderr, "Warning! Only one profile checkpoint can be written!\n");
+				exit(0);
+			}
+			if (CheckOutputFileName((char*)ProfileFileNameVec[0].c_str()) == false) exit(0);
+			// -no_vcf with -profile: build the profile and write the checkpoint, and leave the calling to 'call' or 'merge'
+			if (bNoCalling) bVCFoutput = bCheckpointOnly = true;
+		}
 		if (CheckInputFiles(ReadFileNameVec1) == false || CheckInputFiles(ReadFileNameVec2) == false) exit(0);
 
 		if (strcmp(LogFileName, "job.log")!= 0 && CheckOutputFileName(LogFileName) == false) exit(0);
@@ -366,22 +460,35 @@ int main(int argc, char* argv[])
 				fprintf(stderr, "Reference genome is empty\n");
 				exit(1);
 			}
-			if (bVCFoutput)
+			if (RegionFileName != NULL) LoadTargetRegions(RegionFileName);
+			if (bCallOnly)
+			{
+				if (bMerge) fprintf(stderr, "Merge %d alignment profiles...\n", (int)ProfileFileNameVec.size());
+				else fprintf(stderr, "Load the alignment profile from [%s]...\n", ProfileFileNameVec[0].c_str());
+				LoadProfileCheckpoints(ProfileFileNameVec);
+			}
+			else if (bVCFoutput)
 			{
 				fprintf(stderr, "Initialize the alignment profile...\n");
-				MappingRecordArr = new MappingRecord_t[GenomeSize]();
+				InitProfileBlocks(); ReportProfileMemory();
 			}
 			pthread_mutex_init(&VarLock, NULL); pthread_mutex_init(&OutputLock, NULL); pthread_mutex_init(&LibraryLock, NULL); pthread_mutex_init(&ProfileLock, NULL);
 
 			StartProcessTime = time(NULL);
 			FILE *log = fopen(LogFileName, "a"); fprintf(log, "%s\n[CMD]", string().assign(80, '*').c_str()); for (i = 0; i < argc; i++) fprintf(log, " %s", argv[i]); fprintf(log, "\n\n"); fclose(log);
 
-			Mapping();
-			if (bVCFoutput) VariantCalling();
+			if (!bCallOnly)
+			{
+				InitSeqKernels();
+				if (NW_ALG) nw_init(); else ksw2_init();
+				Mapping();
+				if (bVCFoutput && ProfileFileNameVec.size() > 0) SaveProfileCheckpoint(ProfileFileNameVec[0].c_str());
+			}
+			if (bVCFoutput && !bCheckpointOnly) VariantCalling();
 
 			bwa_idx_destroy(RefIdx);
 			if (RefSequence != NULL) delete[] RefSequence;
-			if (MappingRecordArr != NULL) delete[] MappingRecordArr;
+			ReleaseProfileBlocks();
 			if (RefFileName != NULL)
 			{
 				random_prefix = "rm -f " + random_prefix + "*";
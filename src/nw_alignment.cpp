@@ -1,4 +1,6 @@
 #include "structure.h"
+#include <smmintrin.h>
+#include <immintrin.h>
 
 const float MaxPenalty = -65536;
 const float OPEN_GAP = -1;
@@ -15,7 +17,7 @@ double max(float x, float y, float z)
 	return x > y ? max(x, z) : max(y, z);
 }
 
-void nw_alignment(int m, string& s1, int n, string& s2)
+void nw_alignment(int m, string& s1, int n, string& s2, vector<uint32_t>& cigar)
 {
 	int i, j;
 
@@ -56,23 +58,22 @@ void nw_alignment(int m, string& s1, int n, string& s2)
 		}
 	}
 	// back tracking
-	i = m - 1, j = n - 1;
+	i = m - 1, j = n - 1; cigar.clear();
 	while (i > 0 || j > 0) {
 		if (s[i][j] == r[i][j]) {
-			//fprintf(stderr, "i,j=%d,%d\n", i, j); fflush(stderr);
-			s1.insert(i, 1, '-');
+			PushCigarOp(cigar, CIGAR_D, 1);
 			j--;
 		}
 		else if (s[i][j] == t[i][j]) {
-			//fprintf(stderr, "i,j=%d,%d\n", i, j); fflush(stderr);
-			s2.insert(j, 1, '-');
+			PushCigarOp(cigar, CIGAR_I, 1);
 			i--;
 		}
 		else {
+			PushCigarOp(cigar, CIGAR_M, 1);
 			i--, j--;
 		}
 	}
-	//fprintf(stderr, "alignment\n%s\n%s\n", s1.c_str(), s2.c_str());
+	reverse(cigar.begin(), cigar.end());
 	for (i = 0; i < m; i++)
 	{
 		delete[] r[i]; 
@@ -81,3 +82,185 @@ void nw_alignment(int m, string& s1, int n, string& s2)
 	}
 	delete[] r; delete[] t; delete[] s;
 }
+
+// inter-sequence batched alignment: one gap problem per 16-bit SIMD lane.
+// scores are doubled so that every value of nw_alignment() is an exact integer
+#define NW_MATCH 2
+#define NW_MISMATCH -2
+#define NW_EXTEND -1
+#define NW_NEW -3
+#define NW_NEG -16384
+#define NW_MaxBatchLen 512
+
+typedef void(*nw_batch_func)(int M, int N, const int16_t* A, const int16_t* B, uint8_t* flag);
+static nw_batch_func nw_batch_kernel = NULL;
+static int NwLaneNum = 0;
+
+// A[i*L+k]/B[j*L+k] are the lane codes of s1/s2; flag[(i*(N+1)+j)*L+k] keeps bit0 = (s==r), bit1 = (s==t)
+void nw_batch_sse(int M, int N, const int16_t* A, const int16_t* B, uint8_t* flag)
+{
+	int i, j;
+	__m128i a, r, t, s, sdiag, s_left, r_left, eq, f;
+	__m128i ext_ = _mm_set1_epi16(NW_EXTEND), new_ = _mm_set1_epi16(NW_NEW), mch_ = _mm_set1_epi16(NW_MATCH), mis_ = _mm_set1_epi16(NW_MISMATCH);
+	__m128i one_ = _mm_set1_epi16(1), two_ = _mm_set1_epi16(2);
+	__m128i *sPrev = new __m128i[N + 1], *tPrev = new __m128i[N + 1];
+
+	sPrev[0] = _mm_setzero_si128();
+	for (j = 1; j <= N; j++) sPrev[j] = _mm_set1_epi16(-2 - j), tPrev[j] = _mm_set1_epi16(NW_NEG);
+	for (i = 1; i <= M; i++)
+	{
+		a = _mm_loadu_si128((__m128i*)(A + (i - 1) * 8));
+		sdiag = sPrev[0]; sPrev[0] = s_left = _mm_set1_epi16(-2 - i); r_left = _mm_set1_epi16(NW_NEG);
+		for (j = 1; j <= N; j++)
+		{
+			r = _mm_max_epi16(_mm_add_epi16(r_left, ext_), _mm_add_epi16(s_left, new_));
+			t = _mm_max_epi16(_mm_add_epi16(tPrev[j], ext_), _mm_add_epi16(sPrev[j], new_));
+			eq = _mm_cmpeq_epi16(a, _mm_loadu_si128((__m128i*)(B + (j - 1) * 8)));
+			s = _mm_add_epi16(sdiag, _mm_blendv_epi8(mis_, mch_, eq));
+			s = _mm_max_epi16(s, _mm_max_epi16(r, t));
+			f = _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi16(s, r), one_), _mm_and_si128(_mm_cmpeq_epi16(s, t), two_));
+			_mm_storel_epi64((__m128i*)(flag + (i * (N + 1) + j) * 8), _mm_packus_epi16(f, f));
+			sdiag = sPrev[j]; sPrev[j] = s_left = s; tPrev[j] = t; r_left = r;
+		}
+	}
+	delete[] sPrev; delete[] tPrev;
+}
+
+__attribute__((target("avx2")))
+void nw_batch_avx2(int M, int N, const int16_t* A, const int16_t* B, uint8_t* flag)
+{
+	int i, j;
+	__m256i a, r, t, s, sdiag, s_left, r_left, eq, f;
+	__m256i ext_ = _mm256_set1_epi16(NW_EXTEND), new_ = _mm256_set1_epi16(NW_NEW), mch_ = _mm256_set1_epi16(NW_MATCH), mis_ = _mm256_set1_epi16(NW_MISMATCH);
+	__m256i one_ = _mm256_set1_epi16(1), two_ = _mm256_set1_epi16(2);
+	__m256i *sPrev = new __m256i[N + 1], *tPrev = new __m256i[N + 1];
+
+	sPrev[0] = _mm256_setzero_si256();
+	for (j = 1; j <= N; j++) sPrev[j] = _mm256_set1_epi16(-2 - j), tPrev[j] = _mm256_set1_epi16(NW_NEG);
+	for (i = 1; i <= M; i++)
+	{
+		a = _mm256_loadu_si256((__m256i*)(A + (i - 1) * 16));
+		sdiag = sPrev[0]; sPrev[0] = s_left = _mm256_set1_epi16(-2 - i); r_left = _mm256_set1_epi16(NW_NEG);
+		for (j = 1; j <= N; j++)
+		{
+			r = _mm256_max_epi16(_mm256_add_epi16(r_left, ext_), _mm256_add_epi16(s_left, new_));
+			t = _mm256_max_epi16(_mm256_add_epi16(tPrev[j], ext_), _mm256_add_epi16(sPrev[j], new_));
+			eq = _mm256_cmpeq_epi16(a, _mm256_loadu_si256((__m256i*)(B + (j - 1) * 16)));
+			s = _mm256_add_epi16(sdiag, _mm256_blendv_epi8(mis_, mch_, eq));
+			s = _mm256_max_epi16(s, _mm256_max_epi16(r, t));
+			f = _mm256_or_si256(_mm256_and_si256(_mm256_cmpeq_epi16(s, r), one_), _mm256_and_si256(_mm256_cmpeq_epi16(s, t), two_));
+			_mm_storeu_si128((__m128i*)(flag + (i * (N + 1) + j) * 16), _mm_packus_epi16(_mm256_castsi256_si128(f), _mm256_extracti128_si256(f, 1)));
+			sdiag = sPrev[j]; sPrev[j] = s_left = s; tPrev[j] = t; r_left = r;
+		}
+	}
+	delete[] sPrev; delete[] tPrev;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void nw_batch_avx512(int M, int N, const int16_t* A, const int16_t* B, uint8_t* flag)
+{
+	int i, j;
+	__m512i a, r, t, s, sdiag, s_left, r_left, f;
+	__m512i ext_ = _mm512_set1_epi16(NW_EXTEND), new_ = _mm512_set1_epi16(NW_NEW), mch_ = _mm512_set1_epi16(NW_MATCH), mis_ = _mm512_set1_epi16(NW_MISMATCH);
+	__m512i one_ = _mm512_set1_epi16(1), two_ = _mm512_set1_epi16(2);
+	__m512i *sPrev = new __m512i[N + 1], *tPrev = new __m512i[N + 1];
+
+	sPrev[0] = _mm512_setzero_si512();
+	for (j = 1; j <= N; j++) sPrev[j] = _mm512_set1_epi16(-2 - j), tPrev[j] = _mm512_set1_epi16(NW_NEG);
+	for (i = 1; i <= M; i++)
+	{
+		a = _mm512_loadu_si512((void*)(A + (i - 1) * 32));
+		sdiag = sPrev[0]; sPrev[0] = s_left = _mm512_set1_epi16(-2 - i); r_left = _mm512_set1_epi16(NW_NEG);
+		for (j = 1; j <= N; j++)
+		{
+			r = _mm512_max_epi16(_mm512_add_epi16(r_left, ext_), _mm512_add_epi16(s_left, new_));
+			t = _mm512_max_epi16(_mm512_add_epi16(tPrev[j], ext_), _mm512_add_epi16(sPrev[j], new_));
+			s = _mm512_add_epi16(sdiag, _mm512_mask_blend_epi16(_mm512_cmpeq_epi16_mask(a, _mm512_loadu_si512((void*)(B + (j - 1) * 32))), mis_, mch_));
+			s = _mm512_max_epi16(s, _mm512_max_epi16(r, t));
+			f = _mm512_or_si512(_mm512_maskz_mov_epi16(_mm512_cmpeq_epi16_mask(s, r), one_), _mm512_maskz_mov_epi16(_mm512_cmpeq_epi16_mask(s, t), two_));
+			_mm256_storeu_si256((__m256i*)(flag + (i * (N + 1) + j) * 32), _mm512_maskz_cvtepi16_epi8((__mmask32)-1, f));
+			sdiag = sPrev[j]; sPrev[j] = s_left = s; tPrev[j] = t; r_left = r;
+		}
+	}
+	delete[] sPrev; delete[] tPrev;
+}
+
+bool nw_set_kernel(int level)
+{
+	// level 0 = SSE4.1 (8 lanes), 1 = AVX2 (16 lanes), 2 = AVX-512BW (32 lanes); false if the CPU does not support it
+	__builtin_cpu_init();
+	if (level == 2 && __builtin_cpu_supports("avx512bw")) nw_batch_kernel = nw_batch_avx512, NwLaneNum = 32;
+	else if (level == 1 && __builtin_cpu_supports("avx2")) nw_batch_kernel = nw_batch_avx2, NwLaneNum = 16;
+	else if (level == 0) nw_batch_kernel = nw_batch_sse, NwLaneNum = 8;
+	else return false;
+
+	return true;
+}
+
+void nw_init()
+{
+	const char* KernelName = "SSE4.1";
+
+	if (nw_set_kernel(2)) KernelName = "AVX-512BW";
+	else if (nw_set_kernel(1)) KernelName = "AVX2";
+	else nw_set_kernel(0);
+
+	fprintf(stderr, "nw alignment kernel: %s (%d lanes)\n", KernelName, NwLaneNum);
+}
+
+bool CompByGapProblemSize(const GapAln_t* p1, const GapAln_t* p2)
+{
+	if (p1->fp->rLen == p2->fp->rLen) return p1->fp->gLen < p2->fp->gLen;
+	else return p1->fp->rLen < p2->fp->rLen;
+}
+
+void nw_batch_backtrack(int k, int L, int N, const uint8_t* flag, FragPair_t* fp)
+{
+	int i = fp->rLen, j = fp->gLen;
+
+	fp->cigar.clear();
+	while (i > 0 || j > 0)
+	{
+		uint8_t f = (i == 0 ? 1 : (j == 0 ? 2 : flag[(i * (N + 1) + j) * L + k]));
+		if (f & 1) PushCigarOp(fp->cigar, CIGAR_D, 1), j--;
+		else if (f & 2) PushCigarOp(fp->cigar, CIGAR_I, 1), i--;
+		else PushCigarOp(fp->cigar, CIGAR_M, 1), i--, j--;
+	}
+	reverse(fp->cigar.begin(), fp->cigar.end());
+}
+
+void nw_batch_alignment(vector<GapAln_t>& GapAlnVec)
+{
+	int i, j, k, b, L, M, N, num;
+	vector<GapAln_t*> BatchVec;
+	vector<int16_t> A, B;
+	vector<uint8_t> flag;
+
+	L = NwLaneNum;
+	for (vector<GapAln_t>::iterator iter = GapAlnVec.begin(); iter != GapAlnVec.end(); iter++)
+	{
+		if (iter->fp->rLen > NW_MaxBatchLen || iter->fp->gLen > NW_MaxBatchLen) nw_alignment(iter->fp->rLen, iter->rseq, iter->fp->gLen, iter->gseq, iter->fp->cigar);
+		else BatchVec.push_back(&(*iter));
+	}
+	// problems of similar size share a batch to reduce padding
+	sort(BatchVec.begin(), BatchVec.end(), CompByGapProblemSize);
+	num = (int)BatchVec.size();
+	for (b = 0; b < num; b += L)
+	{
+		int n = (num - b < L ? num - b : L);
+		for (M = N = 0, k = 0; k < n; k++)
+		{
+			if (BatchVec[b + k]->fp->rLen > M) M = BatchVec[b + k]->fp->rLen;
+			if (BatchVec[b + k]->fp->gLen > N) N = BatchVec[b + k]->fp->gLen;
+		}
+		A.assign(M * L, 0); B.assign(N * L, 0); flag.resize((size_t)(M + 1) * (N + 1) * L);
+		for (k = 0; k < n; k++)
+		{
+			GapAln_t* gap = BatchVec[b + k];
+			for (i = 0; i < gap->fp->rLen; i++) A[i * L + k] = nst_nt4_table[(unsigned short)gap->rseq[i]];
+			for (j = 0; j < gap->fp->gLen; j++) B[j * L + k] = nst_nt4_table[(unsigned short)gap->gseq[j]];
+		}
+		nw_batch_kernel(M, N, A.data(), B.data(), flag.data());
+		for (k = 0; k < n; k++) nw_batch_backtrack(k, L, N, flag.data(), BatchVec[b + k]->fp);
+	}
+}
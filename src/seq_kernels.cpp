@@ -0,0 +1,238 @@
+#include "structure.h"
+#include <immintrin.h>
+
+// SIMD sequence primitives: nt4 encoding, reverse complement, byte reversal and mismatch counting.
+// SSE4.1 is the baseline (-msse4.1); AVX2 kernels are selected at runtime by InitSeqKernels().
+
+static bool bSeqAVX2 = false;
+
+static inline char ScalarComplementaryBase(char c)
+{
+	switch (c & 0xDF)
+	{
+	case 'A': return 'T';
+	case 'C': return 'G';
+	case 'G': return 'C';
+	case 'T': return 'A';
+	default:  return 'N';
+	}
+}
+
+// SSE4.1 kernels
+static inline __m128i sse_complement(__m128i x)
+{
+	__m128i u = _mm_and_si128(x, _mm_set1_epi8((char)0xDF)), r = _mm_set1_epi8('N');
+
+	r = _mm_blendv_epi8(r, _mm_set1_epi8('T'), _mm_cmpeq_epi8(u, _mm_set1_epi8('A')));
+	r = _mm_blendv_epi8(r, _mm_set1_epi8('G'), _mm_cmpeq_epi8(u, _mm_set1_epi8('C')));
+	r = _mm_blendv_epi8(r, _mm_set1_epi8('C'), _mm_cmpeq_epi8(u, _mm_set1_epi8('G')));
+	r = _mm_blendv_epi8(r, _mm_set1_epi8('A'), _mm_cmpeq_epi8(u, _mm_set1_epi8('T')));
+	return r;
+}
+
+static inline __m128i sse_reverse(__m128i x)
+{
+	return _mm_shuffle_epi8(x, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+static void sse_encode(int len, const char* seq, uint8_t* code)
+{
+	int i;
+	__m128i u, r;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		u = _mm_and_si128(_mm_loadu_si128((const __m128i*)(seq + i)), _mm_set1_epi8((char)0xDF));
+		r = _mm_set1_epi8(4);
+		r = _mm_blendv_epi8(r, _mm_set1_epi8(0), _mm_cmpeq_epi8(u, _mm_set1_epi8('A')));
+		r = _mm_blendv_epi8(r, _mm_set1_epi8(1), _mm_cmpeq_epi8(u, _mm_set1_epi8('C')));
+		r = _mm_blendv_epi8(r, _mm_set1_epi8(2), _mm_cmpeq_epi8(u, _mm_set1_epi8('G')));
+		r = _mm_blendv_epi8(r, _mm_set1_epi8(3), _mm_cmpeq_epi8(u, _mm_set1_epi8('T')));
+		_mm_storeu_si128((__m128i*)(code + i), r);
+	}
+	for (; i < len; i++) code[i] = nst_nt4_table[(uint8_t)seq[i]];
+}
+
+static void sse_reverse_complement(int len, const char* seq, char* rseq)
+{
+	int i;
+
+	for (i = 0; i + 16 <= len; i += 16) _mm_storeu_si128((__m128i*)(rseq + len - i - 16), sse_reverse(sse_complement(_mm_loadu_si128((const __m128i*)(seq + i)))));
+	for (; i < len; i++) rseq[len - 1 - i] = ScalarComplementaryBase(seq[i]);
+}
+
+static void sse_self_reverse(int len, char* str, bool bComplement)
+{
+	char c;
+	int i, j;
+	__m128i a, b;
+
+	for (i = 0, j = len; j - i >= 32; i += 16, j -= 16)
+	{
+		a = _mm_loadu_si128((__m128i*)(str + i)); b = _mm_loadu_si128((__m128i*)(str + j - 16));
+		if (bComplement) { a = sse_complement(a); b = sse_complement(b); }
+		_mm_storeu_si128((__m128i*)(str + i), sse_reverse(b)); _mm_storeu_si128((__m128i*)(str + j - 16), sse_reverse(a));
+	}
+	for (j--; i < j; i++, j--)
+	{
+		c = str[i];
+		str[i] = bComplement ? ScalarComplementaryBase(str[j]) : str[j];
+		str[j] = bComplement ? ScalarComplementaryBase(c) : c;
+	}
+	if (i == j && bComplement) str[i] = ScalarComplementaryBase(str[i]);
+}
+
+static void sse_reverse_copy(int len, const char* str, char* rstr)
+{
+	int i;
+
+	for (i = 0; i + 16 <= len; i += 16) _mm_storeu_si128((__m128i*)(rstr + len - i - 16), sse_reverse(_mm_loadu_si128((const __m128i*)(str + i))));
+	for (; i < len; i++) rstr[len - 1 - i] = str[i];
+}
+
+static int sse_mismatch_num(int len, const char* s1, const char* s2)
+{
+	// equal bytes are summed with psadbw, as SSE4.1 does not imply a popcnt instruction
+	int i, n = 0;
+	__m128i sum = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+
+	for (i = 0; i + 16 <= len; i += 16) sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s1 + i)), _mm_loadu_si128((const __m128i*)(s2 + i))), one), _mm_setzero_si128()));
+	n = i - (int)(_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+	for (; i < len; i++) if (s1[i] != s2[i]) n++;
+
+	return n;
+}
+
+// AVX2 kernels
+__attribute__((target("avx2"))) static inline __m256i avx2_complement(__m256i x)
+{
+	__m256i u = _mm256_and_si256(x, _mm256_set1_epi8((char)0xDF)), r = _mm256_set1_epi8('N');
+
+	r = _mm256_blendv_epi8(r, _mm256_set1_epi8('T'), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('A')));
+	r = _mm256_blendv_epi8(r, _mm256_set1_epi8('G'), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('C')));
+	r = _mm256_blendv_epi8(r, _mm256_set1_epi8('C'), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('G')));
+	r = _mm256_blendv_epi8(r, _mm256_set1_epi8('A'), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('T')));
+	return r;
+}
+
+__attribute__((target("avx2"))) static inline __m256i avx2_reverse(__m256i x)
+{
+	x = _mm256_shuffle_epi8(x, _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+	return _mm256_permute4x64_epi64(x, 0x4E);
+}
+
+__attribute__((target("avx2"))) static void avx2_encode(int len, const char* seq, uint8_t* code)
+{
+	int i;
+	__m256i u, r;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		u = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(seq + i)), _mm256_set1_epi8((char)0xDF));
+		r = _mm256_set1_epi8(4);
+		r = _mm256_blendv_epi8(r, _mm256_set1_epi8(0), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('A')));
+		r = _mm256_blendv_epi8(r, _mm256_set1_epi8(1), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('C')));
+		r = _mm256_blendv_epi8(r, _mm256_set1_epi8(2), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('G')));
+		r = _mm256_blendv_epi8(r, _mm256_set1_epi8(3), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('T')));
+		_mm256_storeu_si256((__m256i*)(code + i), r);
+	}
+	// the SSE4.1 tail is legacy-encoded: clear the upper halves first to avoid the AVX-SSE transition penalty
+	_mm256_zeroupper();
+	if (i < len) sse_encode(len - i, seq + i, code + i);
+}
+
+__attribute__((target("avx2"))) static void avx2_reverse_complement(int len, const char* seq, char* rseq)
+{
+	int i;
+
+	for (i = 0; i + 32 <= len; i += 32) _mm256_storeu_si256((__m256i*)(rseq + len - i - 32), avx2_reverse(avx2_complement(_mm256_loadu_si256((const __m256i*)(seq + i)))));
+	_mm256_zeroupper();
+	if (i < len) sse_reverse_complement(len - i, seq + i, rseq);
+}
+
+__attribute__((target("avx2"))) static void avx2_self_reverse(int len, char* str, bool bComplement)
+{
+	int i, j;
+	__m256i a, b;
+
+	for (i = 0, j = len; j - i >= 64; i += 32, j -= 32)
+	{
+		a = _mm256_loadu_si256((__m256i*)(str + i)); b = _mm256_loadu_si256((__m256i*)(str + j - 32));
+		if (bComplement) { a = avx2_complement(a); b = avx2_complement(b); }
+		_mm256_storeu_si256((__m256i*)(str + i), avx2_reverse(b)); _mm256_storeu_si256((__m256i*)(str + j - 32), avx2_reverse(a));
+	}
+	_mm256_zeroupper();
+	if (j > i) sse_self_reverse(j - i, str + i, bComplement);
+}
+
+__attribute__((target("avx2"))) static void avx2_reverse_copy(int len, const char* str, char* rstr)
+{
+	int i;
+
+	for (i = 0; i + 32 <= len; i += 32) _mm256_storeu_si256((__m256i*)(rstr + len - i - 32), avx2_reverse(_mm256_loadu_si256((const __m256i*)(str + i))));
+	_mm256_zeroupper();
+	if (i < len) sse_reverse_copy(len - i, str + i, rstr);
+}
+
+__attribute__((target("avx2,popcnt"))) static int avx2_mismatch_num(int len, const char* s1, const char* s2)
+{
+	int i, n = 0;
+
+	for (i = 0; i + 32 <= len; i += 32) n += 32 - __builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s1 + i)), _mm256_loadu_si256((const __m256i*)(s2 + i)))));
+	_mm256_zeroupper();
+	if (i < len) n += sse_mismatch_num(len - i, s1 + i, s2 + i);
+
+	return n;
+}
+
+bool SelectSeqKernels(int level)
+{
+	// level 0 = SSE4.1, 1 = AVX2; false if the CPU does not support it
+	__builtin_cpu_init();
+	if (level == 1 && __builtin_cpu_supports("avx2")) bSeqAVX2 = true;
+	else if (level == 0) bSeqAVX2 = false;
+	else return false;
+
+	return true;
+}
+
+void InitSeqKernels()
+{
+	if (!SelectSeqKernels(1)) SelectSeqKernels(0);
+}
+
+void SeqEncodeNt4(int len, const char* seq, uint8_t* code)
+{
+	if (bSeqAVX2) avx2_encode(len, seq, code);
+	else sse_encode(len, seq, code);
+}
+
+void SeqReverseComplement(int len, const char* seq, char* rseq)
+{
+	if (bSeqAVX2) avx2_reverse_complement(len, seq, rseq);
+	else sse_reverse_complement(len, seq, rseq);
+}
+
+void SeqSelfReverseComplement(int len, char* seq)
+{
+	if (bSeqAVX2) avx2_self_reverse(len, seq, true);
+	else sse_self_reverse(len, seq, true);
+}
+
+void SeqSelfReverse(int len, char* str)
+{
+	if (bSeqAVX2) avx2_self_reverse(len, str, false);
+	else sse_self_reverse(len, str, false);
+}
+
+void SeqReverseCopy(int len, const char* str, char* rstr)
+{
+	if (bSeqAVX2) avx2_reverse_copy(len, str, rstr);
+	else sse_reverse_copy(len, str, rstr);
+}
+
+int SeqMismatchNum(int len, const char* s1, const char* s2)
+{
+	if (bSeqAVX2) return avx2_mismatch_num(len, s1, s2);
+	else return sse_mismatch_num(len, s1, s2);
+}
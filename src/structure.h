@@ -23,6 +23,24 @@
 #define MinSeedLength 16
 #define ReadChunkSize 200
 #define MaxAlleleCount 4095
+// the compact profile cell spills a column to the overflow table once a strand counter passes 63,
+// i.e. at about 4x63 reads per column for paired-end data (2x63 for single-end data)
+#define DeepCoverageDepth 250
+#define MinBreakPointSize 20
+
+// column flags of the candidate-only variant scan (GetProfileCandidates)
+#define CandAltAllele 1
+#define CandMultiHit 2
+
+// calling-stage depth blocks (BlockDepthArr); a target-region profile is laid out in whole blocks
+#define BlockSize 100
+
+// alignment ops are packed as len<<4|op with the BAM op codes
+#define CIGAR_M 0
+#define CIGAR_I 1
+#define CIGAR_D 2
+#define CIGAR_EQ 7
+#define CIGAR_X 8
 
 using namespace std;
 
@@ -118,10 +136,33 @@ typedef struct
 	int rLen; // read block size
 	int gLen; // genome block size
 	int64_t PosDiff; // gPos-rPos
-	string aln1; // read fragment alignment
-	string aln2; // genomic fragment alignment
+	vector<uint32_t> cigar; // alignment ops (=/X/I/D) in the forward genome orientation
 } FragPair_t;
 
+typedef struct
+{
+	FragPair_t* fp;
+	string rseq; // read fragment
+	string gseq; // genomic fragment
+} GapAln_t;
+
+typedef struct
+{
+	int64_t gPos;
+	int rLen, gLen;
+	uint64_t hash; // hash of the read fragment
+	uint64_t stamp; // last access, 0 = empty slot
+	string rseq;
+	vector<uint32_t> cigar;
+} GapAlnCacheEntry_t;
+
+typedef struct
+{
+	uint64_t clock;
+	int64_t lookups, hits, evictions;
+	vector<GapAlnCacheEntry_t> EntryVec; // set-associative, GapAlnCacheWays entries per set
+} GapAlnCache_t;
+
 typedef struct
 {
 	int score;
@@ -158,10 +199,54 @@ typedef struct
 	//uint8_t readCount;
 	//uint8_t multi_hit;
 	//bool bKnowSite;
-	uint64_t A : 12, C : 12, G : 12, T : 12, multi_hit : 12, readCount : 4;
-	uint16_t F1, R2, F2, R1;
+	uint32_t A, C, G, T, multi_hit;
+	uint32_t F1, R2, F2, R1;
+	uint8_t readCount;
 } MappingRecord_t;
 
+// the dense profile cell: small saturating counters; overflow=1 means the column lives in its block's overflow table
+typedef struct
+{
+	uint64_t A : 8, C : 8, G : 8, T : 8, F1 : 6, R1 : 6, F2 : 6, R2 : 6, readCount : 4, overflow : 1;
+} ProfileCell_t;
+
+// the deep-coverage profile cell: 32-bit counters indexed by nt4 code (base[4] absorbs N) and by strand (F1, R1, F2, R2)
+typedef struct
+{
+	uint32_t base[5], strand[4], readCount;
+} DeepProfileCell_t;
+
+// a deferred profile update: a run of base counts or a range increment of one counter
+typedef struct
+{
+	int64_t gPos; // turned into the profile position when the events are applied
+	uint32_t offset; // start of the base codes in BaseVec
+	uint32_t len : 28, type : 4;
+} ProfileEvent_t;
+
+// an indel observation: insertions are keyed by their 2-bit packed sequence (first base in the top bits) and length,
+// deletions by length only; IndSpillFlag in len marks an insertion whose seq indexes a spilled sequence string instead
+#define IndSpillFlag 0x80000000
+typedef struct
+{
+	int64_t gPos; // the base before the indel
+	uint64_t seq;
+	uint32_t len, count;
+} IndEvent_t;
+
+// per-thread profile state: lock statistics plus the profile updates and indel/breakpoint events collected by a mapping thread
+typedef struct
+{
+	double LockWaitTime;
+	int64_t LockNum, ContendedNum;
+	vector<uint8_t> BaseVec; // base codes of the pending base runs
+	vector<ProfileEvent_t> EventVec, TmpVec; // pending profile updates
+	vector<int64_t> BlockCntVec;
+	vector<int64_t> BreakPointVec; // clipped read ends
+	vector<IndEvent_t> InsertEventVec, DeleteEventVec;
+	map<int64_t, map<string, uint32_t> > InsertSpillMap; // insertions longer than 32bp or with non-ACGT bases
+} ProfileBuffer_t;
+
 typedef struct
 {
 	int idx1;
@@ -182,13 +267,27 @@ typedef struct
 	int64_t dist;
 } DiscordPair_t;
 
+// profile statistics gathered by SummarizeProfile()
 typedef struct
 {
-	uint16_t DP; // read   depth
+	int64_t AlignedBase, TotalCoverage; // covered columns and their total depth
+	int64_t ReadStartPos, ReadStartNum; // columns with read starts and the number of read starts
+} ProfileSummary_t;
+
+// structural variant evidence collected by one mapping thread, sorted by position
+typedef struct
+{
+	vector<int64_t> BreakPointVec;
+	vector<DiscordPair_t> INVSiteVec, TNLSiteVec;
+} SVEvidence_t;
+
+typedef struct
+{
+	uint32_t DP; // read   depth
 	int64_t gPos;
 	string ALTstr;
-	uint16_t AD_ref; // allele depth
-	uint16_t AD_alt;
+	uint32_t AD_ref; // allele depth
+	uint32_t AD_alt;
 	uint8_t GenoType;
 	uint8_t qscore;
 	uint8_t VarType;
@@ -207,29 +306,35 @@ extern map<string, int> ChrIdMap;
 extern map<int64_t, int> PosChrIdMap;
 extern map<int64_t, bool> KnowSiteMap;
 extern unsigned char nst_nt4_table[256];
-extern MappingRecord_t* MappingRecordArr;
 extern vector<Chromosome_t> ChromosomeVec;
 extern vector<CoordinatePair_t> DistantPairVec;
-extern vector<string> ReadFileNameVec1, ReadFileNameVec2;
+extern vector<string> ReadFileNameVec1, ReadFileNameVec2, ProfileFileNameVec;
+extern vector<int> GVCFDepthBandVec;
+extern vector<pair<int64_t, int64_t> > TargetRegionVec, PaddedRegionVec;
 extern pthread_mutex_t LibraryLock, ProfileLock, OutputLock, VarLock;
 extern int64_t GenomeSize, TwoGenomeSize, ObservGenomicPos, ObserveBegPos, ObserveEndPos;
-extern char *RefSequence, *RefFileName, *IndexFileName, *KnownSiteFileName, *SamFileName, *VcfFileName, *LogFileName, *sample_id;
-extern bool bDebugMode, bFilter, bPairEnd, bUnique, gzCompressed, FastQFormat, bSAMoutput, bSAMFormat, bVCFoutput, bGVCF, bMonomorphic, bSomatic, NW_ALG;
-extern int iThreadNum, MaxPosDiff, iPloidy, iChromsomeNum, MaxClipSize, WholeChromosomeNum, ChromosomeNumMinusOne, FragmentSize, MinReadDepth, MinAlleleDepth, MinCNVsize, MinUnmappedSize, MinVarConfScore;
+extern char *RefSequence, *RefFileName, *IndexFileName, *KnownSiteFileName, *SamFileName, *VcfFileName, *LogFileName, *RegionFileName, *AlnFileName, *sample_id;
+extern bool bDebugMode, bFilter, bPairEnd, bUnique, gzCompressed, FastQFormat, bSAMoutput, bSAMFormat, bBCFFormat, bVCFoutput, bGVCF, bMonomorphic, bSomatic, bDeepCoverage, NW_ALG;
+extern int iThreadNum, MaxPosDiff, iPloidy, iChromsomeNum, MaxClipSize, WholeChromosomeNum, ChromosomeNumMinusOne, FragmentSize, MinReadDepth, MinAlleleDepth, MinCNVsize, MinUnmappedSize, MinVarConfScore, RegionPadding, MinUniqueMapQ, CallingSliceSize;
 
 extern vector<DiscordPair_t> InversionSiteVec, TranslocationSiteVec;
-extern map<int64_t, map<string, uint16_t> > InsertSeqMap, DeleteSeqMap;
+extern int64_t InversionSiteEnd, TranslocationSiteEnd;
+extern vector<pair<int64_t, uint32_t> > BreakPointVec;
+extern vector<IndEvent_t> InsertEventVec, DeleteEventVec;
+extern int64_t ProfileSize;
 
 // GetData.cpp
 extern void LoadKnownSites(string filename);
 extern bool CheckReadFormat(const char* filename);
 extern bool CheckBWAIndexFiles(string IndexPrefix);
+extern void LoadTargetRegions(const char* filename);
 extern bool CheckReadFile(char* filename, bool& bReadFormat);
 extern int GetNextChunk(bool bSepLibrary, FILE *file, FILE *file2, ReadItem_t* ReadArr);
 extern int gzGetNextChunk(bool bSepLibrary, gzFile file, gzFile file2, ReadItem_t* ReadArr);
 
 // VariantCalling.cpp
 extern void VariantCalling();
+extern ProfileSummary_t SummarizeProfile(int64_t pEnd);
 
 // ReadMapping.cpp
 extern void Mapping();
@@ -239,14 +344,38 @@ extern bool CompByPosDiff(const FragPair_t& p1, const FragPair_t& p2);
 extern vector<AlnCan_t> SimplePairClustering(int rlen, vector<FragPair_t>& SimplePairVec);
 
 // ReadAlignment.cpp
+extern void CollectGapAlignments(ReadItem_t& read, vector<GapAln_t>& GapAlnVec);
+extern void InitGapAlnCache(GapAlnCache_t& cache);
+extern void SolveGapAlignments(vector<GapAln_t>& GapAlnVec, GapAlnCache_t& cache);
 extern bool ProduceReadAlignment(ReadItem_t& read);
 
 // AlignmentRescue.cpp
 extern int AlignmentRescue(uint32_t EstDist, ReadItem_t& read1, ReadItem_t& read2);
 
 // AlignmentProfile.cpp
-extern void UpdateMultiHitCount(ReadItem_t* read, vector<AlnCan_t>& AlnCanVec);
-extern void UpdateProfile(bool bFirstRead, ReadItem_t* read, vector<AlnCan_t>& AlnCanVec);
+extern void InitProfileBlocks();
+extern void ReleaseProfileBlocks();
+extern void ReleaseProfilePages(int64_t beg, int64_t end);
+extern void ReportProfileMemory();
+extern void SaveProfileCheckpoint(const char* filename);
+extern void LoadProfileCheckpoints(vector<string>& FileNameVec);
+extern int64_t LoadProfileCheckpointBlocks(int64_t gPos);
+extern int GetProfileReadCount(int64_t gPos);
+extern int64_t GetProfilePos(int64_t gPos);
+extern int64_t GetProfileBound(int64_t gPos);
+extern int64_t GetProfileRun(int64_t pPos, int64_t pEnd, int64_t& gPos);
+extern int64_t SkipEmptyProfilePages(int64_t gPos, int64_t end);
+extern MappingRecord_t GetProfileColumn(int64_t gPos);
+extern void GetProfileCoverage(int64_t gPos, int len, int* CovArr, uint8_t* RcArr);
+extern void GetProfileCandidates(int64_t gPos, int len, int MinAltCount, int* CovArr, uint8_t* FlagArr);
+extern void MaterializeRangeCounters();
+extern void BuildIndEventView();
+extern bool CompByIndEvent(const IndEvent_t& a, const IndEvent_t& b);
+extern string GetIndEventSeq(const IndEvent_t& ind, bool bDeletion);
+extern void MergeProfileBuffer(ProfileBuffer_t& buf);
+extern bool CheckAlnCanOnTarget(vector<AlnCan_t>& AlnCanVec);
+extern void UpdateMultiHitCount(ReadItem_t* read, vector<AlnCan_t>& AlnCanVec, ProfileBuffer_t& buf);
+extern void UpdateProfile(bool bFirstRead, ReadItem_t* read, vector<AlnCan_t>& AlnCanVec, ProfileBuffer_t& buf);
 
 // SamReport.cpp
 extern void GenerateSingleSamStream(ReadItem_t& read, vector<string>& SamStreamVec);
@@ -259,9 +388,15 @@ extern void ShowSeedLocationInfo(int64_t MyPos);
 extern void ReverseOrientation(ReadItem_t* read);
 extern int64_t GetAlignmentBoundary(int64_t gPos);
 //extern bool CheckFragValidity(FragPair_t FragPair);
+extern char GetComplementaryBase(char c);
 extern void SelfComplementarySeq(int len, char* rseq);
+extern void PushCigarOp(vector<uint32_t>& cigar, int op, int len);
+extern int CalCigarOpLength(vector<uint32_t>& cigar, int op);
+extern int CalCigarColumnNum(vector<uint32_t>& cigar);
 extern Coordinate_t DetermineCoordinate(int64_t gPos);
-extern int GetProfileColumnSize(MappingRecord_t& Profile);
+extern bool CheckRegionOverlap(vector<pair<int64_t, int64_t> >& RegionVec, int64_t beg, int64_t end);
+extern int64_t GetRegionEnd(vector<pair<int64_t, int64_t> >& RegionVec, int64_t gPos);
+extern int GetProfileColumnSize(const MappingRecord_t& Profile);
 extern void ShowIndSeq(int64_t begin_pos, int64_t end_pos);
 extern void ShowFragmentPair(char* ReadSeq, FragPair_t& fp);
 extern void ShowSimplePairInfo(vector<FragPair_t>& FragPairVec);
@@ -269,6 +404,16 @@ extern void GetComplementarySeq(int len, char* seq, char* rseq);
 extern bool CheckAlignmentValidity(vector<FragPair_t>& FragPairVec);
 extern void ShowVariationProfile(int64_t begin_pos, int64_t end_pos);
 
+// seq_kernels.cpp
+extern void InitSeqKernels();
+extern bool SelectSeqKernels(int level);
+extern void SeqEncodeNt4(int len, const char* seq, uint8_t* code);
+extern void SeqReverseComplement(int len, const char* seq, char* rseq);
+extern void SeqSelfReverseComplement(int len, char* seq);
+extern void SeqSelfReverse(int len, char* str);
+extern void SeqReverseCopy(int len, const char* str, char* rstr);
+extern int SeqMismatchNum(int len, const char* s1, const char* s2);
+
 // bwt_index.cpp
 extern void RestoreReferenceInfo();
 extern void bwa_idx_destroy(bwaidx_t *idx);
@@ -286,7 +431,12 @@ extern vector<FragPair_t> GenerateSimplePairsFromCommonKmers(int thr, int64_t gP
 //extern vector<SeedPair_t> GenerateSimplePairsFromFragmentPair(int MaxDist, int len1, char* frag1, int len2, char* frag2);
 
 // nw_alignment.cpp
-extern void nw_alignment(int m, string& s1, int n, string& s2);
+extern void nw_init();
+extern bool nw_set_kernel(int level);
+extern void nw_alignment(int m, string& s1, int n, string& s2, vector<uint32_t>& cigar);
+extern void nw_batch_alignment(vector<GapAln_t>& GapAlnVec);
 
 // ksw2_alignment.cpp
-extern void ksw2_alignment(int m, string& s1, int n, string& s2);
+extern void ksw2_init();
+extern bool ksw2_set_kernel(int level);
+extern int ksw2_alignment(int m, string& s1, int n, string& s2, vector<uint32_t>& cigar);
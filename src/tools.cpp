@@ -18,49 +18,48 @@ char GetComplementaryBase(char c)
 
 void GetComplementarySeq(int len, char* seq, char* rseq)
 {
-	int i, j;
-	for (j = len - 1, i = 0; i<j; i++, j--)
-	{
-		rseq[i] = GetComplementaryBase(seq[j]);
-		rseq[j] = GetComplementaryBase(seq[i]);
-	}
-	if (i == j) rseq[i] = GetComplementaryBase(seq[i]);
+	SeqReverseComplement(len, seq, rseq);
 	rseq[len] = '\0';
 }
 
 void SelfComplementarySeq(int len, char* seq)
 {
-	char c;
-	int i, j;
-
-	for (j = len - 1, i = 0; i < j; i++, j--)
-	{
-		c = seq[i];
-		seq[i] = GetComplementaryBase(seq[j]);
-		seq[j] = GetComplementaryBase(c);;
-	}
-	if (i == j) seq[i] = GetComplementaryBase(seq[i]);
+	SeqSelfReverseComplement(len, seq);
 }
 
 void ReverseOrientation(ReadItem_t* read)
 {
-	char* rseq;
-
-	rseq = new char[read->rlen + 1];
-	GetComplementarySeq(read->rlen, read->seq, rseq);
-	strcpy(read->seq, rseq);
-	copy(rseq, rseq + read->rlen, read->seq);
-	if (read->qual != NULL) reverse(read->qual, read->qual + read->rlen);
-	delete[] rseq;
+	SeqSelfReverseComplement(read->rlen, read->seq);
+	if (read->qual != NULL) SeqSelfReverse(read->rlen, read->qual);
 }
 
 int CalFragPairNonIdenticalBases(int len, char* frag1, char* frag2)
 {
-	int i, c;
+	return SeqMismatchNum(len, frag1, frag2);
+}
 
-	for (c = 0, i = 0; i < len; i++) if (frag1[i] != frag2[i]) c++;
+void PushCigarOp(vector<uint32_t>& cigar, int op, int len)
+{
+	if (cigar.size() > 0 && (int)(cigar.back() & 0xf) == op) cigar.back() += (uint32_t)len << 4;
+	else cigar.push_back((uint32_t)len << 4 | op);
+}
+
+int CalCigarOpLength(vector<uint32_t>& cigar, int op)
+{
+	int len = 0;
+
+	for (vector<uint32_t>::iterator iter = cigar.begin(); iter != cigar.end(); iter++) if ((int)(*iter & 0xf) == op) len += *iter >> 4;
 
-	return c;
+	return len;
+}
+
+int CalCigarColumnNum(vector<uint32_t>& cigar)
+{
+	int len = 0;
+
+	for (vector<uint32_t>::iterator iter = cigar.begin(); iter != cigar.end(); iter++) len += *iter >> 4;
+
+	return len;
 }
 
 void ShowFragmentPair(char* ReadSeq, FragPair_t& fp)
@@ -92,7 +91,9 @@ void ShowSimplePairInfo(vector<FragPair_t>& FragPairVec)
 			}
 			else //if (iter->rLen > 0 || iter->gLen > 0)
 			{
-				printf("\t\t%s\n\t\t%s\n", iter->aln1.c_str(), iter->aln2.c_str());
+				printf("\t\t");
+				for (vector<uint32_t>::const_iterator CigarIter = iter->cigar.begin(); CigarIter != iter->cigar.end(); CigarIter++) printf("%d%c", *CigarIter >> 4, "MIDNSHP=X"[*CigarIter & 0xf]);
+				printf("\n");
 			}
 		}
 	}
@@ -129,6 +130,23 @@ bool CheckAlignmentValidity(vector<FragPair_t>& FragPairVec)
 	}
 }
 
+bool CheckRegionOverlap(vector<pair<int64_t, int64_t> >& RegionVec, int64_t beg, int64_t end)
+{
+	// RegionVec is sorted and merged; [beg, end) overlaps the last interval starting before end
+	vector<pair<int64_t, int64_t> >::iterator iter = upper_bound(RegionVec.begin(), RegionVec.end(), make_pair(end, (int64_t)-1));
+
+	return iter != RegionVec.begin() && (--iter)->second > beg;
+}
+
+int64_t GetRegionEnd(vector<pair<int64_t, int64_t> >& RegionVec, int64_t gPos)
+{
+	// end of the interval containing gPos (GenomeSize without regions or outside them)
+	vector<pair<int64_t, int64_t> >::iterator iter = upper_bound(RegionVec.begin(), RegionVec.end(), make_pair(gPos, GenomeSize));
+
+	if (iter != RegionVec.begin() && (--iter)->second > gPos) return iter->second;
+	return GenomeSize;
+}
+
 Coordinate_t DetermineCoordinate(int64_t gPos)
 {
 	Coordinate_t coor;
@@ -163,15 +181,16 @@ Coordinate_t DetermineCoordinate(int64_t gPos)
 	return coor;
 }
 
-int GetProfileColumnSize(MappingRecord_t& Profile)
+int GetProfileColumnSize(const MappingRecord_t& Profile)
 {
 	return (int)Profile.A + (int)Profile.C + (int)Profile.G + (int)Profile.T;
 }
 
 void ShowProfileColumn(int64_t gPos)
 {
-	int cov = GetProfileColumnSize(MappingRecordArr[gPos]) + MappingRecordArr[gPos].multi_hit;
-	printf("%lld[%c]: cov=%d [A=%d C=%d G=%d T=%d] dup=%d\n", (long long)gPos, RefSequence[gPos], cov, (int)MappingRecordArr[gPos].A, (int)MappingRecordArr[gPos].C, (int)MappingRecordArr[gPos].G, (int)MappingRecordArr[gPos].T, (int)MappingRecordArr[gPos].multi_hit);
+	MappingRecord_t Profile = GetProfileColumn(gPos);
+	int cov = GetProfileColumnSize(Profile) + Profile.multi_hit;
+	printf("%lld[%c]: cov=%d [A=%d C=%d G=%d T=%d] dup=%d\n", (long long)gPos, RefSequence[gPos], cov, (int)Profile.A, (int)Profile.C, (int)Profile.G, (int)Profile.T, (int)Profile.multi_hit);
 }
 
 void ShowVariationProfile(int64_t begin_pos, int64_t end_pos)
@@ -186,20 +205,14 @@ void ShowVariationProfile(int64_t begin_pos, int64_t end_pos)
 
 void ShowIndSeq(int64_t begin_pos, int64_t end_pos)
 {
-	for (map<int64_t, map<string, uint16_t> >::iterator iter = InsertSeqMap.begin(); iter != InsertSeqMap.end(); iter++)
+	for (vector<IndEvent_t>::iterator iter = InsertEventVec.begin(); iter != InsertEventVec.end(); iter++)
 	{
-		if (iter->first >= begin_pos && iter->first <= end_pos)
-		{
-			for (map<string, uint16_t>::iterator SeqMapIter = iter->second.begin(); SeqMapIter != iter->second.end(); SeqMapIter++)
-				fprintf(stdout, "INS:%lld	[%s] freq=%d\n", (long long)iter->first, (char*)SeqMapIter->first.c_str(), SeqMapIter->second);
-		}
+		if (iter->gPos >= begin_pos && iter->gPos <= end_pos)
+			fprintf(stdout, "INS:%lld	[%s] freq=%d\n", (long long)iter->gPos, GetIndEventSeq(*iter, false).c_str(), (int)iter->count);
 	}
-	for (map<int64_t, map<string, uint16_t> >::iterator iter = DeleteSeqMap.begin(); iter != DeleteSeqMap.end(); iter++)
+	for (vector<IndEvent_t>::iterator iter = DeleteEventVec.begin(); iter != DeleteEventVec.end(); iter++)
 	{
-		if (iter->first >= begin_pos && iter->first < end_pos)
-		{
-			for (map<string, uint16_t>::iterator SeqMapIter = iter->second.begin(); SeqMapIter != iter->second.end(); SeqMapIter++)
-				fprintf(stdout, "DEL:%lld	%d	[%s]\n", (long long)iter->first, SeqMapIter->second, (char*)SeqMapIter->first.c_str());
-		}
+		if (iter->gPos >= begin_pos && iter->gPos < end_pos)
+			fprintf(stdout, "DEL:%lld	%d	[%s]\n", (long long)iter->gPos, (int)iter->count, GetIndEventSeq(*iter, true).c_str());
 	}
 }
@@ -0,0 +1,28 @@
+#!/bin/bash
+# checks that calling from the mapper's own BAM (-aln) gives the VCF of the mapping run that wrote it:
+# the sample moves 3kb of chr3 into chr1, so the strand counts, the clipped reads and the
+# translocation evidence of discordant pairs are all compared
+. ./TestData.sh
+tmp=$(mktemp -d)
+trap 'rm -rf $tmp' EXIT
+
+MakeGenome ref.fa $tmp/ref.fa "$Chromosomes"
+MakeGenome mut.fa $tmp/mut.fa "0-8500+40000-43000+8500-17000 17000-35000 35000-40000+43000-52500 52500-70000"
+SimulateReads $tmp/mut.fa 12000 11 $tmp/r1.fq $tmp/r2.fq
+
+$MapCaller index $tmp/ref.fa $tmp/ref > /dev/null 2>&1
+$MapCaller -i $tmp/ref -t 4 -f $tmp/r1.fq -f2 $tmp/r2.fq -bam $tmp/map.bam -vcf $tmp/map.vcf -log $tmp/log > /dev/null 2>&1
+$MapCaller -i $tmp/ref -t 4 -aln $tmp/map.bam -vcf $tmp/aln.vcf -log $tmp/log > /dev/null 2>&1
+if [ ! -s $tmp/map.vcf ] || [ ! -s $tmp/aln.vcf ]; then
+	echo "AlnTest: cannot call the variants"
+	exit 1
+fi
+fail=0
+if ! cmp -s <(grep -v '^##command_line' $tmp/map.vcf) <(grep -v '^##command_line' $tmp/aln.vcf); then
+	echo "AlnTest: the -aln VCF differs from the mapping run"; fail=1
+fi
+if [ $(grep -c '<TNL>' $tmp/aln.vcf) -eq 0 ]; then
+	echo "AlnTest: the translocation is not called"; fail=1
+fi
+echo "AlnTest: $(grep -vc '^#' $tmp/aln.vcf) records, $([ $fail = 0 ] && echo "-aln reproduces the mapping run" || echo FAILED)"
+exit $fail
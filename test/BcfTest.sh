@@ -0,0 +1,37 @@
+#!/bin/bash
+# checks that the BCF output (-bcf), read back as text with the htslib of MapCaller, holds the records of the VCF output,
+# with the default output, -gvcf and -monomorphic
+. ./TestData.sh
+tmp=$(mktemp -d)
+trap 'rm -rf $tmp' EXIT
+htslib=../src/htslib
+
+MakeGenome ref.fa $tmp/ref.fa "$Chromosomes"; MakeGenome mut.fa $tmp/mut.fa "$Chromosomes"
+SimulateReads $tmp/mut.fa 12000 7 $tmp/r1.fq $tmp/r2.fq
+
+# the records of a VCF with the sample AF printed as in the VCF output (htslib prints floats with %g), then its sorted header lines;
+# the VCF header declares MIN_DP as FORMAT only, the BCF one has to declare the gVCF block INFO tag as well
+Normalize()
+{
+	grep -v '^#' $1 | awk 'BEGIN { FS = OFS = "\t" } { n = split($9, key, ":"); split($10, val, ":");
+		for (i = 1; i <= n; i++) if (key[i] == "AF" && val[i] != ".") val[i] = sprintf("%.2f", val[i]);
+		s = val[1]; for (i = 2; i <= n; i++) s = s ":" val[i]; $10 = s; print }'
+	grep '^##' $1 | grep -v '^##command_line\|^##INFO=<ID=MIN_DP,' | sort
+}
+
+$MapCaller index $tmp/ref.fa $tmp/ref > /dev/null 2>&1
+fail=0
+for opt in "" "-gvcf" "-monomorphic"; do
+	$MapCaller -i $tmp/ref -t 4 -f $tmp/r1.fq -f2 $tmp/r2.fq $opt -profile $tmp/ref.prof -vcf $tmp/out.vcf -log $tmp/log > /dev/null 2>&1
+	$MapCaller call -i $tmp/ref -t 4 -profile $tmp/ref.prof $opt -bcf $tmp/out.bcf -log $tmp/log > /dev/null 2>&1
+	if [ ! -s $tmp/out.vcf ] || ! $htslib/htsfile -c $tmp/out.bcf > $tmp/bcf.vcf 2>$tmp/err || [ ! -s $tmp/bcf.vcf ]; then
+		echo "BcfTest: [${opt:-default}] cannot call the variants"
+		exit 1
+	fi
+	if ! cmp -s <(Normalize $tmp/out.vcf) <(Normalize $tmp/bcf.vcf) || ! cmp -s <(grep '^#CHROM' $tmp/out.vcf) <(grep '^#CHROM' $tmp/bcf.vcf); then
+		echo "BcfTest: [${opt:-default}] the BCF differs from the VCF"; fail=1
+	fi
+	echo "BcfTest: [${opt:-default}] $(grep -vc '^#' $tmp/bcf.vcf) records"
+done
+echo "BcfTest: $([ $fail = 0 ] && echo "the BCF holds the records of the VCF" || echo FAILED)"
+exit $fail
@@ -0,0 +1,34 @@
+#!/bin/bash
+# checks that calling from a profile checkpoint ('call -profile') gives the VCF of the mapping run that wrote it,
+# with the default and the deep-coverage (-deep) profile, and that a truncated checkpoint or one with a bad end mark is rejected
+. ./TestData.sh
+tmp=$(mktemp -d)
+trap 'rm -rf $tmp' EXIT
+
+MakeGenome ref.fa $tmp/ref.fa "$Chromosomes"; MakeGenome mut.fa $tmp/mut.fa "$Chromosomes"
+SimulateReads $tmp/mut.fa 12000 7 $tmp/r1.fq $tmp/r2.fq
+
+$MapCaller index $tmp/ref.fa $tmp/ref > /dev/null 2>&1
+fail=0
+for opt in "" "-deep"; do
+	$MapCaller -i $tmp/ref -t 4 -f $tmp/r1.fq -f2 $tmp/r2.fq $opt -profile $tmp/ref.prof -vcf $tmp/map.vcf -log $tmp/log > /dev/null 2>&1
+	$MapCaller call -i $tmp/ref -t 4 -profile $tmp/ref.prof -slice_size 1 -vcf $tmp/call.vcf -log $tmp/log > /dev/null 2>&1
+	if [ ! -s $tmp/map.vcf ] || [ ! -s $tmp/call.vcf ]; then
+		echo "CheckpointTest: [${opt:-default}] cannot call the variants"
+		exit 1
+	fi
+	if ! cmp -s <(grep -v '^##command_line' $tmp/map.vcf) <(grep -v '^##command_line' $tmp/call.vcf); then
+		echo "CheckpointTest: [${opt:-default}] the call VCF differs from the mapping run"; fail=1
+	fi
+	echo "CheckpointTest: [${opt:-default}] $(grep -vc '^#' $tmp/call.vcf) records"
+done
+# the last checkpoint cut in half, and with its end mark overwritten
+head -c $(($(wc -c < $tmp/ref.prof) / 2)) $tmp/ref.prof > $tmp/cut.prof
+gzip -dc $tmp/ref.prof | head -c -4 > $tmp/bad; printf 'XXXX' >> $tmp/bad; gzip -c $tmp/bad > $tmp/bad.prof
+for f in cut bad; do
+	if $MapCaller call -i $tmp/ref -t 4 -profile $tmp/$f.prof -vcf $tmp/$f.vcf -log $tmp/log > /dev/null 2>$tmp/err || ! grep -q 'truncated or corrupt' $tmp/err; then
+		echo "CheckpointTest: the $f checkpoint is not rejected"; fail=1
+	fi
+done
+echo "CheckpointTest: $([ $fail = 0 ] && echo "call reproduces the mapping run, damaged checkpoints are rejected" || echo FAILED)"
+exit $fail
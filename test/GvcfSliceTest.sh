@@ -0,0 +1,35 @@
+#!/bin/bash
+# checks that the calling slice size does not change the (g)VCF output:
+# reads simulated from test/mut.fa are profiled once against test/ref.fa cut into four chromosomes,
+# and the profile is called with one chromosome per slice (-slice_size 1) and with a single slice
+. ./TestData.sh
+tmp=$(mktemp -d)
+trap 'rm -rf $tmp' EXIT
+
+MakeGenome ref.fa $tmp/ref.fa "$Chromosomes"; MakeGenome mut.fa $tmp/mut.fa "$Chromosomes"
+SimulateReads $tmp/mut.fa 12000 7 $tmp/r1.fq $tmp/r2.fq
+
+$MapCaller index $tmp/ref.fa $tmp/ref > /dev/null 2>&1
+$MapCaller -i $tmp/ref -t 4 -f $tmp/r1.fq -f2 $tmp/r2.fq -no_vcf -profile $tmp/ref.prof -log $tmp/log > /dev/null 2>&1
+if [ ! -s $tmp/ref.prof ]; then
+	echo "GvcfSliceTest: cannot build the alignment profile"
+	exit 1
+fi
+fail=0
+for opt in "-gvcf" "-gvcf -gvcf_dp_bands 5,10,20 -filter" "-filter"; do
+	for size in 1 16777216; do
+		$MapCaller call -i $tmp/ref -profile $tmp/ref.prof $opt -slice_size $size -vcf $tmp/out_$size.vcf -log $tmp/log > /dev/null 2>&1
+		grep -v '^##command_line' $tmp/out_$size.vcf > $tmp/cmp_$size.vcf
+	done
+	if ! cmp -s $tmp/cmp_1.vcf $tmp/cmp_16777216.vcf; then
+		echo "GvcfSliceTest: [$opt] differs between slice sizes 1 and 16777216"; fail=1
+	fi
+	echo "GvcfSliceTest: [$opt] $(grep -vc '^#' $tmp/cmp_1.vcf) records"
+	[ "$opt" = "-gvcf" ] && cp $tmp/cmp_1.vcf $tmp/gvcf.vcf
+done
+# a gVCF block does not run into the next chromosome, so each chromosome starts with its own block
+if [ $(grep -v '^#' $tmp/gvcf.vcf | awk '$1 != chr { chr = $1; if ($2 <= 300) n++ } END { print n + 0 }') -ne 4 ]; then
+	echo "GvcfSliceTest: a chromosome does not start with a gVCF block"; fail=1
+fi
+echo "GvcfSliceTest: $([ $fail = 0 ] && echo "the output does not depend on the slice size" || echo FAILED)"
+exit $fail
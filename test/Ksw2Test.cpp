@@ -0,0 +1,85 @@
+#include "../src/structure.h"
+
+// ksw_extz2_sse/avx2/avx512 must give the same score and CIGAR; every kernel the CPU supports is compared with SSE4.1
+
+static const char* KernelNameArr[] = { "SSE4.1", "AVX2", "AVX-512BW" };
+extern int8_t mat[25];
+
+static void RandomSeq(int len, string& seq)
+{
+	seq.resize(len);
+	for (int i = 0; i < len; i++) seq[i] = "ACGT"[rand() & 3];
+}
+
+static void MutateSeq(string& src, string& seq)
+{
+	// substitutions and short indels at about 5% of the positions
+	seq.clear();
+	for (int i = 0; i < (int)src.length(); i++)
+	{
+		int r = rand() % 100;
+		if (r == 0) continue;
+		else if (r == 1) seq.push_back(src[i]), seq.append(1 + rand() % 4, "ACGT"[rand() & 3]);
+		else if (r < 5) seq.push_back("ACGT"[rand() & 3]);
+		else seq.push_back(src[i]);
+	}
+	if (seq.length() == 0) seq = src;
+}
+
+static bool CheckCigar(int m, string& s1, int n, string& s2, vector<uint32_t>& cigar, int score)
+{
+	// the CIGAR spans both sequences and its score (match mat[0], mismatch mat[1], a gap of length l costs 2 + l) is the reported one
+	int i = 0, j = 0, sc = 0, len, op;
+
+	for (vector<uint32_t>::iterator iter = cigar.begin(); iter != cigar.end(); iter++)
+	{
+		len = *iter >> 4; op = *iter & 0xf;
+		if (op == CIGAR_M)
+		{
+			for (int k = 0; k < len; k++, i++, j++) sc += s1[i] == s2[j] ? mat[0] : mat[1];
+		}
+		else if (op == CIGAR_I) i += len, sc -= 2 + len;
+		else if (op == CIGAR_D) j += len, sc -= 2 + len;
+		else return false;
+	}
+	return i == m && j == n && sc == score;
+}
+
+int main()
+{
+	int t, k, m, n, score, fail = 0, pairs = 0;
+	int LenArr[] = { 1, 2, 15, 16, 17, 31, 32, 33, 63, 64, 65, 127, 128, 129, 150, 300 };
+	string s1, s2;
+	vector<uint32_t> cigar, cigar0;
+	bool bSupported[3];
+
+	srand(1);
+	for (k = 0; k < 3; k++) bSupported[k] = ksw2_set_kernel(k);
+	for (t = 0; t < 4000; t++)
+	{
+		if (t < 16 * 16) m = LenArr[t / 16], n = LenArr[t % 16], RandomSeq(m, s1), RandomSeq(n, s2);
+		else
+		{
+			RandomSeq(1 + rand() % 300, s1); MutateSeq(s1, s2);
+			m = (int)s1.length(); n = (int)s2.length();
+		}
+		ksw2_set_kernel(0); score = ksw2_alignment(m, s1, n, s2, cigar0); pairs++;
+		if (!CheckCigar(m, s1, n, s2, cigar0, score))
+		{
+			if (fail++ < 10) fprintf(stderr, "SSE4.1: inconsistent CIGAR/score for m=%d n=%d\n", m, n);
+		}
+		for (k = 1; k < 3; k++)
+		{
+			if (!bSupported[k]) continue;
+			ksw2_set_kernel(k);
+			if (ksw2_alignment(m, s1, n, s2, cigar) != score || cigar != cigar0)
+			{
+				if (fail++ < 10) fprintf(stderr, "%s differs from SSE4.1 for m=%d n=%d\n", KernelNameArr[k], m, n);
+			}
+		}
+	}
+	for (k = 0; k < 3; k++) fprintf(stderr, "Ksw2Test: %s %s\n", KernelNameArr[k], bSupported[k] ? "tested" : "not supported by this CPU");
+	fprintf(stderr, "Ksw2Test: %d pairs, %d failures\n", pairs, fail);
+
+	return fail > 0 ? 1 : 0;
+}
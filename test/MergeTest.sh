@@ -0,0 +1,25 @@
+#!/bin/bash
+# checks that merging the checkpoints of two read shards ('merge') gives the VCF of a single run over all the reads
+. ./TestData.sh
+tmp=$(mktemp -d)
+trap 'rm -rf $tmp' EXIT
+
+MakeGenome ref.fa $tmp/ref.fa "$Chromosomes"; MakeGenome mut.fa $tmp/mut.fa "$Chromosomes"
+SimulateReads $tmp/mut.fa 6000 7 $tmp/a1.fq $tmp/a2.fq; SimulateReads $tmp/mut.fa 6000 13 $tmp/b1.fq $tmp/b2.fq
+cat $tmp/a1.fq $tmp/b1.fq > $tmp/r1.fq; cat $tmp/a2.fq $tmp/b2.fq > $tmp/r2.fq
+
+$MapCaller index $tmp/ref.fa $tmp/ref > /dev/null 2>&1
+$MapCaller -i $tmp/ref -t 4 -f $tmp/a1.fq -f2 $tmp/a2.fq -no_vcf -profile $tmp/a.prof -log $tmp/log > /dev/null 2>&1
+$MapCaller -i $tmp/ref -t 4 -f $tmp/b1.fq -f2 $tmp/b2.fq -no_vcf -profile $tmp/b.prof -log $tmp/log > /dev/null 2>&1
+$MapCaller -i $tmp/ref -t 4 -f $tmp/r1.fq -f2 $tmp/r2.fq -vcf $tmp/all.vcf -log $tmp/log > /dev/null 2>&1
+$MapCaller merge -i $tmp/ref -t 4 -profile $tmp/a.prof $tmp/b.prof -slice_size 1 -vcf $tmp/merge.vcf -log $tmp/log > /dev/null 2>&1
+if [ ! -s $tmp/all.vcf ] || [ ! -s $tmp/merge.vcf ]; then
+	echo "MergeTest: cannot call the variants"
+	exit 1
+fi
+fail=0
+if ! cmp -s <(grep -v '^##command_line' $tmp/all.vcf) <(grep -v '^##command_line' $tmp/merge.vcf); then
+	echo "MergeTest: the merged VCF differs from the single run"; fail=1
+fi
+echo "MergeTest: $(grep -vc '^#' $tmp/merge.vcf) records, $([ $fail = 0 ] && echo "merging two shards reproduces the single run" || echo FAILED)"
+exit $fail
@@ -0,0 +1,89 @@
+#include "../src/structure.h"
+
+// nw_batch_alignment must give the CIGAR of nw_alignment for every problem, on every lane width the CPU supports;
+// problems longer than 512bp take the scalar fallback inside the batch call
+
+static const char* KernelNameArr[] = { "SSE4.1", "AVX2", "AVX-512BW" };
+
+static void RandomSeq(int len, string& seq)
+{
+	seq.resize(len);
+	for (int i = 0; i < len; i++) seq[i] = "ACGT"[rand() & 3];
+}
+
+static void MutateSeq(string& src, string& seq)
+{
+	// substitutions and short indels at about 10% of the positions
+	seq.clear();
+	for (int i = 0; i < (int)src.length(); i++)
+	{
+		int r = rand() % 100;
+		if (r < 2) continue;
+		else if (r < 4) seq.push_back(src[i]), seq.append(1 + rand() % 3, "ACGT"[rand() & 3]);
+		else if (r < 10) seq.push_back("ACGT"[rand() & 3]);
+		else seq.push_back(src[i]);
+	}
+	if (seq.length() == 0) seq = src;
+}
+
+static void AddProblem(string& rseq, string& gseq, vector<FragPair_t>& FragPairVec, vector<GapAln_t>& GapAlnVec)
+{
+	GapAln_t gap;
+	FragPair_t fp = FragPair_t();
+
+	fp.rLen = (int)rseq.length(); fp.gLen = (int)gseq.length();
+	FragPairVec.push_back(fp); gap.fp = NULL; gap.rseq = rseq; gap.gseq = gseq;
+	GapAlnVec.push_back(gap);
+}
+
+static int RunBatch(int level, vector<FragPair_t>& FragPairVec, vector<GapAln_t>& GapAlnVec)
+{
+	int i, num = (int)GapAlnVec.size(), fail = 0;
+	vector<uint32_t> cigar;
+
+	for (i = 0; i < num; i++) FragPairVec[i].cigar.clear(), GapAlnVec[i].fp = &FragPairVec[i];
+	nw_batch_alignment(GapAlnVec);
+	for (i = 0; i < num; i++)
+	{
+		nw_alignment(FragPairVec[i].rLen, GapAlnVec[i].rseq, FragPairVec[i].gLen, GapAlnVec[i].gseq, cigar);
+		if (cigar != FragPairVec[i].cigar)
+		{
+			if (fail++ < 10) fprintf(stderr, "%s batch differs from nw_alignment for rLen=%d gLen=%d\n", KernelNameArr[level], FragPairVec[i].rLen, FragPairVec[i].gLen);
+		}
+	}
+	return fail;
+}
+
+int main()
+{
+	int i, j, k, fail = 0, num = 0;
+	int LenArr[] = { 1, 2, 7, 8, 9, 15, 16, 17, 31, 32, 33, 100, 511, 512, 513, 600 };
+	string s1, s2;
+	vector<FragPair_t> FragPairVec;
+	vector<GapAln_t> GapAlnVec;
+	bool bSupported[3];
+
+	srand(1);
+	for (k = 0; k < 3; k++) bSupported[k] = nw_set_kernel(k);
+
+	// edge lengths, tie-rich repeats and random/mutated pairs share one call, so the batches mix problem sizes
+	for (i = 0; i < 16; i++) for (j = 0; j < 16; j++) RandomSeq(LenArr[i], s1), RandomSeq(LenArr[j], s2), AddProblem(s1, s2, FragPairVec, GapAlnVec);
+	for (i = 1; i <= 20; i++) s1.assign(i, 'A'), s2.assign(1 + i / 3, 'A'), AddProblem(s1, s2, FragPairVec, GapAlnVec), AddProblem(s2, s1, FragPairVec, GapAlnVec);
+	for (i = 0; i < 1000; i++) RandomSeq(1 + rand() % 60, s1), MutateSeq(s1, s2), AddProblem(s1, s2, FragPairVec, GapAlnVec);
+	for (i = 0; i < 20; i++) RandomSeq(490 + rand() % 40, s1), MutateSeq(s1, s2), AddProblem(s1, s2, FragPairVec, GapAlnVec);
+
+	for (k = 0; k < 3; k++)
+	{
+		if (!bSupported[k]) continue;
+		nw_set_kernel(k); fail += RunBatch(k, FragPairVec, GapAlnVec); num += (int)GapAlnVec.size();
+
+		// a batch with a single occupied lane
+		vector<FragPair_t> OneFragPairVec(FragPairVec.begin() + 300, FragPairVec.begin() + 301);
+		vector<GapAln_t> OneGapAlnVec(GapAlnVec.begin() + 300, GapAlnVec.begin() + 301);
+		fail += RunBatch(k, OneFragPairVec, OneGapAlnVec); num++;
+	}
+	for (k = 0; k < 3; k++) fprintf(stderr, "NwBatchTest: %s %s\n", KernelNameArr[k], bSupported[k] ? "tested" : "not supported by this CPU");
+	fprintf(stderr, "NwBatchTest: %d problems, %d failures\n", num, fail);
+
+	return fail > 0 ? 1 : 0;
+}
@@ -0,0 +1,34 @@
+#!/bin/bash
+# checks that profiling only the target regions (-regions) calls the targets as the whole-genome run does:
+# the targets include chromosome ends, a small target and two targets whose paddings overlap
+. ./TestData.sh
+tmp=$(mktemp -d)
+trap 'rm -rf $tmp' EXIT
+
+MakeGenome ref.fa $tmp/ref.fa "$Chromosomes"; MakeGenome mut.fa $tmp/mut.fa "$Chromosomes"
+SimulateReads $tmp/mut.fa 12000 7 $tmp/r1.fq $tmp/r2.fq
+printf "chr1\t0\t1200\nchr1\t4500\t4700\nchr1\t4800\t5300\nchr2\t10000\t12000\nchr3\t16700\t17500\nchr4\t7000\t7020\n" > $tmp/targets.bed
+
+$MapCaller index $tmp/ref.fa $tmp/ref > /dev/null 2>&1
+$MapCaller -i $tmp/ref -t 4 -f $tmp/r1.fq -f2 $tmp/r2.fq -vcf $tmp/full.vcf -log $tmp/log > /dev/null 2>&1
+$MapCaller -i $tmp/ref -t 4 -f $tmp/r1.fq -f2 $tmp/r2.fq -regions $tmp/targets.bed -vcf $tmp/regions.vcf -log $tmp/log > /dev/null 2>$tmp/err
+if [ ! -s $tmp/full.vcf ] || [ ! -s $tmp/regions.vcf ]; then
+	echo "RegionsTest: cannot call the variants"
+	exit 1
+fi
+# the records of the whole-genome run within the targets (BED is 0-based, half-open)
+InTargets()
+{
+	grep -v '^#' $2 | awk 'NR == FNR { beg[NR] = $2; end[NR] = $3; chr[NR] = $1; n = NR; next }
+		{ for (i = 1; i <= n; i++) if ($1 == chr[i] && $2 > beg[i] && $2 <= end[i]) { print; next } }' $1 -
+}
+fail=0
+InTargets $tmp/targets.bed $tmp/full.vcf > $tmp/full_in.vcf; InTargets $tmp/targets.bed $tmp/regions.vcf > $tmp/regions_in.vcf
+if [ ! -s $tmp/full_in.vcf ] || ! cmp -s $tmp/full_in.vcf $tmp/regions_in.vcf; then
+	echo "RegionsTest: the target records differ from the whole-genome run"; fail=1
+fi
+if [ $(grep -vc '^#' $tmp/regions.vcf) -ne $(wc -l < $tmp/regions_in.vcf) ]; then
+	echo "RegionsTest: a record lies outside the targets"; fail=1
+fi
+echo "RegionsTest: $(wc -l < $tmp/regions_in.vcf) target records, $(grep -o '[0-9]* / [0-9]* pages' $tmp/err | tail -1), $([ $fail = 0 ] && echo "-regions reproduces the whole-genome run" || echo FAILED)"
+exit $fail
@@ -0,0 +1,156 @@
+#include "../src/structure.h"
+#include <sys/time.h>
+
+// the SSE4.1 and AVX2 sequence kernels are compared with scalar code on random input, including mixed case and
+// non-ACGT bytes, at the vector-width edge lengths; "SeqKernelTest bench" times them against the scalar code
+
+static const char* KernelNameArr[] = { "SSE4.1", "AVX2" };
+static const int GuardSize = 64;
+
+static char ScalarComplement(char c)
+{
+	switch (c)
+	{
+	case 'A': case 'a': return 'T';
+	case 'C': case 'c': return 'G';
+	case 'G': case 'g': return 'C';
+	case 'T': case 't': return 'A';
+	default: return 'N';
+	}
+}
+
+static void ScalarEncode(int len, const char* seq, uint8_t* code)
+{
+	for (int i = 0; i < len; i++) code[i] = nst_nt4_table[(uint8_t)seq[i]];
+}
+
+static void ScalarReverseComplement(int len, const char* seq, char* rseq)
+{
+	for (int i = 0; i < len; i++) rseq[len - 1 - i] = ScalarComplement(seq[i]);
+}
+
+static void ScalarSelfReverseComplement(int len, char* seq)
+{
+	char c;
+	for (int i = 0, j = len - 1; i <= j; i++, j--) c = seq[i], seq[i] = ScalarComplement(seq[j]), seq[j] = ScalarComplement(c);
+}
+
+static void ScalarReverseCopy(int len, const char* str, char* rstr)
+{
+	for (int i = 0; i < len; i++) rstr[len - 1 - i] = str[i];
+}
+
+static int ScalarMismatchNum(int len, const char* s1, const char* s2)
+{
+	int n = 0;
+	for (int i = 0; i < len; i++) if (s1[i] != s2[i]) n++;
+	return n;
+}
+
+static void RandomSeq(int len, char* seq, bool bNoisy)
+{
+	// bNoisy adds lower case, N and arbitrary bytes
+	for (int i = 0; i < len; i++)
+	{
+		int r = rand() % 100;
+		if (!bNoisy || r < 80) seq[i] = "ACGT"[rand() & 3];
+		else if (r < 90) seq[i] = "acgt"[rand() & 3];
+		else if (r < 95) seq[i] = 'N';
+		else seq[i] = (char)(1 + rand() % 255);
+	}
+}
+
+static int CheckKernels(int level, int len, bool bNoisy)
+{
+	// every output buffer is surrounded by guard bytes that must stay untouched
+	int fail = 0;
+	vector<char> seq(len + 1), seq2(len + 1), out(len + 2 * GuardSize, 'x'), ref(len + 2 * GuardSize, 'x'), inplace;
+	vector<uint8_t> code(len + 2 * GuardSize, 0xee), code_ref(len + 2 * GuardSize, 0xee);
+
+	RandomSeq(len, seq.data(), bNoisy); memcpy(seq2.data(), seq.data(), len);
+	for (int i = 0; i < len; i++) if (rand() % 8 == 0) seq2[i] = "ACGT"[rand() & 3];
+
+	SeqEncodeNt4(len, seq.data(), code.data() + GuardSize); ScalarEncode(len, seq.data(), code_ref.data() + GuardSize);
+	if (code != code_ref) fail++, fprintf(stderr, "%s SeqEncodeNt4 differs at len=%d\n", KernelNameArr[level], len);
+
+	SeqReverseComplement(len, seq.data(), out.data() + GuardSize); ScalarReverseComplement(len, seq.data(), ref.data() + GuardSize);
+	if (out != ref) fail++, fprintf(stderr, "%s SeqReverseComplement differs at len=%d\n", KernelNameArr[level], len);
+
+	inplace.assign(out.size(), 'x'); memcpy(inplace.data() + GuardSize, seq.data(), len); SeqSelfReverseComplement(len, inplace.data() + GuardSize);
+	if (inplace != ref) fail++, fprintf(stderr, "%s SeqSelfReverseComplement differs at len=%d\n", KernelNameArr[level], len);
+
+	out.assign(out.size(), 'x'); ref.assign(ref.size(), 'x');
+	SeqReverseCopy(len, seq.data(), out.data() + GuardSize); ScalarReverseCopy(len, seq.data(), ref.data() + GuardSize);
+	if (out != ref) fail++, fprintf(stderr, "%s SeqReverseCopy differs at len=%d\n", KernelNameArr[level], len);
+
+	inplace.assign(out.size(), 'x'); memcpy(inplace.data() + GuardSize, seq.data(), len); SeqSelfReverse(len, inplace.data() + GuardSize);
+	if (inplace != ref) fail++, fprintf(stderr, "%s SeqSelfReverse differs at len=%d\n", KernelNameArr[level], len);
+
+	if (SeqMismatchNum(len, seq.data(), seq2.data()) != ScalarMismatchNum(len, seq.data(), seq2.data())) fail++, fprintf(stderr, "%s SeqMismatchNum differs at len=%d\n", KernelNameArr[level], len);
+
+	return fail;
+}
+
+static double GetTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// ns per call of a 150bp read (or len bytes) for the scalar code and each supported kernel
+#define BENCH(name, scalar_call, kernel_call) \
+	{ \
+		double t, ScalarNs, KernelNs[2]; int k, r; \
+		for (t = GetTime(), r = 0; r < rounds; r++) { scalar_call; sink += buf[r & 7]; } ScalarNs = (GetTime() - t) * 1e9 / rounds; \
+		for (k = 0; k < 2; k++) \
+		{ \
+			if (!bSupported[k]) { KernelNs[k] = 0; continue; } \
+			SelectSeqKernels(k); \
+			for (t = GetTime(), r = 0; r < rounds; r++) { kernel_call; sink += buf[r & 7]; } KernelNs[k] = (GetTime() - t) * 1e9 / rounds; \
+		} \
+		printf("%-26s %8.1f %8.1f %8.1f\n", name, ScalarNs, KernelNs[0], KernelNs[1]); \
+	}
+
+static void RunBenchmarks(int len, bool* bSupported)
+{
+	int rounds = 2000000;
+	long sink = 0;
+	vector<char> seq(len), seq2(len), buf(len + 8);
+	vector<uint8_t> code(len);
+
+	RandomSeq(len, seq.data(), false); RandomSeq(len, seq2.data(), false);
+	printf("%d bp, ns per call           scalar   SSE4.1     AVX2\n", len);
+	BENCH("encode nt4", ScalarEncode(len, seq.data(), code.data()), SeqEncodeNt4(len, seq.data(), code.data()));
+	BENCH("reverse complement", ScalarReverseComplement(len, seq.data(), buf.data()), SeqReverseComplement(len, seq.data(), buf.data()));
+	BENCH("reverse copy", ScalarReverseCopy(len, seq.data(), buf.data()), SeqReverseCopy(len, seq.data(), buf.data()));
+	BENCH("self reverse complement", ScalarSelfReverseComplement(len, buf.data()), SeqSelfReverseComplement(len, buf.data()));
+	BENCH("mismatch count", sink += ScalarMismatchNum(len, seq.data(), seq2.data()), sink += SeqMismatchNum(len, seq.data(), seq2.data()));
+	if (sink == 42) printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+	int k, len, t, fail = 0, num = 0;
+	int LenArr[] = { 0, 1, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 150 };
+	bool bSupported[2];
+
+	srand(1);
+	for (k = 0; k < 2; k++) bSupported[k] = SelectSeqKernels(k);
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+	{
+		RunBenchmarks(argc > 2 ? atoi(argv[2]) : 150, bSupported);
+		return 0;
+	}
+	for (k = 0; k < 2; k++)
+	{
+		if (!bSupported[k]) continue;
+		SelectSeqKernels(k);
+		for (t = 0; t < (int)(sizeof(LenArr) / sizeof(int)); t++, num += 2) fail += CheckKernels(k, LenArr[t], false) + CheckKernels(k, LenArr[t], true);
+		for (t = 0; t < 2000; t++, num++) len = rand() % 300, fail += CheckKernels(k, len, (t & 1) == 1);
+	}
+	for (k = 0; k < 2; k++) fprintf(stderr, "SeqKernelTest: %s %s\n", KernelNameArr[k], bSupported[k] ? "tested" : "not supported by this CPU");
+	fprintf(stderr, "SeqKernelTest: %d inputs, %d failures\n", num, fail);
+
+	return fail > 0 ? 1 : 0;
+}
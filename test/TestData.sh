@@ -0,0 +1,27 @@
+# sourced by the test scripts: the simulated genomes and reads they share
+MapCaller=${MapCaller:-../bin/MapCaller}
+
+# MakeGenome in.fa out.fa "beg-end[+beg-end...] ...": one chromosome chrN per field, made of the [beg, end) pieces of in.fa
+MakeGenome()
+{
+	grep -v '>' $1 | tr -d '\n' | awk -v layout="$3" '{ n = split(layout, chr, " ");
+		for (i = 1; i <= n; i++) { printf(">chr%d\n", i); s = ""; m = split(chr[i], piece, "+");
+			for (j = 1; j <= m; j++) { split(piece[j], r, "-"); s = s substr($0, r[1] + 1, r[2] - r[1]) }
+			for (p = 1; p <= length(s); p += 70) print substr(s, p, 70) } }' > $2
+}
+
+# SimulateReads genome.fa pairs seed out1.fq out2.fq: 2x100bp pairs of ~300bp fragments, the chromosome ends are less covered
+SimulateReads()
+{
+	awk -v num=$2 -v seed=$3 -v out1=$4 -v out2=$5 'BEGIN { srand(seed); comp["A"] = "T"; comp["C"] = "G"; comp["G"] = "C"; comp["T"] = "A"; comp["N"] = "N" }
+		/^>/ { if (s != "") chr[++n] = s; s = ""; next } { s = s $0 }
+		END { chr[++n] = s; q = sprintf("%100s", ""); gsub(/ /, "I", q);
+			for (k = 0; k < num; k++) {
+				c = int(rand() * n) + 1; len = length(chr[c]); flen = 280 + int(rand() * 40);
+				p = int(rand() * (len - flen)) + 1; r1 = substr(chr[c], p, 100); f = substr(chr[c], p + flen - 100, 100);
+				r2 = ""; for (i = 100; i > 0; i--) r2 = r2 comp[substr(f, i, 1)];
+				print "@r" seed "_" k "/1\n" r1 "\n+\n" q > out1; print "@r" seed "_" k "/2\n" r2 "\n+\n" q > out2 } }' $1
+}
+
+# the reference cut into four chromosomes
+Chromosomes="0-17000 17000-35000 35000-52500 52500-70000"
@@ -0,0 +1,45 @@
+#!/bin/bash
+# checks that the bgzip-compressed VCF (-vcf *.gz) holds the text of the plain VCF, with and without -gvcf,
+# and that tabix region queries against its index return the records of the plain VCF overlapping the regions
+. ./TestData.sh
+tmp=$(mktemp -d)
+trap 'rm -rf $tmp' EXIT
+htslib=../src/htslib
+
+MakeGenome ref.fa $tmp/ref.fa "$Chromosomes"; MakeGenome mut.fa $tmp/mut.fa "$Chromosomes"
+SimulateReads $tmp/mut.fa 12000 7 $tmp/r1.fq $tmp/r2.fq
+# chromosome ends, a region of one base and one spanning most of a chromosome
+Regions="chr1:1-1200 chr1:4500-5300 chr2:10000-10000 chr3:1-17500 chr4:16000-17500"
+
+# the records of a VCF overlapping chr:beg-end (1-based, inclusive); a record ends at INFO END or with its REF allele
+InRegion()
+{
+	grep -v '^#' $1 | awk -v chr=${2%%:*} -v r=${2#*:} 'BEGIN { split(r, b, "-") }
+		$1 == chr { e = $2 + length($4) - 1; if (match($8, /(^|;)END=[0-9]+/)) { x = substr($8, RSTART, RLENGTH); sub(/.*=/, "", x); if (x + 0 > e) e = x + 0 }
+			if ($2 <= b[2] && e >= b[1]) print }'
+}
+
+$MapCaller index $tmp/ref.fa $tmp/ref > /dev/null 2>&1
+fail=0
+for opt in "" "-gvcf"; do
+	$MapCaller -i $tmp/ref -t 4 -f $tmp/r1.fq -f2 $tmp/r2.fq $opt -profile $tmp/ref.prof -vcf $tmp/out.vcf -log $tmp/log > /dev/null 2>&1
+	$MapCaller call -i $tmp/ref -t 4 -profile $tmp/ref.prof $opt -vcf $tmp/out.vcf.gz -log $tmp/log > /dev/null 2>&1
+	if [ ! -s $tmp/out.vcf ] || [ ! -s $tmp/out.vcf.gz ] || [ ! -s $tmp/out.vcf.gz.tbi ]; then
+		echo "VcfGzTest: [${opt:-default}] cannot call the variants"
+		exit 1
+	fi
+	if ! cmp -s <(grep -v '^##command_line' $tmp/out.vcf) <($htslib/bgzip -dc $tmp/out.vcf.gz | grep -v '^##command_line'); then
+		echo "VcfGzTest: [${opt:-default}] the decompressed VCF differs from the plain VCF"; fail=1
+	fi
+	n=0
+	for r in $Regions; do
+		InRegion $tmp/out.vcf $r > $tmp/expect
+		if ! $htslib/tabix $tmp/out.vcf.gz $r > $tmp/query 2>$tmp/err || ! cmp -s $tmp/expect $tmp/query; then
+			echo "VcfGzTest: [${opt:-default}] the tabix query $r differs from the plain VCF"; fail=1
+		fi
+		n=$((n + $(wc -l < $tmp/query)))
+	done
+	echo "VcfGzTest: [${opt:-default}] $(grep -vc '^#' $tmp/out.vcf) records, $n in the tabix queries"
+done
+echo "VcfGzTest: $([ $fail = 0 ] && echo "the bgzip VCF and its index match the plain VCF" || echo FAILED)"
+exit $fail